@@ -0,0 +1,828 @@
+#include <open62541/server.h>
+#include <open62541/server_config_default.h>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+extern char **environ;
+
+// ========== FUNCTION PROTOTYPES ==========
+void print_help(const char* program_name);
+
+#define MAX_STRATEGIES 8
+#define MAX_VALUE_KINDS 8
+#define MAX_EXTRA_ARGS 32
+#define MAX_BINARIES 8
+
+// ========== BENCHMARK CONFIGURATION ==========
+
+typedef enum {
+    VALUE_INT32,
+    VALUE_DOUBLE,
+    VALUE_STRING,
+    VALUE_BOOLEAN,
+    VALUE_ARRAY
+} ValueKind;
+
+typedef struct {
+    const char *name;
+    ValueKind kind;
+} ValueKindName;
+
+static const ValueKindName valueKindNames[] = {
+    {"int32", VALUE_INT32}, {"double", VALUE_DOUBLE}, {"string", VALUE_STRING},
+    {"boolean", VALUE_BOOLEAN}, {"array", VALUE_ARRAY}
+};
+
+// Shape of the synthetic address space: a tree of Objects `depth` levels
+// deep with `breadth` child Objects and `variables` Variables each. Every
+// `cycleEvery`-th Object also organizes the bench root, so the traversals
+// have to cope with reference cycles.
+typedef struct {
+    int breadth;
+    int depth;
+    int variables;
+    int cycleEvery;
+    ValueKind kinds[MAX_VALUE_KINDS];
+    size_t kindCount;
+} SpaceShape;
+
+typedef struct {
+    const char *name;
+    const char *args[4];
+} Strategy;
+
+// ========== SYNTHETIC SERVER ==========
+
+typedef struct {
+    UA_Server *server;
+    UA_UInt16 ns;
+    UA_UInt32 nextId;
+    size_t objects;
+    size_t variables;
+    size_t references;
+    const SpaceShape *shape;
+} SpaceBuilder;
+
+static void quietLog(void *context, UA_LogLevel level, UA_LogCategory category,
+                     const char *msg, va_list args) {
+}
+
+static UA_Logger quietLogger = {quietLog, NULL, NULL};
+
+static void setSyntheticValue(UA_VariableAttributes *attr, ValueKind kind, UA_UInt32 id) {
+    switch (kind) {
+    case VALUE_INT32: {
+        UA_Int32 v = (UA_Int32)id;
+        UA_Variant_setScalarCopy(&attr->value, &v, &UA_TYPES[UA_TYPES_INT32]);
+        attr->dataType = UA_TYPES[UA_TYPES_INT32].typeId;
+        break;
+    }
+    case VALUE_DOUBLE: {
+        UA_Double v = id * 0.25;
+        UA_Variant_setScalarCopy(&attr->value, &v, &UA_TYPES[UA_TYPES_DOUBLE]);
+        attr->dataType = UA_TYPES[UA_TYPES_DOUBLE].typeId;
+        break;
+    }
+    case VALUE_STRING: {
+        char text[32];
+        snprintf(text, sizeof(text), "Value %u", id);
+        UA_String v = UA_STRING(text);
+        UA_Variant_setScalarCopy(&attr->value, &v, &UA_TYPES[UA_TYPES_STRING]);
+        attr->dataType = UA_TYPES[UA_TYPES_STRING].typeId;
+        break;
+    }
+    case VALUE_BOOLEAN: {
+        UA_Boolean v = (id & 1) != 0;
+        UA_Variant_setScalarCopy(&attr->value, &v, &UA_TYPES[UA_TYPES_BOOLEAN]);
+        attr->dataType = UA_TYPES[UA_TYPES_BOOLEAN].typeId;
+        break;
+    }
+    case VALUE_ARRAY: {
+        UA_Double v[16];
+        for (size_t i = 0; i < 16; i++)
+            v[i] = id + i * 0.5;
+        UA_Variant_setArrayCopy(&attr->value, v, 16, &UA_TYPES[UA_TYPES_DOUBLE]);
+        attr->dataType = UA_TYPES[UA_TYPES_DOUBLE].typeId;
+        attr->valueRank = 1;
+        break;
+    }
+    }
+}
+
+static UA_StatusCode addSyntheticVariable(SpaceBuilder *b, UA_NodeId parent, int index) {
+    UA_UInt32 id = b->nextId++;
+    char name[32];
+    snprintf(name, sizeof(name), "Var%d", index);
+    
+    UA_VariableAttributes attr = UA_VariableAttributes_default;
+    attr.displayName = UA_LOCALIZEDTEXT("", name);
+    setSyntheticValue(&attr, b->shape->kinds[id % b->shape->kindCount], id);
+    UA_StatusCode retval = UA_Server_addVariableNode(b->server, UA_NODEID_NUMERIC(b->ns, id), parent,
+        UA_NODEID_NUMERIC(0, UA_NS0ID_HASCOMPONENT), UA_QUALIFIEDNAME(b->ns, name),
+        UA_NODEID_NUMERIC(0, UA_NS0ID_BASEDATAVARIABLETYPE), attr, NULL, NULL);
+    UA_Variant_clear(&attr.value);
+    if (retval == UA_STATUSCODE_GOOD)
+        b->variables++;
+    return retval;
+}
+
+// Add an Object named `name` below `parent` and, recursively, its subtree
+static UA_StatusCode addSyntheticObject(SpaceBuilder *b, UA_NodeId parent, UA_NodeId root,
+                                        const char *name, int level) {
+    UA_NodeId id = UA_NODEID_NUMERIC(b->ns, b->nextId++);
+    UA_ObjectAttributes attr = UA_ObjectAttributes_default;
+    attr.displayName = UA_LOCALIZEDTEXT("", (char*)name);
+    UA_StatusCode retval = UA_Server_addObjectNode(b->server, id, parent,
+        UA_NODEID_NUMERIC(0, UA_NS0ID_ORGANIZES), UA_QUALIFIEDNAME(b->ns, (char*)name),
+        UA_NODEID_NUMERIC(0, UA_NS0ID_FOLDERTYPE), attr, NULL, NULL);
+    if (retval != UA_STATUSCODE_GOOD)
+        return retval;
+    b->objects++;
+    
+    if (level > 0 && b->shape->cycleEvery > 0 && b->objects % (size_t)b->shape->cycleEvery == 0) {
+        UA_ExpandedNodeId target;
+        UA_ExpandedNodeId_init(&target);
+        target.nodeId = root;
+        if (UA_Server_addReference(b->server, id, UA_NODEID_NUMERIC(0, UA_NS0ID_ORGANIZES),
+                                   target, true) == UA_STATUSCODE_GOOD)
+            b->references++;
+    }
+    
+    for (int i = 0; i < b->shape->variables && retval == UA_STATUSCODE_GOOD; i++)
+        retval = addSyntheticVariable(b, id, i);
+    if (level >= b->shape->depth)
+        return retval;
+    for (int i = 0; i < b->shape->breadth && retval == UA_STATUSCODE_GOOD; i++) {
+        char child[32];
+        snprintf(child, sizeof(child), "Object%d", i);
+        retval = addSyntheticObject(b, id, root, child, level + 1);
+    }
+    return retval;
+}
+
+static void *serverThread(void *arg) {
+    void **ctx = (void**)arg;
+    UA_Server *server = (UA_Server*)ctx[0];
+    volatile UA_Boolean *running = (volatile UA_Boolean*)ctx[1];
+    while (*running)
+        UA_Server_run_iterate(server, true);
+    return NULL;
+}
+
+// ========== LATENCY PROXY ==========
+
+// TCP relay between uaconsole and the bench server that holds every chunk
+// for half the configured round-trip time in each direction. Chunks are
+// queued with their due time, so pipelined requests overlap on the
+// emulated link instead of queueing behind each other's delay.
+typedef struct Chunk {
+    struct Chunk *next;
+    UA_UInt64 due;
+    size_t len;
+    char data[];
+} Chunk;
+
+struct ProxyConn;
+
+typedef struct {
+    int from;
+    int to;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    Chunk *head;
+    Chunk *tail;
+    int closed;
+    struct ProxyConn *conn;
+} ProxyPipe;
+
+typedef struct ProxyConn {
+    int client;
+    int server;
+    UA_UInt64 delayUs;
+    ProxyPipe up;
+    ProxyPipe down;
+    int threads;
+    pthread_mutex_t lock;
+} ProxyConn;
+
+typedef struct {
+    int listenFd;
+    UA_UInt16 targetPort;
+    UA_UInt64 delayUs;
+    pthread_t thread;
+} Proxy;
+
+static UA_UInt64 monotonicUs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (UA_UInt64)ts.tv_sec * 1000000 + (UA_UInt64)ts.tv_nsec / 1000;
+}
+
+static void sleepUntil(UA_UInt64 due) {
+    struct timespec ts;
+    ts.tv_sec = (time_t)(due / 1000000);
+    ts.tv_nsec = (long)(due % 1000000) * 1000;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0) {}
+}
+
+// The last of the four relay threads closes the sockets
+static void proxyConn_release(ProxyConn *conn) {
+    pthread_mutex_lock(&conn->lock);
+    int remaining = --conn->threads;
+    pthread_mutex_unlock(&conn->lock);
+    if (remaining > 0)
+        return;
+    
+    ProxyPipe *pipes[2] = {&conn->up, &conn->down};
+    for (int p = 0; p < 2; p++) {
+        while (pipes[p]->head) {
+            Chunk *c = pipes[p]->head;
+            pipes[p]->head = c->next;
+            free(c);
+        }
+        pthread_mutex_destroy(&pipes[p]->lock);
+        pthread_cond_destroy(&pipes[p]->cond);
+    }
+    close(conn->client);
+    close(conn->server);
+    pthread_mutex_destroy(&conn->lock);
+    free(conn);
+}
+
+static void *proxyReader(void *arg) {
+    ProxyPipe *pipe = (ProxyPipe*)arg;
+    char buf[64 * 1024];
+    for (;;) {
+        ssize_t n = recv(pipe->from, buf, sizeof(buf), 0);
+        Chunk *c = n > 0 ? (Chunk*)malloc(sizeof(Chunk) + (size_t)n) : NULL;
+        pthread_mutex_lock(&pipe->lock);
+        if (!c) {
+            pipe->closed = 1;
+            pthread_cond_signal(&pipe->cond);
+            pthread_mutex_unlock(&pipe->lock);
+            break;
+        }
+        c->next = NULL;
+        c->due = monotonicUs() + pipe->conn->delayUs;
+        c->len = (size_t)n;
+        memcpy(c->data, buf, (size_t)n);
+        if (pipe->tail)
+            pipe->tail->next = c;
+        else
+            pipe->head = c;
+        pipe->tail = c;
+        pthread_cond_signal(&pipe->cond);
+        pthread_mutex_unlock(&pipe->lock);
+    }
+    proxyConn_release(pipe->conn);
+    return NULL;
+}
+
+static void *proxyWriter(void *arg) {
+    ProxyPipe *pipe = (ProxyPipe*)arg;
+    for (;;) {
+        pthread_mutex_lock(&pipe->lock);
+        while (!pipe->head && !pipe->closed)
+            pthread_cond_wait(&pipe->cond, &pipe->lock);
+        Chunk *c = pipe->head;
+        if (c) {
+            pipe->head = c->next;
+            if (!pipe->head)
+                pipe->tail = NULL;
+        }
+        pthread_mutex_unlock(&pipe->lock);
+        if (!c)
+            break;
+        
+        sleepUntil(c->due);
+        size_t sent = 0;
+        while (sent < c->len) {
+            ssize_t n = send(pipe->to, c->data + sent, c->len - sent, MSG_NOSIGNAL);
+            if (n <= 0)
+                break;
+            sent += (size_t)n;
+        }
+        int failed = sent < c->len;
+        free(c);
+        if (failed)
+            break;
+    }
+    shutdown(pipe->to, SHUT_WR);
+    proxyConn_release(pipe->conn);
+    return NULL;
+}
+
+static int connectLocal(UA_UInt16 port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+static void proxyPipe_init(ProxyPipe *pipe, ProxyConn *conn, int from, int to) {
+    memset(pipe, 0, sizeof(ProxyPipe));
+    pipe->from = from;
+    pipe->to = to;
+    pipe->conn = conn;
+    pthread_mutex_init(&pipe->lock, NULL);
+    pthread_cond_init(&pipe->cond, NULL);
+}
+
+static void proxyStartConnection(Proxy *proxy, int clientFd) {
+    int serverFd = connectLocal(proxy->targetPort);
+    ProxyConn *conn = serverFd >= 0 ? (ProxyConn*)calloc(1, sizeof(ProxyConn)) : NULL;
+    if (!conn) {
+        if (serverFd >= 0)
+            close(serverFd);
+        close(clientFd);
+        return;
+    }
+    conn->client = clientFd;
+    conn->server = serverFd;
+    conn->delayUs = proxy->delayUs;
+    conn->threads = 4;
+    pthread_mutex_init(&conn->lock, NULL);
+    proxyPipe_init(&conn->up, conn, clientFd, serverFd);
+    proxyPipe_init(&conn->down, conn, serverFd, clientFd);
+    
+    void *(*routines[4])(void*) = {proxyReader, proxyWriter, proxyReader, proxyWriter};
+    ProxyPipe *args[4] = {&conn->up, &conn->up, &conn->down, &conn->down};
+    for (int i = 0; i < 4; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, routines[i], args[i]) != 0) {
+            // A half-started relay cannot be unwound; the timings would be wrong anyway
+            fprintf(stderr, "Error: Could not start proxy thread\n");
+            exit(1);
+        }
+        pthread_detach(thread);
+    }
+}
+
+static void *proxyAcceptThread(void *arg) {
+    Proxy *proxy = (Proxy*)arg;
+    for (;;) {
+        int fd = accept(proxy->listenFd, NULL, NULL);
+        if (fd < 0)
+            break;
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        proxyStartConnection(proxy, fd);
+    }
+    return NULL;
+}
+
+static int proxy_start(Proxy *proxy, UA_UInt16 listenPort, UA_UInt16 targetPort, UA_UInt64 rttUs) {
+    memset(proxy, 0, sizeof(Proxy));
+    proxy->targetPort = targetPort;
+    proxy->delayUs = rttUs / 2;
+    proxy->listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    if (proxy->listenFd < 0)
+        return 0;
+    
+    int one = 1;
+    setsockopt(proxy->listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(listenPort);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(proxy->listenFd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        listen(proxy->listenFd, 64) != 0 ||
+        pthread_create(&proxy->thread, NULL, proxyAcceptThread, proxy) != 0) {
+        close(proxy->listenFd);
+        return 0;
+    }
+    return 1;
+}
+
+static void proxy_stop(Proxy *proxy) {
+    shutdown(proxy->listenFd, SHUT_RDWR);
+    pthread_join(proxy->thread, NULL);
+    close(proxy->listenFd);
+}
+
+// ========== STRATEGY RUNS ==========
+
+typedef struct {
+    double wallMs;
+    double cpuMs;
+    long rssKb;
+    int ok;
+} RunResult;
+
+// Spawn the binary, wait for it and collect wall time, CPU time and peak RSS
+static RunResult spawnTimed(const char *binary, const char **argv, int showOutput) {
+    RunResult result = {0, 0, 0, 0};
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if (!showOutput) {
+        posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+        posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+    }
+    
+    UA_UInt64 start = monotonicUs();
+    pid_t pid;
+    int spawned = posix_spawn(&pid, binary, &actions, NULL, (char**)argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if (spawned != 0) {
+        fprintf(stderr, "Error: Could not start %s: %s\n", binary, strerror(spawned));
+        return result;
+    }
+    
+    int status = 0;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) < 0)
+        return result;
+    result.wallMs = (monotonicUs() - start) / 1000.0;
+    result.cpuMs = (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000.0 +
+                   (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000.0;
+    result.rssKb = usage.ru_maxrss;
+    result.ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    return result;
+}
+
+// Run uaconsole once with the strategy's options and time it end to end,
+// connect and disconnect included
+static RunResult runOnce(const char *binary, const char *url, const char *root,
+                         const Strategy *strategy, const char **extra, size_t extraCount,
+                         int showOutput) {
+    const char *argv[16 + MAX_EXTRA_ARGS];
+    size_t argc = 0;
+    argv[argc++] = binary;
+    argv[argc++] = "--root";
+    argv[argc++] = root;
+    for (size_t i = 0; i < 4 && strategy->args[i]; i++)
+        argv[argc++] = strategy->args[i];
+    for (size_t i = 0; i < extraCount; i++)
+        argv[argc++] = extra[i];
+    argv[argc++] = url;
+    argv[argc] = NULL;
+    return spawnTimed(binary, argv, showOutput);
+}
+
+// Cold start: loading, relocation and argument parsing without a connection.
+// -h exits right after printing, so the run is dominated by process setup.
+static RunResult runStartup(const char *binary) {
+    const char *argv[] = {binary, "-h", NULL};
+    return spawnTimed(binary, argv, 0);
+}
+
+static int compareDouble(const void *a, const void *b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static int compareLong(const void *a, const void *b) {
+    long x = *(const long*)a, y = *(const long*)b;
+    return (x > y) - (x < y);
+}
+
+// ========== OPTION PARSING ==========
+
+static int parseValueKinds(const char *text, SpaceShape *shape) {
+    shape->kindCount = 0;
+    const char *p = text;
+    while (*p) {
+        size_t len = strcspn(p, ",");
+        size_t k;
+        for (k = 0; k < sizeof(valueKindNames) / sizeof(valueKindNames[0]); k++) {
+            if (strlen(valueKindNames[k].name) == len &&
+                strncmp(valueKindNames[k].name, p, len) == 0)
+                break;
+        }
+        if (k == sizeof(valueKindNames) / sizeof(valueKindNames[0]) ||
+            shape->kindCount == MAX_VALUE_KINDS)
+            return 0;
+        shape->kinds[shape->kindCount++] = valueKindNames[k].kind;
+        p += len;
+        if (*p == ',')
+            p++;
+    }
+    return shape->kindCount > 0;
+}
+
+static int parseStrategies(const char *text, const Strategy *all, size_t allCount,
+                           const Strategy **selected, size_t *count) {
+    *count = 0;
+    const char *p = text;
+    while (*p) {
+        size_t len = strcspn(p, ",");
+        size_t s;
+        for (s = 0; s < allCount; s++) {
+            if (strlen(all[s].name) == len && strncmp(all[s].name, p, len) == 0)
+                break;
+        }
+        if (s == allCount || *count == MAX_STRATEGIES)
+            return 0;
+        selected[(*count)++] = &all[s];
+        p += len;
+        if (*p == ',')
+            p++;
+    }
+    return *count > 0;
+}
+
+// ========== HELP FUNCTION ==========
+void print_help(const char* program_name) {
+    printf("UAConsole Bench - traversal benchmarks against a synthetic server\n");
+    printf("==================================================================\n\n");
+    printf("Usage: %s [OPTIONS] [-- UACONSOLE_OPTIONS]\n\n", program_name);
+    printf("Starts an in-process open62541 server with a generated address space and\n");
+    printf("times each uaconsole traversal strategy against it.\n\n");
+    printf("Options:\n");
+    printf("  -h, --help           Show this help message\n");
+    printf("  -v, --verbose        Show the output of the uaconsole runs\n");
+    printf("  --uaconsole PATH     uaconsole binary to benchmark (default: ./uaconsole);\n");
+    printf("                       repeat to compare builds, e.g. full and minimal\n");
+    printf("  --port N             Bench server port (default: 4850; the latency\n");
+    printf("                       proxy listens on N+1)\n");
+    printf("  --breadth N          Child Objects per Object (default: 4)\n");
+    printf("  --depth N            Object levels below the bench root (default: 4)\n");
+    printf("  --vars N             Variables per Object (default: 8)\n");
+    printf("  --types LIST         Variable value types, assigned round-robin:\n");
+    printf("                       int32, double, string, boolean, array\n");
+    printf("                       (default: int32,double,string,boolean)\n");
+    printf("  --cycles N           Every Nth Object also references the bench root\n");
+    printf("                       (default: 0 = no cycles)\n");
+    printf("  --rtt MS             Emulate a link with this round-trip time (default: 0)\n");
+    printf("  --runs N             Runs per strategy; the median is reported (default: 3)\n");
+    printf("  --strategies LIST    Strategies to time: recursive, batched, pipelined,\n");
+    printf("                       parallel (default: all)\n");
+    printf("  --inflight N         Window of the pipelined strategy (default: 32)\n");
+    printf("  --sessions N         Sessions of the parallel strategy (default: 4)\n");
+    printf("  --serve              Only run the server (and proxy) until interrupted\n");
+    printf("\nOptions after -- are passed to every uaconsole run, e.g. -- -f ndjson\n");
+    printf("\nEach binary's size, cold-start time (median of --runs runs of -h) and\n");
+    printf("peak RSS are reported first; the strategy tables add the peak RSS of the runs.\n");
+}
+
+// ========== MAIN FUNCTION ==========
+int main(int argc, char *argv[]) {
+    SpaceShape shape;
+    memset(&shape, 0, sizeof(SpaceShape));
+    shape.breadth = 4;
+    shape.depth = 4;
+    shape.variables = 8;
+    parseValueKinds("int32,double,string,boolean", &shape);
+    
+    const char *binaries[MAX_BINARIES];
+    size_t binary_count = 0;
+    const char *strategy_list = "recursive,batched,pipelined,parallel";
+    const char *extra[MAX_EXTRA_ARGS];
+    size_t extra_count = 0;
+    int port = 4850;
+    int rtt_ms = 0;
+    int runs = 3;
+    int verbose = 0;
+    int serve_only = 0;
+    char inflight[16] = "32";
+    char sessions[16] = "4";
+    
+    for (int i = 1; i < argc; i++) {
+        int *value = NULL;
+        const char *name = NULL;
+        if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+            print_help(argv[0]);
+            return 0;
+        } else if (strcmp(argv[i], "-v") == 0 || strcmp(argv[i], "--verbose") == 0) {
+            verbose = 1;
+        } else if (strcmp(argv[i], "--serve") == 0) {
+            serve_only = 1;
+        } else if (strcmp(argv[i], "--uaconsole") == 0 && i + 1 < argc) {
+            if (binary_count == MAX_BINARIES) {
+                printf("Error: At most %d binaries can be compared\n", MAX_BINARIES);
+                return 1;
+            }
+            binaries[binary_count++] = argv[++i];
+        } else if (strcmp(argv[i], "--strategies") == 0 && i + 1 < argc) {
+            strategy_list = argv[++i];
+        } else if (strcmp(argv[i], "--types") == 0 && i + 1 < argc) {
+            if (!parseValueKinds(argv[++i], &shape)) {
+                printf("Error: Invalid value type list: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--inflight") == 0 && i + 1 < argc) {
+            snprintf(inflight, sizeof(inflight), "%s", argv[++i]);
+        } else if (strcmp(argv[i], "--sessions") == 0 && i + 1 < argc) {
+            snprintf(sessions, sizeof(sessions), "%s", argv[++i]);
+        } else if (strcmp(argv[i], "--") == 0) {
+            for (i++; i < argc && extra_count < MAX_EXTRA_ARGS; i++)
+                extra[extra_count++] = argv[i];
+        } else if (strcmp(argv[i], "--port") == 0) {
+            value = &port; name = "port";
+        } else if (strcmp(argv[i], "--breadth") == 0) {
+            value = &shape.breadth; name = "breadth";
+        } else if (strcmp(argv[i], "--depth") == 0) {
+            value = &shape.depth; name = "depth";
+        } else if (strcmp(argv[i], "--vars") == 0) {
+            value = &shape.variables; name = "variables";
+        } else if (strcmp(argv[i], "--cycles") == 0) {
+            value = &shape.cycleEvery; name = "cycles";
+        } else if (strcmp(argv[i], "--rtt") == 0) {
+            value = &rtt_ms; name = "round-trip time";
+        } else if (strcmp(argv[i], "--runs") == 0) {
+            value = &runs; name = "runs";
+        } else {
+            printf("Unknown option: %s\n", argv[i]);
+            printf("Use %s -h for help\n", argv[0]);
+            return 1;
+        }
+        
+        if (value) {
+            if (i + 1 >= argc) {
+                printf("Error: Missing value for %s\n", name);
+                return 1;
+            }
+            *value = atoi(argv[++i]);
+            if (*value < 0 || (value == &port && (*value == 0 || *value > 65534)) ||
+                (value == &runs && *value == 0)) {
+                printf("Error: Invalid %s: %s\n", name, argv[i]);
+                return 1;
+            }
+        }
+    }
+    
+    if (binary_count == 0)
+        binaries[binary_count++] = "./uaconsole";
+    
+    Strategy strategies[] = {
+        {"recursive", {NULL}},
+        {"batched", {"-b", NULL}},
+        {"pipelined", {"--inflight", inflight, NULL}},
+        {"parallel", {"--sessions", sessions, NULL}}
+    };
+    const Strategy *selected[MAX_STRATEGIES];
+    size_t selected_count;
+    if (!parseStrategies(strategy_list, strategies, sizeof(strategies) / sizeof(strategies[0]),
+                         selected, &selected_count)) {
+        printf("Error: Invalid strategy list: %s\n", strategy_list);
+        return 1;
+    }
+    
+    // ========== SERVER SETUP ==========
+    
+    UA_ServerConfig config;
+    memset(&config, 0, sizeof(UA_ServerConfig));
+    config.logging = &quietLogger;
+    UA_StatusCode retval = UA_ServerConfig_setMinimal(&config, (UA_UInt16)port, NULL);
+    UA_Server *server = retval == UA_STATUSCODE_GOOD ? UA_Server_newWithConfig(&config) : NULL;
+    if (!server) {
+        printf("Error: Could not create the bench server\n");
+        return 1;
+    }
+    
+    SpaceBuilder builder;
+    memset(&builder, 0, sizeof(SpaceBuilder));
+    builder.server = server;
+    builder.shape = &shape;
+    builder.ns = UA_Server_addNamespace(server, "urn:uaconsole:bench");
+    builder.nextId = 1;
+    UA_NodeId root = UA_NODEID_NUMERIC(builder.ns, builder.nextId);
+    
+    UA_UInt64 buildStart = monotonicUs();
+    retval = addSyntheticObject(&builder, UA_NODEID_NUMERIC(0, UA_NS0ID_OBJECTSFOLDER), root, "Bench", 0);
+    if (retval != UA_STATUSCODE_GOOD) {
+        printf("Error: Could not build the address space: %s\n", UA_StatusCode_name(retval));
+        UA_Server_delete(server);
+        return 1;
+    }
+    size_t nodes = builder.objects + builder.variables;
+    printf("Address space: %zu Objects, %zu Variables, %zu cycle references (%.0f ms)\n",
+           builder.objects, builder.variables, builder.references,
+           (monotonicUs() - buildStart) / 1000.0);
+    
+    retval = UA_Server_run_startup(server);
+    if (retval != UA_STATUSCODE_GOOD) {
+        printf("Error: Could not start the bench server: %s\n", UA_StatusCode_name(retval));
+        UA_Server_delete(server);
+        return 1;
+    }
+    volatile UA_Boolean running = true;
+    void *serverCtx[2] = {server, (void*)&running};
+    pthread_t serverTid;
+    pthread_create(&serverTid, NULL, serverThread, serverCtx);
+    
+    Proxy proxy;
+    int url_port = port;
+    if (rtt_ms > 0) {
+        if (!proxy_start(&proxy, (UA_UInt16)(port + 1), (UA_UInt16)port, (UA_UInt64)rtt_ms * 1000)) {
+            printf("Error: Could not start the latency proxy on port %d\n", port + 1);
+            running = false;
+            pthread_join(serverTid, NULL);
+            UA_Server_run_shutdown(server);
+            UA_Server_delete(server);
+            return 1;
+        }
+        url_port = port + 1;
+    }
+    
+    char url[64];
+    char root_text[32];
+    snprintf(url, sizeof(url), "opc.tcp://127.0.0.1:%d", url_port);
+    snprintf(root_text, sizeof(root_text), "ns=%u;i=%u", builder.ns, root.identifier.numeric);
+    printf("Server: %s (root %s, RTT %d ms)\n", url, root_text, rtt_ms);
+    
+    // ========== BENCHMARK RUNS ==========
+    
+    if (serve_only) {
+        printf("\nServing; press Ctrl+C to stop\n");
+        pause();
+    } else {
+        double *wall = (double*)calloc((size_t)runs, sizeof(double));
+        double *cpu = (double*)calloc((size_t)runs, sizeof(double));
+        long *rss = (long*)calloc((size_t)runs, sizeof(long));
+        
+        printf("\n%-32s %10s %10s %10s\n", "Binary", "Size KB", "Start ms", "RSS KB");
+        for (size_t b = 0; wall && rss && b < binary_count; b++) {
+            struct stat st;
+            int ok = 0;
+            for (int r = 0; r < runs; r++) {
+                RunResult result = runStartup(binaries[b]);
+                if (result.ok) {
+                    wall[ok] = result.wallMs;
+                    rss[ok] = result.rssKb;
+                    ok++;
+                }
+            }
+            if (stat(binaries[b], &st) != 0 || ok == 0) {
+                printf("%-32s %10s\n", binaries[b], "failed");
+                continue;
+            }
+            qsort(wall, (size_t)ok, sizeof(double), compareDouble);
+            qsort(rss, (size_t)ok, sizeof(long), compareLong);
+            printf("%-32s %10.0f %10.2f %10ld\n", binaries[b], st.st_size / 1024.0,
+                   wall[ok / 2], rss[ok / 2]);
+        }
+        
+        for (size_t b = 0; wall && cpu && rss && b < binary_count; b++) {
+            printf("\n");
+            if (binary_count > 1)
+                printf("%s\n", binaries[b]);
+            printf("%-10s %5s %10s %10s %10s %10s %10s %12s\n",
+                   "Strategy", "Runs", "Min ms", "Median ms", "Max ms", "CPU ms", "RSS KB", "Nodes/s");
+            for (size_t s = 0; s < selected_count; s++) {
+                int ok = 0;
+                for (int r = 0; r < runs; r++) {
+                    RunResult result = runOnce(binaries[b], url, root_text, selected[s],
+                                               extra, extra_count, verbose);
+                    if (result.ok) {
+                        wall[ok] = result.wallMs;
+                        cpu[ok] = result.cpuMs;
+                        rss[ok] = result.rssKb;
+                        ok++;
+                    }
+                }
+                if (ok == 0) {
+                    printf("%-10s %5d %10s\n", selected[s]->name, runs, "failed");
+                    continue;
+                }
+                qsort(wall, (size_t)ok, sizeof(double), compareDouble);
+                qsort(cpu, (size_t)ok, sizeof(double), compareDouble);
+                qsort(rss, (size_t)ok, sizeof(long), compareLong);
+                double median = wall[ok / 2];
+                printf("%-10s %5d %10.1f %10.1f %10.1f %10.1f %10ld %12.0f%s\n",
+                       selected[s]->name, ok, wall[0], median, wall[ok - 1], cpu[ok / 2],
+                       rss[ok - 1], median > 0 ? nodes / (median / 1000.0) : 0.0,
+                       ok < runs ? "  (some runs failed)" : "");
+            }
+        }
+        free(wall);
+        free(cpu);
+        free(rss);
+    }
+    
+    // ========== SHUTDOWN ==========
+    
+    if (rtt_ms > 0)
+        proxy_stop(&proxy);
+    running = false;
+    pthread_join(serverTid, NULL);
+    UA_Server_run_shutdown(server);
+    UA_Server_delete(server);
+    return 0;
+}
@@ -71,160 +71,7930 @@
  * 
  * 2. Compile this program:
  *    ----------------------------------------------
- *    gcc -o uaconsole browse_opc_server.c -lopen62541 -lm
+ *    gcc -o uaconsole browse_opc_server.c -lopen62541 -lm -lpthread
  *    
  *    # Or with optimizations
- *    gcc -O2 -o uaconsole uaconsole.c -lopen62541 -lm
+ *    gcc -O2 -o uaconsole uaconsole.c -lopen62541 -lm -lpthread
  *    
  *    # Debug build with symbols
- *    gcc -g -O0 -o uaconsole uaconsole.c -lopen62541 -lm
+ *    gcc -g -O0 -o uaconsole uaconsole.c -lopen62541 -lm -lpthread
+ *    
+ *    # CMake, with optional features and a static build
+ *    cmake -S . -B build -DUACONSOLE_SHELL=OFF -DUACONSOLE_STATIC=ON
+ *    cmake --build build
+ *    
+ *    # Subsystems can be compiled out with -DUACONSOLE_WITH_<NAME>=0:
+ *    # ASYNC (pipelined traversal), EXPORT (ndjson and csv), SNAPSHOT
+ *    # (--snapshot, --load, --diff), SHELL (--shell), MONITOR (--monitor,
+ *    # --read-list, --profile-values)
  * 
  * 3. Run:
  *    ----------------------------------------------
  *    ./uaconsole opc.tcp://10.0.0.128:4840
  *    ./uaconsole -h                    # Show help
  *    ./uaconsole -v opc.tcp://...     # Verbose mode
+ *    ./uaconsole -b opc.tcp://...     # Batched breadth-first scan
+ *    ./uaconsole --inflight 32 opc.tcp://...  # Pipelined asynchronous scan
+ *    ./uaconsole --sessions 4 opc.tcp://...   # Parallel scan over 4 sessions
+ *    ./uaconsole -f ndjson opc.tcp://... > nodes.ndjson  # Machine-readable export
+ *    ./uaconsole --snapshot plant.uas opc.tcp://...       # Save a snapshot
+ *    ./uaconsole --load plant.uas                         # List it offline
+ *    ./uaconsole --diff plant.uas opc.tcp://...           # Changes since the snapshot
+ *    ./uaconsole --monitor opc.tcp://...                  # Stream value changes
+ *    ./uaconsole --read-list tags.txt --interval 100 opc.tcp://...  # Poll registered nodes
+ *    ./uaconsole --targets plants.txt -f ndjson > fleet.ndjson       # Scan many servers
+ *    ./uaconsole --shell opc.tcp://...                    # Interactive browsing
  * 
  * ============================================================================
  */
 
+// ========== FEATURE SELECTION ==========
+// Every subsystem is built unless it is switched off with -D...=0
+#ifndef UACONSOLE_WITH_ASYNC
+#define UACONSOLE_WITH_ASYNC 1
+#endif
+#ifndef UACONSOLE_WITH_EXPORT
+#define UACONSOLE_WITH_EXPORT 1
+#endif
+#ifndef UACONSOLE_WITH_SNAPSHOT
+#define UACONSOLE_WITH_SNAPSHOT 1
+#endif
+#ifndef UACONSOLE_WITH_SHELL
+#define UACONSOLE_WITH_SHELL 1
+#endif
+#ifndef UACONSOLE_WITH_MONITOR
+#define UACONSOLE_WITH_MONITOR 1
+#endif
+
 #include <open62541/client_config_default.h>
 #include <open62541/client_highlevel.h>
+#if UACONSOLE_WITH_ASYNC
+#include <open62541/client_highlevel_async.h>
+#endif
+#if UACONSOLE_WITH_MONITOR
+#include <open62541/client_subscriptions.h>
+#endif
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
 // ========== FUNCTION PROTOTYPES ==========
 void print_help(const char* program_name);
 
-// Function for recursive node traversal and value reading
-static void browseAndReadNode(UA_Client *client, UA_NodeId nodeId, int depth, int verbose) {
-    
-    // Get node attributes
-    UA_NodeClass nodeClass;
-    UA_QualifiedName browseName;
-    
-    if (UA_Client_readNodeClassAttribute(client, nodeId, &nodeClass) != UA_STATUSCODE_GOOD ||
-        UA_Client_readBrowseNameAttribute(client, nodeId, &browseName) != UA_STATUSCODE_GOOD) {
+// Batch size used when the server does not report an operation limit
+#define DEFAULT_BATCH_SIZE 500
+
+// ========== TIMING STATISTICS ==========
+
+// Per-service latency samples collected for --stats. Every timed call
+// records one sample in microseconds; the report at exit sorts them to
+// find the percentiles. Byte counts are the binary-encoded request and
+// response bodies, which is as close to the wire as the client API goes.
+typedef enum {
+    STAT_CONNECT,
+    STAT_BROWSE,
+    STAT_BROWSENEXT,
+    STAT_READ_VALUE,
+    STAT_READ_ATTRIBUTE,
+    STAT_TRANSLATE,
+    STAT_FLUSH,
+    STAT_COUNT
+} StatKind;
+
+static const char *statNames[STAT_COUNT] = {
+    "Connect", "Browse", "BrowseNext", "Read (Value)", "Read (other)", "TranslatePaths",
+    "Output flush"
+};
+
+typedef struct {
+    UA_UInt32 *samples;
+    size_t size;
+    size_t capacity;
+    UA_UInt64 operations;
+    UA_UInt64 bytesSent;
+    UA_UInt64 bytesReceived;
+} StatSeries;
+
+static struct {
+    int enabled;
+    StatSeries series[STAT_COUNT];
+    size_t nodes;
+    UA_UInt64 started;
+    clock_t cpuStarted;
+} stats;
+
+// Worker sessions record concurrently
+static pthread_mutex_t statsLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Monotonic clock in microseconds
+static UA_UInt64 stats_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (UA_UInt64)ts.tv_sec * 1000000 + (UA_UInt64)ts.tv_nsec / 1000;
+}
+
+static void stats_start(void) {
+    stats.enabled = 1;
+    stats.started = stats_now();
+    stats.cpuStarted = clock();
+}
+
+// Record one completed request that was issued at `start`
+static void stats_record(StatKind kind, UA_UInt64 start, size_t operations,
+                         size_t sent, size_t received) {
+    if (!stats.enabled)
         return;
-    }
     
-    // Create indentation for hierarchy visualization
-    char indent[64] = {0};
-    for (int i = 0; i < depth && i < 60; i++) {
-        indent[i] = ' ';
-        indent[i+1] = ' ';
+    UA_UInt64 elapsed = stats_now() - start;
+    pthread_mutex_lock(&statsLock);
+    StatSeries *s = &stats.series[kind];
+    if (s->size == s->capacity) {
+        size_t capacity = s->capacity ? s->capacity * 2 : 256;
+        UA_UInt32 *samples = (UA_UInt32*)realloc(s->samples, capacity * sizeof(UA_UInt32));
+        if (!samples) {
+            pthread_mutex_unlock(&statsLock);
+            return;
+        }
+        s->samples = samples;
+        s->capacity = capacity;
     }
+    s->samples[s->size++] = elapsed > UINT32_MAX ? UINT32_MAX : (UA_UInt32)elapsed;
+    s->operations += operations;
+    s->bytesSent += sent;
+    s->bytesReceived += received;
+    pthread_mutex_unlock(&statsLock);
+}
+
+// Fleet scans add up the nodes of every target
+static void stats_addNodes(size_t nodes) {
+    pthread_mutex_lock(&statsLock);
+    stats.nodes += nodes;
+    pthread_mutex_unlock(&statsLock);
+}
+
+// Encoded size of a request or response, only computed when collecting
+static size_t stats_size(const void *message, const UA_DataType *type) {
+    return stats.enabled ? UA_calcSizeBinary(message, type) : 0;
+}
+
+static int compareSample(const void *a, const void *b) {
+    UA_UInt32 x = *(const UA_UInt32*)a, y = *(const UA_UInt32*)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile of a sorted series, in milliseconds
+static double stats_percentile(const StatSeries *s, double p) {
+    size_t rank = (size_t)(p / 100.0 * (double)s->size + 0.999999);
+    if (rank < 1)
+        rank = 1;
+    if (rank > s->size)
+        rank = s->size;
+    return s->samples[rank - 1] / 1000.0;
+}
+
+// Print the timing report to stderr and release the samples
+static void stats_report(void) {
+    if (!stats.enabled)
+        return;
+    fflush(stdout);
     
-    // Display node information
-    printf("%s%.*s", indent, (int)browseName.name.length, browseName.name.data);
-    
-    // Format NodeId for display
-    char nodeIdStr[256];
-    snprintf(nodeIdStr, sizeof(nodeIdStr), " [ns=%u;", nodeId.namespaceIndex);
+    double wall = (stats_now() - stats.started) / 1000000.0;
+    double cpu = (double)(clock() - stats.cpuStarted) / CLOCKS_PER_SEC;
+    UA_UInt64 requests = 0, sent = 0, received = 0;
     
-    if (nodeId.identifierType == UA_NODEIDTYPE_NUMERIC) {
-        char temp[64];
-        snprintf(temp, sizeof(temp), "i=%u]", nodeId.identifier.numeric);
-        strncat(nodeIdStr, temp, sizeof(nodeIdStr) - strlen(nodeIdStr) - 1);
-    } else if (nodeId.identifierType == UA_NODEIDTYPE_STRING) {
-        char temp[256];
-        snprintf(temp, sizeof(temp), "s=%.*s]", 
-                (int)nodeId.identifier.string.length,
-                nodeId.identifier.string.data);
-        strncat(nodeIdStr, temp, sizeof(nodeIdStr) - strlen(nodeIdStr) - 1);
+    fprintf(stderr, "\n=== TIMING STATISTICS ===\n");
+    fprintf(stderr, "%-14s %8s %10s %12s %12s %9s %9s %9s %9s\n",
+            "Service", "Requests", "Operations", "Sent", "Received",
+            "p50 ms", "p95 ms", "p99 ms", "max ms");
+    for (int k = 0; k < STAT_COUNT; k++) {
+        StatSeries *s = &stats.series[k];
+        if (s->size == 0)
+            continue;
+        qsort(s->samples, s->size, sizeof(UA_UInt32), compareSample);
+        fprintf(stderr, "%-14s %8zu %10llu %12llu %12llu %9.2f %9.2f %9.2f %9.2f\n",
+                statNames[k], s->size, (unsigned long long)s->operations,
+                (unsigned long long)s->bytesSent, (unsigned long long)s->bytesReceived,
+                stats_percentile(s, 50), stats_percentile(s, 95),
+                stats_percentile(s, 99), s->samples[s->size - 1] / 1000.0);
+        if (k != STAT_CONNECT && k != STAT_FLUSH) {
+            requests += s->size;
+            sent += s->bytesSent;
+            received += s->bytesReceived;
+        }
+        free(s->samples);
+        memset(s, 0, sizeof(*s));
     }
+    fprintf(stderr, "Requests sent:  %llu (%llu bytes sent, %llu received)\n",
+            (unsigned long long)requests, (unsigned long long)sent,
+            (unsigned long long)received);
+    fprintf(stderr, "Nodes:          %zu\n", stats.nodes);
+    fprintf(stderr, "Wall time:      %.3f s (client CPU %.3f s)\n", wall, cpu);
+    if (wall > 0)
+        fprintf(stderr, "Throughput:     %.1f nodes/s\n", stats.nodes / wall);
+}
+
+// ========== ADAPTIVE RATE CONTROL ==========
+
+// Keeps scans from starving the server's cyclic clients. --max-rps is a
+// hard ceiling: requests are spaced at least 1/rps apart. With --adaptive
+// an AIMD controller scales the batch sizes, the pipelining window and the
+// number of sessions with a request outstanding between 1/64 and the
+// configured values. It starts at 1/8; every response without signs of
+// overload adds 1/32, an overload signal halves the scale, at most once
+// per round trip. Overload is a Bad_TooManyOperations,
+// Bad_ResourceUnavailable or Bad_Timeout result, or a round trip several
+// times the fastest one seen on this server for requests of about the
+// same size. The baseline is kept per power-of-two batch size: a round
+// trip has a roughly fixed cost, so a halved batch spends more time per
+// operation without the server being any slower.
+//
+// Nodes refused with an overload status are not lost: every engine sends
+// them again at the reduced scale, and gives up on them only after
+// THROTTLE_RETRIES overloaded responses in a row.
+//
+// One Throttle describes one server. Scans use the process-wide instance;
+// fleet workers bind their own for the target they are scanning.
+
+#define THROTTLE_MIN_SCALE (1.0 / 64)
+#define THROTTLE_START_SCALE (1.0 / 8)
+#define THROTTLE_STEP (1.0 / 32)
+#define THROTTLE_LATENCY_FACTOR 4.0     // Round trip over the fastest of its size class
+#define THROTTLE_LATENCY_FLOOR 20000    // Slower requests only count from 20 ms (us)
+#define THROTTLE_HOLD_MIN 100000        // Shortest pause between two decreases (us)
+#define THROTTLE_SIZE_CLASSES 32        // Batch sizes 1, 2-3, 4-7, ...
+#define THROTTLE_RETRIES 8              // Overloaded responses in a row before work is dropped
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    UA_UInt64 nextSlot;             // Earliest time for the next request (us)
+    double scale;
+    double lowestScale;
+    double bestRtt[THROTTLE_SIZE_CLASSES];  // Fastest round trip per size class (us), slowly forgotten
+    UA_UInt64 holdUntil;            // No further decrease before this
+    size_t concurrency;             // Sessions sharing this server
+    size_t active;                  // Synchronous requests outstanding
+    size_t decreases;
+} Throttle;
+
+static struct {
+    int adaptive;
+    double maxRps;                  // 0 = no ceiling
+} throttleConfig;
+
+static Throttle mainThrottle = {
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, 1.0, 1.0, {0.0}, 0, 1, 0, 0
+};
+static __thread Throttle *boundThrottle;
+
+static void throttle_init(Throttle *t) {
+    pthread_mutex_init(&t->lock, NULL);
+    pthread_cond_init(&t->cond, NULL);
+    t->nextSlot = 0;
+    t->scale = throttleConfig.adaptive ? THROTTLE_START_SCALE : 1.0;
+    t->lowestScale = t->scale;
+    for (size_t i = 0; i < THROTTLE_SIZE_CLASSES; i++)
+        t->bestRtt[i] = 0.0;
+    t->holdUntil = 0;
+    t->concurrency = 1;
+    t->active = 0;
+    t->decreases = 0;
+}
+
+static void throttle_destroy(Throttle *t) {
+    pthread_mutex_destroy(&t->lock);
+    pthread_cond_destroy(&t->cond);
+}
+
+static void throttle_configure(int adaptive, double maxRps) {
+    throttleConfig.adaptive = adaptive;
+    throttleConfig.maxRps = maxRps;
+    mainThrottle.scale = mainThrottle.lowestScale = adaptive ? THROTTLE_START_SCALE : 1.0;
+}
+
+// Requests of the calling thread go to this server; NULL for the main one
+static void throttle_bind(Throttle *t) {
+    boundThrottle = t;
+}
+
+static Throttle *throttle_current(void) {
+    return boundThrottle ? boundThrottle : &mainThrottle;
+}
+
+// Configured batch size or window scaled by the controller, at least 1
+static size_t throttle_scaled(size_t configured) {
+    if (!throttleConfig.adaptive || configured <= 1)
+        return configured;
+    Throttle *t = throttle_current();
+    pthread_mutex_lock(&t->lock);
+    double n = (double)configured * t->scale + 0.5;
+    pthread_mutex_unlock(&t->lock);
+    return n < 1.0 ? 1 : n > (double)configured ? configured : (size_t)n;
+}
+
+// Sleep until the --max-rps slot of the next request
+static void throttle_pace(void) {
+    if (throttleConfig.maxRps <= 0.0)
+        return;
+    Throttle *t = throttle_current();
+    pthread_mutex_lock(&t->lock);
+    UA_UInt64 now = stats_now();
+    UA_UInt64 slot = t->nextSlot > now ? t->nextSlot : now;
+    t->nextSlot = slot + (UA_UInt64)(1000000.0 / throttleConfig.maxRps);
+    pthread_mutex_unlock(&t->lock);
+    if (slot > now) {
+        struct timespec ts;
+        ts.tv_sec = (time_t)((slot - now) / 1000000);
+        ts.tv_nsec = (long)((slot - now) % 1000000) * 1000L;
+        nanosleep(&ts, NULL);
+    }
+}
+
+// Index of the power-of-two size class of a request
+static size_t throttle_sizeClass(size_t operations) {
+    size_t sizeClass = 0;
+    while (operations > 1 && sizeClass < THROTTLE_SIZE_CLASSES - 1) {
+        operations >>= 1;
+        sizeClass++;
+    }
+    return sizeClass;
+}
+
+static int throttle_overloadStatus(UA_StatusCode code) {
+    return code == UA_STATUSCODE_BADTOOMANYOPERATIONS ||
+           code == UA_STATUSCODE_BADRESOURCEUNAVAILABLE ||
+           code == UA_STATUSCODE_BADTIMEOUT;
+}
+
+// Feed one response, issued at start for `operations` operations, to the
+// controller. status is the service result or the first overload code
+// among the operation results.
+static void throttle_observe(UA_UInt64 start, size_t operations, UA_StatusCode status) {
+    if (!throttleConfig.adaptive)
+        return;
+    Throttle *t = throttle_current();
+    UA_UInt64 now = stats_now();
+    UA_UInt64 elapsed = now - start;
     
-    printf(" %s", nodeIdStr);
-    
-    // Determine node type
-    switch (nodeClass) {
-        case UA_NODECLASS_OBJECT:
-            printf(" (Object)\n");
-            break;
-        case UA_NODECLASS_VARIABLE:
-            printf(" (Variable)");
-            // Try to read variable value
-            UA_Variant value;
-            UA_Variant_init(&value);
-            UA_StatusCode readStatus = UA_Client_readValueAttribute(client, nodeId, &value);
-            
-            if (readStatus == UA_STATUSCODE_GOOD && !UA_Variant_isEmpty(&value)) {
-                printf(" = ");
-                
-                // Display value based on type
-                if (UA_Variant_hasScalarType(&value, &UA_TYPES[UA_TYPES_BOOLEAN])) {
-                    printf("%s", *(UA_Boolean*)value.data ? "true" : "false");
-                } else if (UA_Variant_hasScalarType(&value, &UA_TYPES[UA_TYPES_UINT16])) {
-                    printf("%u", *(UA_UInt16*)value.data);
-                } else if (UA_Variant_hasScalarType(&value, &UA_TYPES[UA_TYPES_UINT32])) {
-                    printf("%u", *(UA_UInt32*)value.data);
-                } else if (UA_Variant_hasScalarType(&value, &UA_TYPES[UA_TYPES_FLOAT])) {
-                    printf("%.2f", *(UA_Float*)value.data);
-                } else if (UA_Variant_hasScalarType(&value, &UA_TYPES[UA_TYPES_DATETIME])) {
-                    UA_DateTimeStruct dts = UA_DateTime_toStruct(*(UA_DateTime*)value.data);
-                    printf("%04u-%02u-%02u %02u:%02u:%02u", 
-                           dts.year, dts.month, dts.day, 
-                           dts.hour, dts.min, dts.sec);
-                } else {
-                    // For other types, display type name
-                    printf("[%s]", value.type->typeName);
-                }
-            } else {
-                printf(" [Read error: 0x%08X]", readStatus);
-            }
-            printf("\n");
-            UA_Variant_clear(&value);
+    pthread_mutex_lock(&t->lock);
+    int overload = throttle_overloadStatus(status);
+    if (status == UA_STATUSCODE_GOOD) {
+        double *best = &t->bestRtt[throttle_sizeClass(operations)];
+        overload = *best > 0.0 && elapsed > THROTTLE_LATENCY_FLOOR &&
+                   (double)elapsed > *best * THROTTLE_LATENCY_FACTOR;
+        if (*best == 0.0 || (double)elapsed < *best)
+            *best = (double)elapsed;
+        else
+            *best *= 1.001;             // Let a lucky outlier age out
+    }
+    if (overload) {
+        // Responses already in flight carry the same signal; wait a round trip
+        if (now >= t->holdUntil) {
+            t->scale = t->scale / 2 < THROTTLE_MIN_SCALE ? THROTTLE_MIN_SCALE : t->scale / 2;
+            if (t->scale < t->lowestScale)
+                t->lowestScale = t->scale;
+            t->holdUntil = now + (elapsed > THROTTLE_HOLD_MIN ? elapsed : THROTTLE_HOLD_MIN);
+            t->decreases++;
+        }
+    } else if (status == UA_STATUSCODE_GOOD) {
+        t->scale = t->scale + THROTTLE_STEP > 1.0 ? 1.0 : t->scale + THROTTLE_STEP;
+    }
+    pthread_cond_broadcast(&t->cond);
+    pthread_mutex_unlock(&t->lock);
+}
+
+// Sessions that may have a request outstanding at the current scale
+static size_t throttle_sessionLimit(const Throttle *t) {
+    double n = (double)t->concurrency * t->scale + 0.5;
+    return n < 1.0 ? 1 : (size_t)n;
+}
+
+// Around every synchronous service call: pace it and, when several
+// sessions share the server, hold it back while the scaled number of
+// requests is outstanding. Returns the start time for throttle_end().
+static UA_UInt64 throttle_begin(void) {
+    throttle_pace();
+    Throttle *t = throttle_current();
+    if (throttleConfig.adaptive && t->concurrency > 1) {
+        pthread_mutex_lock(&t->lock);
+        while (t->active >= throttle_sessionLimit(t))
+            pthread_cond_wait(&t->cond, &t->lock);
+        t->active++;
+        pthread_mutex_unlock(&t->lock);
+    }
+    return stats_now();
+}
+
+static void throttle_end(UA_UInt64 start, size_t operations, UA_StatusCode status) {
+    Throttle *t = throttle_current();
+    if (throttleConfig.adaptive && t->concurrency > 1) {
+        pthread_mutex_lock(&t->lock);
+        t->active--;
+        pthread_mutex_unlock(&t->lock);
+    }
+    throttle_observe(start, operations, status);
+}
+
+// Sessions about to share the current server (parallel traversal)
+static void throttle_setConcurrency(size_t sessions) {
+    Throttle *t = throttle_current();
+    pthread_mutex_lock(&t->lock);
+    t->concurrency = sessions > 0 ? sessions : 1;
+    pthread_mutex_unlock(&t->lock);
+}
+
+// Worst of the service result and the operation results, as far as the
+// controller is concerned
+static UA_StatusCode throttle_readStatus(const UA_ReadResponse *response) {
+    for (size_t i = 0; i < response->resultsSize; i++) {
+        if (response->results[i].hasStatus && throttle_overloadStatus(response->results[i].status))
+            return response->results[i].status;
+    }
+    return response->responseHeader.serviceResult;
+}
+
+static UA_StatusCode throttle_browseStatus(UA_StatusCode serviceResult,
+                                           const UA_BrowseResult *results, size_t resultsSize) {
+    for (size_t i = 0; i < resultsSize; i++) {
+        if (throttle_overloadStatus(results[i].statusCode))
+            return results[i].statusCode;
+    }
+    return serviceResult;
+}
+
+// Called once per response with whether any of it was refused for
+// overload; *streak counts such responses in a row. Returns 1 if the
+// refused work is to be sent again.
+static int throttle_retry(unsigned *streak, int overloaded) {
+    if (!overloaded) {
+        *streak = 0;
+        return 0;
+    }
+    return ++*streak <= THROTTLE_RETRIES;
+}
+
+// Pause a synchronous engine before it sends refused work again: until
+// the controller's hold after its last decrease ends, at least
+// THROTTLE_HOLD_MIN
+static void throttle_backoff(void) {
+    Throttle *t = throttle_current();
+    pthread_mutex_lock(&t->lock);
+    UA_UInt64 now = stats_now();
+    UA_UInt64 wait = t->holdUntil > now + THROTTLE_HOLD_MIN ? t->holdUntil - now : THROTTLE_HOLD_MIN;
+    pthread_mutex_unlock(&t->lock);
+    struct timespec ts;
+    ts.tv_sec = (time_t)(wait / 1000000);
+    ts.tv_nsec = (long)(wait % 1000000) * 1000L;
+    nanosleep(&ts, NULL);
+}
+
+static void throttle_report(const Throttle *t) {
+    if (!throttleConfig.adaptive)
+        return;
+    printf("Rate control: scale %.3f at the end (lowest %.3f), %zu back-offs\n",
+           t->scale, t->lowestScale, t->decreases);
+}
+
+// ========== SERVICE CALLS ==========
+
+// Timed and throttled wrappers: the kind of a Read is taken from its first item
+static UA_BrowseResponse timedBrowse(UA_Client *client, const UA_BrowseRequest request) {
+    UA_UInt64 start = throttle_begin();
+    UA_BrowseResponse response = UA_Client_Service_browse(client, request);
+    throttle_end(start, request.nodesToBrowseSize,
+                 throttle_browseStatus(response.responseHeader.serviceResult,
+                                       response.results, response.resultsSize));
+    stats_record(STAT_BROWSE, start, request.nodesToBrowseSize,
+                 stats_size(&request, &UA_TYPES[UA_TYPES_BROWSEREQUEST]),
+                 stats_size(&response, &UA_TYPES[UA_TYPES_BROWSERESPONSE]));
+    return response;
+}
+
+static UA_BrowseNextResponse timedBrowseNext(UA_Client *client,
+                                             const UA_BrowseNextRequest request) {
+    UA_UInt64 start = throttle_begin();
+    UA_BrowseNextResponse response = UA_Client_Service_browseNext(client, request);
+    throttle_end(start, request.continuationPointsSize,
+                 throttle_browseStatus(response.responseHeader.serviceResult,
+                                       response.results, response.resultsSize));
+    stats_record(STAT_BROWSENEXT, start, request.continuationPointsSize,
+                 stats_size(&request, &UA_TYPES[UA_TYPES_BROWSENEXTREQUEST]),
+                 stats_size(&response, &UA_TYPES[UA_TYPES_BROWSENEXTRESPONSE]));
+    return response;
+}
+
+static StatKind readKind(const UA_ReadRequest *request) {
+    return request->nodesToReadSize > 0 &&
+           request->nodesToRead[0].attributeId == UA_ATTRIBUTEID_VALUE
+           ? STAT_READ_VALUE : STAT_READ_ATTRIBUTE;
+}
+
+static UA_ReadResponse timedRead(UA_Client *client, const UA_ReadRequest request) {
+    UA_UInt64 start = throttle_begin();
+    UA_ReadResponse response = UA_Client_Service_read(client, request);
+    throttle_end(start, request.nodesToReadSize, throttle_readStatus(&response));
+    stats_record(readKind(&request), start, request.nodesToReadSize,
+                 stats_size(&request, &UA_TYPES[UA_TYPES_READREQUEST]),
+                 stats_size(&response, &UA_TYPES[UA_TYPES_READRESPONSE]));
+    return response;
+}
+
+// ========== OUTPUT BUFFER ==========
+
+// Buffered writer for the node listing. The caller owns the storage; data
+// reaches the stream with one fwrite per flush, and the hot-path
+// formatters below avoid printf-style varargs entirely. Without a stream
+// the buffer is a scratch area that silently truncates.
+typedef struct {
+    char *data;
+    size_t size;
+    size_t capacity;
+    FILE *fp;
+    UA_UInt64 flushInterval;    // Microseconds between out_tick flushes, 0 = only when full
+    UA_UInt64 flushedAt;
+    int intermediate;           // Stream is copied to another OutBuf; not counted by --stats
+} OutBuf;
+
+// Streamed listings reach the consumer at least this often on slow scans
+#define OUT_FLUSH_INTERVAL_US 1000000
+
+static void out_init(OutBuf *out, char *storage, size_t capacity, FILE *fp) {
+    out->data = storage;
+    out->size = 0;
+    out->capacity = capacity;
+    out->fp = fp;
+    out->flushInterval = 0;
+    out->flushedAt = 0;
+    out->intermediate = 0;
+}
+
+static void out_flush(OutBuf *out) {
+    if (out->size > 0) {
+        UA_UInt64 start = stats_now();
+        fwrite(out->data, 1, out->size, out->fp);
+        if (!out->intermediate)
+            stats_record(STAT_FLUSH, start, 0, out->size, 0);
+        out->flushedAt = start;
+    }
+    out->size = 0;
+}
+
+// Called after every record: flush once the interval has passed, through
+// the stdio buffer too, so a pipe sees the records without waiting for
+// the buffer to fill
+static void out_tick(OutBuf *out) {
+    if (out->flushInterval == 0 || out->size == 0 ||
+        stats_now() - out->flushedAt < out->flushInterval)
+        return;
+    out_flush(out);
+    fflush(out->fp);
+}
+
+static void out_write(OutBuf *out, const char *s, size_t len) {
+    if (!out->fp && len > out->capacity - out->size)
+        len = out->capacity - out->size;    // Scratch buffer: truncate
+    if (len > out->capacity - out->size) {
+        out_flush(out);
+        if (len > out->capacity) {
+            fwrite(s, 1, len, out->fp);
+            return;
+        }
+    }
+    memcpy(&out->data[out->size], s, len);
+    out->size += len;
+}
+
+static void out_char(OutBuf *out, char c) {
+    if (out->size == out->capacity) {
+        if (!out->fp)
+            return;
+        out_flush(out);
+    }
+    out->data[out->size++] = c;
+}
+
+static void out_str(OutBuf *out, const char *s) {
+    out_write(out, s, strlen(s));
+}
+
+static void out_uastr(OutBuf *out, const UA_String *s) {
+    out_write(out, (const char*)s->data, s->length);
+}
+
+static void out_u64(OutBuf *out, UA_UInt64 v) {
+    char tmp[20];
+    size_t n = 0;
+    do {
+        tmp[sizeof(tmp) - ++n] = (char)('0' + v % 10);
+        v /= 10;
+    } while (v > 0);
+    out_write(out, &tmp[sizeof(tmp) - n], n);
+}
+
+static void out_i64(OutBuf *out, UA_Int64 v) {
+    if (v < 0) {
+        out_char(out, '-');
+        out_u64(out, (UA_UInt64)0 - (UA_UInt64)v);
+    } else {
+        out_u64(out, (UA_UInt64)v);
+    }
+}
+
+// Zero-padded decimal with a fixed minimum width
+static void out_u32pad(OutBuf *out, UA_UInt32 v, size_t width) {
+    char tmp[10];
+    size_t n = 0;
+    do {
+        tmp[sizeof(tmp) - ++n] = (char)('0' + v % 10);
+        v /= 10;
+    } while (v > 0 && n < sizeof(tmp));
+    for (; n < width && n < sizeof(tmp); n++)
+        tmp[sizeof(tmp) - n - 1] = '0';
+    out_write(out, &tmp[sizeof(tmp) - n], n);
+}
+
+// Fixed-width uppercase hex, as in "%08X"
+static void out_hex(OutBuf *out, UA_UInt64 v, size_t digits) {
+    static const char hex[] = "0123456789ABCDEF";
+    char tmp[16];
+    for (size_t i = 0; i < digits && i < sizeof(tmp); i++)
+        tmp[digits - 1 - i] = hex[(v >> (4 * i)) & 0xF];
+    out_write(out, tmp, digits);
+}
+
+static void out_double(OutBuf *out, double v, int precision) {
+    char tmp[64];
+    int n = snprintf(tmp, sizeof(tmp), "%.*f", precision, v);
+    if (n > 0)
+        out_write(out, tmp, (size_t)n < sizeof(tmp) ? (size_t)n : sizeof(tmp) - 1);
+}
+
+static void out_base64(OutBuf *out, const UA_ByteString *bs) {
+    static const char b64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t i = 0;
+    for (; i + 2 < bs->length; i += 3) {
+        UA_UInt32 v = ((UA_UInt32)bs->data[i] << 16) | ((UA_UInt32)bs->data[i+1] << 8) | bs->data[i+2];
+        char quad[4] = {b64[(v >> 18) & 63], b64[(v >> 12) & 63], b64[(v >> 6) & 63], b64[v & 63]};
+        out_write(out, quad, 4);
+    }
+    if (i < bs->length) {
+        UA_UInt32 v = (UA_UInt32)bs->data[i] << 16;
+        if (i + 1 < bs->length)
+            v |= (UA_UInt32)bs->data[i+1] << 8;
+        char quad[4] = {b64[(v >> 18) & 63], b64[(v >> 12) & 63],
+                        i + 1 < bs->length ? b64[(v >> 6) & 63] : '=', '='};
+        out_write(out, quad, 4);
+    }
+}
+
+static void out_guid(OutBuf *out, const UA_Guid *g) {
+    out_hex(out, g->data1, 8);
+    out_char(out, '-');
+    out_hex(out, g->data2, 4);
+    out_char(out, '-');
+    out_hex(out, g->data3, 4);
+    out_char(out, '-');
+    for (size_t i = 0; i < 8; i++) {
+        if (i == 2)
+            out_char(out, '-');
+        out_hex(out, g->data4[i], 2);
+    }
+}
+
+// NodeId in the "ns=<n>;<type>=<id>" notation
+static void out_nodeid(OutBuf *out, const UA_NodeId *id) {
+    out_str(out, "ns=");
+    out_u64(out, id->namespaceIndex);
+    switch (id->identifierType) {
+        case UA_NODEIDTYPE_NUMERIC:
+            out_str(out, ";i=");
+            out_u64(out, id->identifier.numeric);
+            break;
+        case UA_NODEIDTYPE_STRING:
+            out_str(out, ";s=");
+            out_uastr(out, &id->identifier.string);
             break;
-        case UA_NODECLASS_METHOD:
-            printf(" (Method)\n");
+        case UA_NODEIDTYPE_GUID:
+            out_str(out, ";g=");
+            out_guid(out, &id->identifier.guid);
+            break;
+        case UA_NODEIDTYPE_BYTESTRING:
+            out_str(out, ";b=");
+            out_base64(out, &id->identifier.byteString);
+            break;
+    }
+}
+
+static void out_datetime(OutBuf *out, UA_DateTime t) {
+    UA_DateTimeStruct dts = UA_DateTime_toStruct(t);
+    out_u32pad(out, dts.year, 4);
+    out_char(out, '-');
+    out_u32pad(out, dts.month, 2);
+    out_char(out, '-');
+    out_u32pad(out, dts.day, 2);
+    out_char(out, ' ');
+    out_u32pad(out, dts.hour, 2);
+    out_char(out, ':');
+    out_u32pad(out, dts.min, 2);
+    out_char(out, ':');
+    out_u32pad(out, dts.sec, 2);
+}
+
+static void out_json_string(OutBuf *out, const char *s, size_t len) {
+    out_char(out, '"');
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)s[i];
+        if (c == '"' || c == '\\') {
+            out_char(out, '\\');
+            out_char(out, (char)c);
+        } else if (c == '\n') {
+            out_str(out, "\\n");
+        } else if (c == '\r') {
+            out_str(out, "\\r");
+        } else if (c == '\t') {
+            out_str(out, "\\t");
+        } else if (c < 0x20) {
+            out_str(out, "\\u00");
+            out_hex(out, c, 2);
+        } else {
+            out_char(out, (char)c);
+        }
+    }
+    out_char(out, '"');
+}
+
+static const char *nodeClassName(UA_NodeClass nodeClass) {
+    switch (nodeClass) {
+        case UA_NODECLASS_OBJECT:        return "Object";
+        case UA_NODECLASS_VARIABLE:      return "Variable";
+        case UA_NODECLASS_METHOD:        return "Method";
+        case UA_NODECLASS_OBJECTTYPE:    return "ObjectType";
+        case UA_NODECLASS_VARIABLETYPE:  return "VariableType";
+        case UA_NODECLASS_REFERENCETYPE: return "ReferenceType";
+        case UA_NODECLASS_DATATYPE:      return "DataType";
+        case UA_NODECLASS_VIEW:          return "View";
+        default:                         return "Unknown";
+    }
+}
+
+// ========== VALUE FORMATTER ==========
+
+// Text form of values of any type, written straight into an OutBuf. The
+// writers are looked up by UA_DataType kind; structures, unions and
+// decoded ExtensionObjects are printed member by member, arrays up to
+// valueArrayLimit elements (0 = all). Strings nested in arrays and
+// structures are quoted.
+#define VALUE_ARRAY_LIMIT 16
+#define VALUE_MAX_NESTING 8
+
+static size_t valueArrayLimit = VALUE_ARRAY_LIMIT;
+
+typedef void (*ValueWriter)(OutBuf *out, const void *p, const UA_DataType *type, int depth);
+
+static void out_typed(OutBuf *out, const void *p, const UA_DataType *type, int depth);
+
+static void out_typed_array(OutBuf *out, const void *data, size_t length,
+                            const UA_DataType *type, int depth) {
+    size_t shown = valueArrayLimit && length > valueArrayLimit ? valueArrayLimit : length;
+    out_char(out, '[');
+    for (size_t i = 0; i < shown; i++) {
+        if (i > 0)
+            out_str(out, ", ");
+        out_typed(out, (const char*)data + i * type->memSize, type, depth + 1);
+    }
+    if (shown < length) {
+        out_str(out, ", ... (");
+        out_u64(out, length);
+        out_str(out, " total)");
+    }
+    out_char(out, ']');
+}
+
+static void fmt_boolean(OutBuf *out, const void *p, const UA_DataType *type, int depth) {
+    out_str(out, *(const UA_Boolean*)p ? "true" : "false");
+}
+
+static void fmt_sbyte(OutBuf *out, const void *p, const UA_DataType *type, int depth) {
+    out_i64(out, *(const UA_SByte*)p);
+}
+
+static void fmt_byte(OutBuf *out, const void *p, const UA_DataType *type, int depth) {
+    out_u64(out, *(const UA_Byte*)p);
+}
+
+static void fmt_int16(OutBuf *out, const void *p, const UA_DataType *type, int depth) {
+    out_i64(out, *(const UA_Int16*)p);
+}
+
+static void fmt_uint16(OutBuf *out, const void *p, const UA_DataType *type, int depth) {
+    out_u64(out, *(const UA_UInt16*)p);
+}
+
+// Int32 and enumerations
+static void fmt_int32(OutBuf *out, const void *p, const UA_DataType *type, int depth) {
+    out_i64(out, *(const UA_Int32*)p);
+}
+
+static void fmt_uint32(OutBuf *out, const void *p, const UA_DataType *type, int depth) {
+    out_u64(out, *(const UA_UInt32*)p);
+}
+
+static void fmt_int64(OutBuf *out, const void *p, const UA_DataType *type, int depth) {
+    out_i64(out, *(const UA_Int64*)p);
+}
+
+static void fmt_uint64(OutBuf *out, const void *p, const UA_DataType *type, int depth) {
+    out_u64(out, *(const UA_UInt64*)p);
+}
+
+// Shortest precision that keeps the usual number of significant digits
+static void out_real(OutBuf *out, double v, int digits) {
+    char tmp[64];
+    int n = snprintf(tmp, sizeof(tmp), "%.*g", digits, v);
+    if (n > 0)
+        out_write(out, tmp, (size_t)n < sizeof(tmp) ? (size_t)n : sizeof(tmp) - 1);
+}
+
+static void fmt_float(OutBuf *out, const void *p, const UA_DataType *type, int depth) {
+    out_real(out, *(const UA_Float*)p, 7);
+}
+
+static void fmt_double(OutBuf *out, const void *p, const UA_DataType *type, int depth) {
+    out_real(out, *(const UA_Double*)p, 15);
+}
+
+// String and XmlElement
+static void fmt_string(OutBuf *out, const void *p, const UA_DataType *type, int depth) {
+    const UA_String *s = (const UA_String*)p;
+    if (depth > 0)
+        out_json_string(out, (const char*)s->data, s->length);
+    else
+        out_uastr(out, s);
+}
+
+static void fmt_datetime(OutBuf *out, const void *p, const UA_DataType *type, int depth) {
+    out_datetime(out, *(const UA_DateTime*)p);
+}
+
+static void fmt_guid(OutBuf *out, const void *p, const UA_DataType *type, int depth) {
+    out_guid(out, (const UA_Guid*)p);
+}
+
+static void fmt_bytestring(OutBuf *out, const void *p, const UA_DataType *type, int depth) {
+    out_base64(out, (const UA_ByteString*)p);
+}
+
+static void fmt_nodeid(OutBuf *out, const void *p, const UA_DataType *type, int depth) {
+    out_nodeid(out, (const UA_NodeId*)p);
+}
+
+static void fmt_expandednodeid(OutBuf *out, const void *p, const UA_DataType *type, int depth) {
+    const UA_ExpandedNodeId *id = (const UA_ExpandedNodeId*)p;
+    if (id->serverIndex > 0) {
+        out_str(out, "svr=");
+        out_u64(out, id->serverIndex);
+        out_char(out, ';');
+    }
+    if (id->namespaceUri.length > 0) {
+        out_str(out, "nsu=");
+        out_uastr(out, &id->namespaceUri);
+        out_char(out, ';');
+    }
+    out_nodeid(out, &id->nodeId);
+}
+
+static void fmt_statuscode(OutBuf *out, const void *p, const UA_DataType *type, int depth) {
+    out_str(out, UA_StatusCode_name(*(const UA_StatusCode*)p));
+}
+
+// "ns:name", the namespace omitted for namespace 0
+static void fmt_qualifiedname(OutBuf *out, const void *p, const UA_DataType *type, int depth) {
+    const UA_QualifiedName *qn = (const UA_QualifiedName*)p;
+    if (qn->namespaceIndex > 0) {
+        out_u64(out, qn->namespaceIndex);
+        out_char(out, ':');
+    }
+    fmt_string(out, &qn->name, type, depth);
+}
+
+// Text followed by the locale in parentheses
+static void fmt_localizedtext(OutBuf *out, const void *p, const UA_DataType *type, int depth) {
+    const UA_LocalizedText *lt = (const UA_LocalizedText*)p;
+    fmt_string(out, &lt->text, type, depth);
+    if (lt->locale.length > 0) {
+        out_str(out, " (");
+        out_uastr(out, &lt->locale);
+        out_char(out, ')');
+    }
+}
+
+static void fmt_variant(OutBuf *out, const void *p, const UA_DataType *type, int depth) {
+    const UA_Variant *v = (const UA_Variant*)p;
+    if (!v->type)
+        out_str(out, "null");
+    else if (UA_Variant_isScalar(v))
+        out_typed(out, v->data, v->type, depth);
+    else
+        out_typed_array(out, v->data, v->arrayLength, v->type, depth);
+}
+
+static void fmt_datavalue(OutBuf *out, const void *p, const UA_DataType *type, int depth) {
+    const UA_DataValue *dv = (const UA_DataValue*)p;
+    if (dv->hasStatus && dv->status != UA_STATUSCODE_GOOD) {
+        out_str(out, UA_StatusCode_name(dv->status));
+    } else if (dv->hasValue) {
+        fmt_variant(out, &dv->value, type, depth);
+    } else {
+        out_str(out, "null");
+    }
+}
+
+// Decoded bodies are printed as their type; bodies of types unknown to
+// the client are shown as type and size
+static void fmt_extensionobject(OutBuf *out, const void *p, const UA_DataType *type, int depth) {
+    const UA_ExtensionObject *eo = (const UA_ExtensionObject*)p;
+    switch (eo->encoding) {
+        case UA_EXTENSIONOBJECT_DECODED:
+        case UA_EXTENSIONOBJECT_DECODED_NODELETE:
+            out_typed(out, eo->content.decoded.data, eo->content.decoded.type, depth);
             break;
-        case UA_NODECLASS_OBJECTTYPE:
-            printf(" (ObjectType)\n");
+        case UA_EXTENSIONOBJECT_ENCODED_BYTESTRING:
+        case UA_EXTENSIONOBJECT_ENCODED_XML:
+            out_char(out, '<');
+            out_nodeid(out, &eo->content.encoded.typeId);
+            out_str(out, ": ");
+            out_u64(out, eo->content.encoded.body.length);
+            out_str(out, eo->encoding == UA_EXTENSIONOBJECT_ENCODED_XML ? " bytes XML>" : " bytes>");
             break;
-        case UA_NODECLASS_VARIABLETYPE:
-            printf(" (VariableType)\n");
+        default:
+            out_str(out, "null");
             break;
-        case UA_NODECLASS_REFERENCETYPE:
-            printf(" (ReferenceType)\n");
+    }
+}
+
+static void out_member_name(OutBuf *out, const UA_DataTypeMember *m, int first) {
+    if (!first)
+        out_str(out, ", ");
+    out_str(out, m->memberName ? m->memberName : "?");
+    out_str(out, ": ");
+}
+
+// Structures with and without optional fields. Members follow each other
+// at their padding; arrays are stored as length and pointer, optional
+// scalars as pointers that are NULL when absent.
+static void fmt_structure(OutBuf *out, const void *p, const UA_DataType *type, int depth) {
+    uintptr_t ptr = (uintptr_t)p;
+    int first = 1;
+    out_char(out, '{');
+    for (size_t i = 0; i < type->membersSize; i++) {
+        const UA_DataTypeMember *m = &type->members[i];
+        const UA_DataType *mt = m->memberType;
+        ptr += m->padding;
+        if (m->isArray) {
+            size_t length = *(const size_t*)ptr;
+            ptr += sizeof(size_t);
+            const void *data = *(void * const *)ptr;
+            ptr += sizeof(void*);
+            if (m->isOptional && !data)
+                continue;
+            out_member_name(out, m, first);
+            out_typed_array(out, data, length, mt, depth);
+        } else if (m->isOptional) {
+            const void *data = *(void * const *)ptr;
+            ptr += sizeof(void*);
+            if (!data)
+                continue;
+            out_member_name(out, m, first);
+            out_typed(out, data, mt, depth + 1);
+        } else {
+            out_member_name(out, m, first);
+            out_typed(out, (const void*)ptr, mt, depth + 1);
+            ptr += mt->memSize;
+        }
+        first = 0;
+    }
+    out_char(out, '}');
+}
+
+// Unions start with the 1-based index of the selected member, whose
+// padding is relative to the start of the union
+static void fmt_union(OutBuf *out, const void *p, const UA_DataType *type, int depth) {
+    UA_UInt32 selection = *(const UA_UInt32*)p;
+    out_char(out, '{');
+    if (selection > 0 && selection <= type->membersSize) {
+        const UA_DataTypeMember *m = &type->members[selection - 1];
+        uintptr_t ptr = (uintptr_t)p + m->padding;
+        out_member_name(out, m, 1);
+        if (m->isArray) {
+            size_t length = *(const size_t*)ptr;
+            out_typed_array(out, *(void * const *)(ptr + sizeof(size_t)), length, m->memberType, depth);
+        } else {
+            out_typed(out, (const void*)ptr, m->memberType, depth + 1);
+        }
+    }
+    out_char(out, '}');
+}
+
+static const ValueWriter valueWriters[UA_DATATYPEKIND_BITFIELDCLUSTER + 1] = {
+    [UA_DATATYPEKIND_BOOLEAN]         = fmt_boolean,
+    [UA_DATATYPEKIND_SBYTE]           = fmt_sbyte,
+    [UA_DATATYPEKIND_BYTE]            = fmt_byte,
+    [UA_DATATYPEKIND_INT16]           = fmt_int16,
+    [UA_DATATYPEKIND_UINT16]          = fmt_uint16,
+    [UA_DATATYPEKIND_INT32]           = fmt_int32,
+    [UA_DATATYPEKIND_UINT32]          = fmt_uint32,
+    [UA_DATATYPEKIND_INT64]           = fmt_int64,
+    [UA_DATATYPEKIND_UINT64]          = fmt_uint64,
+    [UA_DATATYPEKIND_FLOAT]           = fmt_float,
+    [UA_DATATYPEKIND_DOUBLE]          = fmt_double,
+    [UA_DATATYPEKIND_STRING]          = fmt_string,
+    [UA_DATATYPEKIND_DATETIME]        = fmt_datetime,
+    [UA_DATATYPEKIND_GUID]            = fmt_guid,
+    [UA_DATATYPEKIND_BYTESTRING]      = fmt_bytestring,
+    [UA_DATATYPEKIND_XMLELEMENT]      = fmt_string,
+    [UA_DATATYPEKIND_NODEID]          = fmt_nodeid,
+    [UA_DATATYPEKIND_EXPANDEDNODEID]  = fmt_expandednodeid,
+    [UA_DATATYPEKIND_STATUSCODE]      = fmt_statuscode,
+    [UA_DATATYPEKIND_QUALIFIEDNAME]   = fmt_qualifiedname,
+    [UA_DATATYPEKIND_LOCALIZEDTEXT]   = fmt_localizedtext,
+    [UA_DATATYPEKIND_EXTENSIONOBJECT] = fmt_extensionobject,
+    [UA_DATATYPEKIND_DATAVALUE]       = fmt_datavalue,
+    [UA_DATATYPEKIND_VARIANT]         = fmt_variant,
+    [UA_DATATYPEKIND_ENUM]            = fmt_int32,
+    [UA_DATATYPEKIND_STRUCTURE]       = fmt_structure,
+    [UA_DATATYPEKIND_OPTSTRUCT]       = fmt_structure,
+    [UA_DATATYPEKIND_UNION]           = fmt_union
+};
+
+// Kinds without a writer (DiagnosticInfo, Decimal, bit fields) and values
+// nested too deeply print their type name
+static void out_typed(OutBuf *out, const void *p, const UA_DataType *type, int depth) {
+    ValueWriter writer = type->typeKind <= UA_DATATYPEKIND_BITFIELDCLUSTER
+                         ? valueWriters[type->typeKind] : NULL;
+    if (!writer || depth > VALUE_MAX_NESTING) {
+        out_char(out, '[');
+        out_str(out, type->typeName);
+        out_char(out, ']');
+        return;
+    }
+    writer(out, p, type, depth);
+}
+
+// Text form of a value, shared by all output formats
+static void out_value(OutBuf *out, const UA_Variant *value) {
+    fmt_variant(out, value, NULL, 0);
+}
+
+// ========== NODE RECORD OUTPUT ==========
+
+typedef enum {
+    FORMAT_TREE = 0,    // Indented human-readable listing
+    FORMAT_NDJSON,      // One JSON object per line
+    FORMAT_CSV          // Header line plus one row per node
+} OutputFormat;
+
+#define MAX_EXTRA_ATTRIBUTES 9
+
+// Attributes read in the same request as the Value of each Variable
+// (--attributes); results follow the Value in this order
+typedef struct {
+    UA_UInt32 ids[MAX_EXTRA_ATTRIBUTES];
+    size_t count;
+    int timestamps;             // Show the value timestamps in the tree listing
+} AttributeSet;
+
+typedef struct {
+    const char *option;
+    const char *name;
+    UA_UInt32 id;
+} AttributeName;
+
+static const AttributeName attributeNames[MAX_EXTRA_ATTRIBUTES] = {
+    {"datatype",        "DataType",                UA_ATTRIBUTEID_DATATYPE},
+    {"valuerank",       "ValueRank",               UA_ATTRIBUTEID_VALUERANK},
+    {"arraydimensions", "ArrayDimensions",         UA_ATTRIBUTEID_ARRAYDIMENSIONS},
+    {"accesslevel",     "AccessLevel",             UA_ATTRIBUTEID_ACCESSLEVEL},
+    {"useraccesslevel", "UserAccessLevel",         UA_ATTRIBUTEID_USERACCESSLEVEL},
+    {"minsampling",     "MinimumSamplingInterval", UA_ATTRIBUTEID_MINIMUMSAMPLINGINTERVAL},
+    {"historizing",     "Historizing",             UA_ATTRIBUTEID_HISTORIZING},
+    {"displayname",     "DisplayName",             UA_ATTRIBUTEID_DISPLAYNAME},
+    {"description",     "Description",             UA_ATTRIBUTEID_DESCRIPTION}
+};
+
+static const char *attributeName(UA_UInt32 id) {
+    for (size_t i = 0; i < MAX_EXTRA_ATTRIBUTES; i++) {
+        if (attributeNames[i].id == id)
+            return attributeNames[i].name;
+    }
+    return "Unknown";
+}
+
+// Everything known about one listed node. Pointers are borrowed from the
+// traversal and only valid for the duration of the emit call.
+typedef struct {
+    const UA_NodeId *nodeId;
+    const UA_QualifiedName *browseName;
+    UA_NodeClass nodeClass;
+    const UA_NodeId *parentId;    // NULL for the traversal root
+    int depth;
+    const UA_DataValue *value;    // Variables only, may be NULL
+    int backRef;                  // Repeated occurrence of a listed node
+    char change;                  // Diff reports: '+', '-' or '~', else 0
+    const UA_DataValue *previous; // Diff reports: old value of a changed Variable
+    const AttributeSet *attributeSet; // Extra attributes listed, may be NULL
+    const UA_DataValue *attributes;   // Their values, NULL if not read
+    const char *server;           // Combined fleet output: endpoint URL, else NULL
+} NodeRecord;
+
+// Status of a value read: the DataValue status, or Good when absent
+static UA_StatusCode recordStatus(const UA_DataValue *dv) {
+    return dv->hasStatus ? dv->status : UA_STATUSCODE_GOOD;
+}
+
+// Is there a value that can be displayed?
+static int hasDisplayValue(const UA_DataValue *dv) {
+    return dv && recordStatus(dv) == UA_STATUSCODE_GOOD &&
+           dv->hasValue && !UA_Variant_isEmpty(&dv->value);
+}
+
+static const char *changeName(char change) {
+    switch (change) {
+        case '+': return "added";
+        case '-': return "removed";
+        default:  return "changed";
+    }
+}
+
+// Value suffix of a Variable in the tree listing
+static void printValue(OutBuf *out, const UA_DataValue *dv) {
+    if (hasDisplayValue(dv)) {
+        out_str(out, " = ");
+        out_value(out, &dv->value);
+    } else {
+        out_str(out, " [Read error: 0x");
+        out_hex(out, dv ? recordStatus(dv) : UA_STATUSCODE_BADUNEXPECTEDERROR, 8);
+        out_char(out, ']');
+    }
+}
+
+// Text form of an extra attribute, with symbolic DataTypes and AccessLevels
+static void out_attribute(OutBuf *out, UA_UInt32 id, const UA_DataValue *dv) {
+    static const char *accessBits[] = {
+        "CurrentRead", "CurrentWrite", "HistoryRead", "HistoryWrite",
+        "SemanticChange", "StatusWrite", "TimestampWrite"
+    };
+    if (!hasDisplayValue(dv)) {
+        out_str(out, dv && recordStatus(dv) != UA_STATUSCODE_GOOD
+                     ? UA_StatusCode_name(recordStatus(dv)) : "null");
+    } else if (id == UA_ATTRIBUTEID_DATATYPE &&
+               UA_Variant_hasScalarType(&dv->value, &UA_TYPES[UA_TYPES_NODEID])) {
+        const UA_DataType *type = UA_findDataType((const UA_NodeId*)dv->value.data);
+        if (type)
+            out_str(out, type->typeName);
+        else
+            out_nodeid(out, (const UA_NodeId*)dv->value.data);
+    } else if ((id == UA_ATTRIBUTEID_ACCESSLEVEL || id == UA_ATTRIBUTEID_USERACCESSLEVEL) &&
+               UA_Variant_hasScalarType(&dv->value, &UA_TYPES[UA_TYPES_BYTE])) {
+        UA_Byte level = *(const UA_Byte*)dv->value.data;
+        int first = 1;
+        for (size_t bit = 0; bit < sizeof(accessBits) / sizeof(accessBits[0]); bit++) {
+            if (level & (1u << bit)) {
+                if (!first)
+                    out_char(out, '|');
+                out_str(out, accessBits[bit]);
+                first = 0;
+            }
+        }
+        if (first)
+            out_str(out, "None");
+    } else {
+        out_value(out, &dv->value);
+    }
+}
+
+static int hasAttributes(const NodeRecord *rec) {
+    return rec->attributeSet && rec->attributeSet->count > 0;
+}
+
+// Print one node line of the tree listing.
+// A back-reference marks a node that was already listed further up.
+static void printNode(OutBuf *out, const NodeRecord *rec) {
+    
+    // Indentation for hierarchy visualization
+    if (rec->depth > 0) {
+        static const char spaces[] = "                                                                ";
+        size_t width = (size_t)rec->depth + 1;
+        while (width > 0) {
+            size_t n = width < sizeof(spaces) - 1 ? width : sizeof(spaces) - 1;
+            out_write(out, spaces, n);
+            width -= n;
+        }
+    }
+    
+    if (rec->change) {
+        out_char(out, rec->change);
+        out_char(out, ' ');
+    }
+    
+    // Display node information
+    out_uastr(out, &rec->browseName->name);
+    out_str(out, "  [");
+    out_nodeid(out, rec->nodeId);
+    out_str(out, "] (");
+    out_str(out, nodeClassName(rec->nodeClass));
+    out_char(out, ')');
+    
+    if (rec->backRef) {
+        out_str(out, " -> see above\n");
+        return;
+    }
+    
+    if (rec->nodeClass == UA_NODECLASS_VARIABLE) {
+        printValue(out, rec->value);
+        if (rec->previous) {
+            out_str(out, " (was");
+            printValue(out, rec->previous);
+            out_char(out, ')');
+        }
+        const UA_DataValue *dv = rec->value;
+        if (rec->attributeSet && rec->attributeSet->timestamps && dv &&
+            (dv->hasSourceTimestamp || dv->hasServerTimestamp)) {
+            out_str(out, " @");
+            if (dv->hasSourceTimestamp) {
+                out_str(out, " source ");
+                out_datetime(out, dv->sourceTimestamp);
+            }
+            if (dv->hasServerTimestamp) {
+                out_str(out, " server ");
+                out_datetime(out, dv->serverTimestamp);
+            }
+        }
+        if (hasAttributes(rec) && rec->attributes) {
+            out_str(out, " {");
+            for (size_t i = 0; i < rec->attributeSet->count; i++) {
+                if (i > 0)
+                    out_str(out, ", ");
+                out_str(out, attributeName(rec->attributeSet->ids[i]));
+                out_char(out, '=');
+                out_attribute(out, rec->attributeSet->ids[i], &rec->attributes[i]);
+            }
+            out_char(out, '}');
+        }
+    }
+    out_char(out, '\n');
+}
+
+// ISO 8601 UTC timestamp with milliseconds
+static void out_isotime(OutBuf *out, UA_DateTime t) {
+    UA_DateTimeStruct dts = UA_DateTime_toStruct(t);
+    out_u32pad(out, dts.year, 4);
+    out_char(out, '-');
+    out_u32pad(out, dts.month, 2);
+    out_char(out, '-');
+    out_u32pad(out, dts.day, 2);
+    out_char(out, 'T');
+    out_u32pad(out, dts.hour, 2);
+    out_char(out, ':');
+    out_u32pad(out, dts.min, 2);
+    out_char(out, ':');
+    out_u32pad(out, dts.sec, 2);
+    out_char(out, '.');
+    out_u32pad(out, dts.milliSec, 3);
+    out_char(out, 'Z');
+}
+
+// Field text is rendered into a small truncating scratch buffer first so
+// it can be escaped for the target format
+#define FIELD_BUFFER_SIZE 4096
+
+#if UACONSOLE_WITH_EXPORT
+// RFC 4180 field: quoted only when it contains a separator, quote or newline
+static void out_csv_field(OutBuf *out, const char *s, size_t len) {
+    int quote = 0;
+    for (size_t i = 0; i < len && !quote; i++)
+        quote = (s[i] == ',' || s[i] == '"' || s[i] == '\n' || s[i] == '\r');
+    if (!quote) {
+        out_write(out, s, len);
+        return;
+    }
+    out_char(out, '"');
+    for (size_t i = 0; i < len; i++) {
+        if (s[i] == '"')
+            out_char(out, '"');
+        out_char(out, s[i]);
+    }
+    out_char(out, '"');
+}
+
+typedef void (*FieldWriter)(OutBuf *out, const char *s, size_t len);
+
+static void out_nodeid_field(OutBuf *out, const UA_NodeId *id, FieldWriter field) {
+    char storage[FIELD_BUFFER_SIZE];
+    OutBuf tmp;
+    out_init(&tmp, storage, sizeof(storage), NULL);
+    out_nodeid(&tmp, id);
+    field(out, tmp.data, tmp.size);
+}
+
+static void out_value_field(OutBuf *out, const UA_Variant *value, FieldWriter field) {
+    char storage[FIELD_BUFFER_SIZE];
+    OutBuf tmp;
+    out_init(&tmp, storage, sizeof(storage), NULL);
+    out_value(&tmp, value);
+    field(out, tmp.data, tmp.size);
+}
+
+// JSON can carry booleans and finite numbers unquoted
+static int isJsonLiteral(const UA_Variant *value) {
+    if (!UA_Variant_isScalar(value))
+        return 0;
+    switch (value->type->typeKind) {
+        case UA_DATATYPEKIND_FLOAT: {
+            UA_Float f = *(UA_Float*)value->data;
+            return f == f && f - f == 0.0f;
+        }
+        case UA_DATATYPEKIND_DOUBLE: {
+            UA_Double d = *(UA_Double*)value->data;
+            return d == d && d - d == 0.0;
+        }
+        case UA_DATATYPEKIND_BOOLEAN:
+        case UA_DATATYPEKIND_SBYTE:
+        case UA_DATATYPEKIND_BYTE:
+        case UA_DATATYPEKIND_INT16:
+        case UA_DATATYPEKIND_UINT16:
+        case UA_DATATYPEKIND_INT32:
+        case UA_DATATYPEKIND_UINT32:
+        case UA_DATATYPEKIND_INT64:
+        case UA_DATATYPEKIND_UINT64:
+        case UA_DATATYPEKIND_ENUM:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static void out_attribute_field(OutBuf *out, UA_UInt32 id, const UA_DataValue *dv, FieldWriter field) {
+    char storage[FIELD_BUFFER_SIZE];
+    OutBuf tmp;
+    out_init(&tmp, storage, sizeof(storage), NULL);
+    out_attribute(&tmp, id, dv);
+    field(out, tmp.data, tmp.size);
+}
+
+static void out_json_value(OutBuf *out, const UA_DataValue *dv) {
+    if (!hasDisplayValue(dv))
+        out_str(out, "null");
+    else if (isJsonLiteral(&dv->value))
+        out_value(out, &dv->value);
+    else
+        out_value_field(out, &dv->value, out_json_string);
+}
+
+static void writeJsonRecord(OutBuf *out, const NodeRecord *rec) {
+    if (rec->server) {
+        out_str(out, "{\"server\":");
+        out_json_string(out, rec->server, strlen(rec->server));
+        out_str(out, ",\"nodeId\":");
+    } else {
+        out_str(out, "{\"nodeId\":");
+    }
+    out_nodeid_field(out, rec->nodeId, out_json_string);
+    out_str(out, ",\"browseName\":");
+    out_json_string(out, (const char*)rec->browseName->name.data, rec->browseName->name.length);
+    out_str(out, ",\"browseNameNs\":");
+    out_u64(out, rec->browseName->namespaceIndex);
+    out_str(out, ",\"nodeClass\":\"");
+    out_str(out, nodeClassName(rec->nodeClass));
+    out_str(out, "\",\"parentId\":");
+    if (rec->parentId)
+        out_nodeid_field(out, rec->parentId, out_json_string);
+    else
+        out_str(out, "null");
+    out_str(out, ",\"depth\":");
+    out_u64(out, (UA_UInt64)rec->depth);
+    
+    const UA_DataValue *dv = rec->backRef ? NULL : rec->value;
+    out_str(out, ",\"valueType\":");
+    if (dv && dv->hasValue && dv->value.type)
+        out_json_string(out, dv->value.type->typeName, strlen(dv->value.type->typeName));
+    else
+        out_str(out, "null");
+    out_str(out, ",\"value\":");
+    out_json_value(out, dv);
+    out_str(out, ",\"status\":");
+    if (dv) {
+        out_char(out, '"');
+        out_str(out, UA_StatusCode_name(recordStatus(dv)));
+        out_char(out, '"');
+    } else {
+        out_str(out, "null");
+    }
+    out_str(out, ",\"sourceTimestamp\":");
+    if (dv && dv->hasSourceTimestamp) {
+        out_char(out, '"');
+        out_isotime(out, dv->sourceTimestamp);
+        out_char(out, '"');
+    } else {
+        out_str(out, "null");
+    }
+    out_str(out, ",\"serverTimestamp\":");
+    if (dv && dv->hasServerTimestamp) {
+        out_char(out, '"');
+        out_isotime(out, dv->serverTimestamp);
+        out_char(out, '"');
+    } else {
+        out_str(out, "null");
+    }
+    out_str(out, rec->backRef ? ",\"backref\":true" : ",\"backref\":false");
+    if (hasAttributes(rec)) {
+        out_str(out, ",\"attributes\":");
+        if (rec->attributes && !rec->backRef) {
+            for (size_t i = 0; i < rec->attributeSet->count; i++) {
+                UA_UInt32 id = rec->attributeSet->ids[i];
+                const UA_DataValue *attr = &rec->attributes[i];
+                out_str(out, i > 0 ? ",\"" : "{\"");
+                out_str(out, attributeName(id));
+                out_str(out, "\":");
+                if (!hasDisplayValue(attr) && recordStatus(attr) == UA_STATUSCODE_GOOD)
+                    out_str(out, "null");
+                else if (hasDisplayValue(attr) && isJsonLiteral(&attr->value))
+                    out_value(out, &attr->value);
+                else
+                    out_attribute_field(out, id, attr, out_json_string);
+            }
+            out_char(out, '}');
+        } else {
+            out_str(out, "null");
+        }
+    }
+    if (rec->change) {
+        out_str(out, ",\"change\":\"");
+        out_str(out, changeName(rec->change));
+        out_str(out, "\",\"previousValue\":");
+        out_json_value(out, rec->previous);
+    }
+    out_str(out, "}\n");
+}
+
+#define CSV_COLUMNS "nodeId,browseName,browseNameNs,nodeClass,parentId,depth," \
+                    "valueType,value,status,sourceTimestamp,serverTimestamp,backref"
+
+// Diff reports wrap the regular columns with the kind of change and the
+// previous value
+static void writeCsvRecord(OutBuf *out, const NodeRecord *rec) {
+    if (rec->server) {
+        out_csv_field(out, rec->server, strlen(rec->server));
+        out_char(out, ',');
+    }
+    if (rec->change) {
+        out_str(out, changeName(rec->change));
+        out_char(out, ',');
+    }
+    out_nodeid_field(out, rec->nodeId, out_csv_field);
+    out_char(out, ',');
+    out_csv_field(out, (const char*)rec->browseName->name.data, rec->browseName->name.length);
+    out_char(out, ',');
+    out_u64(out, rec->browseName->namespaceIndex);
+    out_char(out, ',');
+    out_str(out, nodeClassName(rec->nodeClass));
+    out_char(out, ',');
+    if (rec->parentId)
+        out_nodeid_field(out, rec->parentId, out_csv_field);
+    out_char(out, ',');
+    out_u64(out, (UA_UInt64)rec->depth);
+    out_char(out, ',');
+    
+    const UA_DataValue *dv = rec->backRef ? NULL : rec->value;
+    if (dv && dv->hasValue && dv->value.type)
+        out_str(out, dv->value.type->typeName);
+    out_char(out, ',');
+    if (hasDisplayValue(dv))
+        out_value_field(out, &dv->value, out_csv_field);
+    out_char(out, ',');
+    if (dv)
+        out_str(out, UA_StatusCode_name(recordStatus(dv)));
+    out_char(out, ',');
+    if (dv && dv->hasSourceTimestamp)
+        out_isotime(out, dv->sourceTimestamp);
+    out_char(out, ',');
+    if (dv && dv->hasServerTimestamp)
+        out_isotime(out, dv->serverTimestamp);
+    out_str(out, rec->backRef ? ",1" : ",0");
+    for (size_t i = 0; hasAttributes(rec) && i < rec->attributeSet->count; i++) {
+        out_char(out, ',');
+        if (rec->attributes && !rec->backRef)
+            out_attribute_field(out, rec->attributeSet->ids[i], &rec->attributes[i], out_csv_field);
+    }
+    if (rec->change) {
+        out_char(out, ',');
+        if (hasDisplayValue(rec->previous))
+            out_value_field(out, &rec->previous->value, out_csv_field);
+    }
+    out_char(out, '\n');
+}
+
+#endif
+
+// Write the format's preamble, if any. attrs are the extra attribute
+// columns of the records that follow, or NULL.
+static void beginOutput(OutBuf *out, OutputFormat format, int changes, const AttributeSet *attrs) {
+#if UACONSOLE_WITH_EXPORT
+    if (format != FORMAT_CSV)
+        return;
+    out_str(out, changes ? "change," CSV_COLUMNS : CSV_COLUMNS);
+    for (size_t i = 0; attrs && i < attrs->count; i++) {
+        out_char(out, ',');
+        out_str(out, attributeName(attrs->ids[i]));
+    }
+    out_str(out, changes ? ",previousValue\n" : "\n");
+#endif
+}
+
+// Without the export formats only the tree listing is built; -f rejects
+// the others
+static void emitNode(OutBuf *out, OutputFormat format, const NodeRecord *rec) {
+    switch (format) {
+#if UACONSOLE_WITH_EXPORT
+        case FORMAT_NDJSON:
+            writeJsonRecord(out, rec);
+            break;
+        case FORMAT_CSV:
+            writeCsvRecord(out, rec);
+            break;
+#endif
+        default:
+            printNode(out, rec);
+    }
+    out_tick(out);
+}
+
+// Nodes per request for every batched service, derived from the server's
+// limits once after connecting
+typedef struct {
+    size_t browse;
+    size_t read;
+    size_t registerNodes;
+    size_t translate;
+    size_t monitoredItems;
+} BatchSizes;
+
+// Traversal settings shared by all browse engines
+typedef struct {
+    int verbose;
+    size_t batchSize;               // Max nodes per batched request
+    UA_UInt32 maxReferencesPerNode; // requestedMaxReferencesPerNode, 0 = server decides
+    int backReferences;             // Print repeated nodes instead of omitting them
+    size_t inflight;                // Pipelined mode: max outstanding requests
+    size_t sessions;                // Parallel mode: number of sessions
+    const char *serverUrl;          // For sessions opened by worker threads
+    int timeoutMs;
+    OutBuf *out;                    // Node listing output
+    OutputFormat format;
+    const char *snapshotPath;       // Save the scan result here (graph engines)
+    struct ScanBaseline *baseline;  // Report changes against this snapshot
+    struct EndpointCache *endpoints; // --direct: connect to cached endpoints
+    int browseOnly;                 // Collect nodes without reading values
+    const char *monitorList;        // --monitor: NodeId list instead of a subtree
+    double monitorSamplingMs;
+    UA_UInt32 monitorQueueSize;
+    double monitorDeadband;         // Absolute deadband, 0 = report every change
+    const char *readList;           // --read-list: NodeIds polled with registered Reads
+    int pollIntervalMs;
+    double duration;                // Seconds to monitor or poll, 0 = until interrupted
+    size_t cycles;                  // Polling cycles to run, 0 = no limit
+    int profileValues;              // Report per-item statistics instead of samples
+    UA_NodeId referenceTypeId;      // Browse filter, null = all reference types
+    int exactReferenceType;         // Do not include subtypes of referenceTypeId
+    UA_UInt32 nodeClassMask;        // Browse filter, 0 = all NodeClasses
+    int maxDepth;                   // Levels below the root to expand, -1 = no limit
+    int namespaceIndex;             // Only follow nodes of this namespace, -1 = all
+    int inflightAuto;               // Size the pipelining window from the server's limits
+    BatchSizes sizes;
+    AttributeSet attributes;        // Read with every Value
+    const char *recordServer;       // Fleet scans: tag records with this endpoint
+    size_t formatThreads;           // Graph engines: threads formatting the listing
+    const char *checkpointPath;     // Depth-first traversal: save progress here
+    const char **paths;             // --path: browse paths to read or monitor
+    size_t pathCount;
+    int resume;                     // Continue from checkpointPath
+} ScanOptions;
+
+// Create a client with the default configuration and the given timeout
+static UA_Client *createClient(int timeout_ms) {
+    UA_Client *client = UA_Client_new();
+    if (!client)
+        return NULL;
+    UA_ClientConfig *config = UA_Client_getConfig(client);
+    UA_ClientConfig_setDefault(config);
+    config->timeout = timeout_ms;
+    return client;
+}
+
+// Only nodes that cost a round trip (expanded or read) are deduplicated;
+// type definitions and methods are printed wherever they are referenced
+static int isDeduplicated(UA_NodeClass nodeClass) {
+    return nodeClass == UA_NODECLASS_OBJECT || nodeClass == UA_NODECLASS_VIEW ||
+           nodeClass == UA_NODECLASS_VARIABLE;
+}
+
+// Describe a Browse of one node with the scan's filters. The server then
+// prunes by direction, reference type and NodeClass; Objects and Views
+// are always requested so the traversal can pass through them.
+static void initBrowseDescription(UA_BrowseDescription *bd, const ScanOptions *opts) {
+    bd->browseDirection = UA_BROWSEDIRECTION_FORWARD;
+    UA_NodeId_copy(&opts->referenceTypeId, &bd->referenceTypeId);
+    bd->includeSubtypes = !opts->exactReferenceType;
+    if (opts->nodeClassMask)
+        bd->nodeClassMask = opts->nodeClassMask | UA_NODECLASS_OBJECT | UA_NODECLASS_VIEW;
+    bd->resultMask = UA_BROWSERESULTMASK_ALL;
+}
+
+// Filters the server cannot apply, and a guard for servers that ignore
+// the Browse filters
+static int acceptReference(const ScanOptions *opts, const UA_ReferenceDescription *ref) {
+    if (!ref->isForward)
+        return 0;
+    if (opts->namespaceIndex >= 0 && ref->nodeId.nodeId.namespaceIndex != (UA_UInt16)opts->namespaceIndex)
+        return 0;
+    return !opts->nodeClassMask ||
+           (ref->nodeClass & (opts->nodeClassMask | UA_NODECLASS_OBJECT | UA_NODECLASS_VIEW));
+}
+
+// May a node found at this depth be expanded?
+static int expandAtDepth(const ScanOptions *opts, int depth) {
+    return opts->maxDepth < 0 || depth < opts->maxDepth;
+}
+
+// ========== SCAN ARENA ==========
+
+// Bump allocator for storage that lives exactly as long as one scan, such
+// as the interned identifiers and names of a string pool. Allocations are
+// carved from large blocks and never freed one by one; arena_clear
+// releases everything at once.
+#define ARENA_BLOCK_SIZE (256 * 1024)
+
+typedef struct ArenaBlock {
+    struct ArenaBlock *next;
+    size_t size;
+    size_t used;
+    UA_UInt64 data[];           // 8-byte aligned storage
+} ArenaBlock;
+
+typedef struct {
+    ArenaBlock *head;
+    size_t allocated;           // Bytes handed out, for --verbose
+} Arena;
+
+static void *arena_alloc(Arena *arena, size_t size) {
+    size = (size + 7) & ~(size_t)7;
+    ArenaBlock *b = arena->head;
+    if (!b || b->size - b->used < size) {
+        // Oversized requests get a block of their own behind the current
+        // one, so the space left in the current block is not wasted
+        size_t blockSize = size > ARENA_BLOCK_SIZE / 4 ? size : ARENA_BLOCK_SIZE;
+        ArenaBlock *nb = (ArenaBlock*)malloc(sizeof(ArenaBlock) + blockSize);
+        if (!nb)
+            return NULL;
+        nb->size = blockSize;
+        nb->used = 0;
+        if (b && blockSize != ARENA_BLOCK_SIZE) {
+            nb->next = b->next;
+            b->next = nb;
+        } else {
+            nb->next = b;
+            arena->head = nb;
+        }
+        b = nb;
+    }
+    void *p = (char*)b->data + b->used;
+    b->used += size;
+    arena->allocated += size;
+    return p;
+}
+
+static void arena_clear(Arena *arena) {
+    while (arena->head) {
+        ArenaBlock *next = arena->head->next;
+        free(arena->head);
+        arena->head = next;
+    }
+    arena->allocated = 0;
+}
+
+// ========== STRING POOL ==========
+
+#define STRINGPOOL_NONE ((UA_UInt32)-1)
+
+// Hashed intern table. Each distinct byte string is stored once in the
+// pool's arena and numbered in insertion order. The scan graph interns
+// BrowseNames and string/opaque NodeId identifiers; the snapshot writer
+// uses the ids as its string table. Lookups start from strings received
+// from the server, which are not pooled yet, so equality is always
+// decided by hash and bytes rather than by pointer.
+typedef struct {
+    UA_String string;
+    UA_UInt32 hash;
+    UA_UInt32 id;               // STRINGPOOL_NONE marks a free slot
+} StringPoolEntry;
+
+typedef struct {
+    StringPoolEntry *entries;
+    size_t size;
+    size_t capacity;            // Always a power of two
+    Arena arena;
+} StringPool;
+
+// FNV-1a
+static UA_UInt32 stringPool_hash(const UA_Byte *data, size_t len) {
+    UA_UInt32 h = 2166136261u;
+    for (size_t i = 0; i < len; i++)
+        h = (h ^ data[i]) * 16777619u;
+    return h;
+}
+
+static StringPoolEntry *stringPool_slot(const StringPool *pool, const UA_Byte *data, size_t len,
+                                        UA_UInt32 hash) {
+    size_t mask = pool->capacity - 1;
+    for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+        StringPoolEntry *e = &pool->entries[i];
+        if (e->id == STRINGPOOL_NONE ||
+            (e->hash == hash && e->string.length == len &&
+             (len == 0 || memcmp(e->string.data, data, len) == 0)))
+            return e;
+    }
+}
+
+static int stringPool_grow(StringPool *pool) {
+    size_t newCapacity = pool->capacity ? pool->capacity * 2 : 1024;
+    StringPoolEntry *entries = (StringPoolEntry*)malloc(newCapacity * sizeof(StringPoolEntry));
+    if (!entries)
+        return 0;
+    for (size_t i = 0; i < newCapacity; i++)
+        entries[i].id = STRINGPOOL_NONE;
+    
+    StringPoolEntry *old = pool->entries;
+    size_t oldCapacity = pool->capacity;
+    pool->entries = entries;
+    pool->capacity = newCapacity;
+    for (size_t i = 0; i < oldCapacity; i++) {
+        if (old[i].id != STRINGPOOL_NONE)
+            *stringPool_slot(pool, old[i].string.data, old[i].string.length, old[i].hash) = old[i];
+    }
+    free(old);
+    return 1;
+}
+
+// Intern a byte string. Returns its id, or STRINGPOOL_NONE if memory ran
+// out; out (if given) receives the pooled copy, which lives as long as
+// the pool. A new string gets the id pool->size - 1.
+static UA_UInt32 stringPool_intern(StringPool *pool, const UA_Byte *data, size_t len, UA_String *out) {
+    if ((pool->size + 1) * 10 > pool->capacity * 7 && !stringPool_grow(pool))
+        return STRINGPOOL_NONE;
+    
+    UA_UInt32 hash = stringPool_hash(data, len);
+    StringPoolEntry *e = stringPool_slot(pool, data, len, hash);
+    if (e->id == STRINGPOOL_NONE) {
+        if (pool->size == STRINGPOOL_NONE)
+            return STRINGPOOL_NONE;
+        UA_String s = {len, NULL};
+        if (len > 0) {
+            s.data = (UA_Byte*)arena_alloc(&pool->arena, len);
+            if (!s.data)
+                return STRINGPOOL_NONE;
+            memcpy(s.data, data, len);
+        }
+        e->string = s;
+        e->hash = hash;
+        e->id = (UA_UInt32)pool->size++;
+    }
+    if (out)
+        *out = e->string;
+    return e->id;
+}
+
+static UA_StatusCode stringPool_copyString(StringPool *pool, const UA_String *src, UA_String *dst) {
+    return stringPool_intern(pool, src->data, src->length, dst) == STRINGPOOL_NONE
+           ? UA_STATUSCODE_BADOUTOFMEMORY : UA_STATUSCODE_GOOD;
+}
+
+// Shallow copy of a NodeId with a pooled string/opaque identifier
+static UA_StatusCode stringPool_copyNodeId(StringPool *pool, const UA_NodeId *src, UA_NodeId *dst) {
+    *dst = *src;
+    if (src->identifierType == UA_NODEIDTYPE_STRING || src->identifierType == UA_NODEIDTYPE_BYTESTRING)
+        return stringPool_copyString(pool, &src->identifier.string, &dst->identifier.string);
+    return UA_STATUSCODE_GOOD;
+}
+
+static UA_StatusCode stringPool_copyQualifiedName(StringPool *pool, const UA_QualifiedName *src,
+                                                  UA_QualifiedName *dst) {
+    dst->namespaceIndex = src->namespaceIndex;
+    return stringPool_copyString(pool, &src->name, &dst->name);
+}
+
+static void stringPool_clear(StringPool *pool) {
+    free(pool->entries);
+    arena_clear(&pool->arena);
+    memset(pool, 0, sizeof(StringPool));
+}
+
+// ========== NODE INDEX ==========
+
+#define NODEINDEX_EMPTY ((size_t)-1)
+
+// Open-addressing (linear probing) hash map from NodeId to an index.
+// Keys are deep copies hashed with UA_NodeId_hash, which covers numeric,
+// string, GUID and opaque identifiers. With a string pool the key
+// identifiers are interned there and released with it.
+typedef struct {
+    UA_NodeId key;
+    UA_UInt32 hash;
+    size_t value;     // NODEINDEX_EMPTY marks a free slot
+} NodeIndexEntry;
+
+typedef struct {
+    NodeIndexEntry *entries;
+    size_t size;
+    size_t capacity;  // Always a power of two
+    StringPool *strings;  // Optional storage for the key identifiers
+} NodeIndex;
+
+static NodeIndexEntry *nodeIndex_slot(const NodeIndex *index, const UA_NodeId *nodeId, UA_UInt32 hash) {
+    size_t mask = index->capacity - 1;
+    for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+        NodeIndexEntry *e = &index->entries[i];
+        if (e->value == NODEINDEX_EMPTY ||
+            (e->hash == hash && UA_NodeId_equal(&e->key, nodeId)))
+            return e;
+    }
+}
+
+static int nodeIndex_grow(NodeIndex *index) {
+    size_t newCapacity = index->capacity ? index->capacity * 2 : 1024;
+    NodeIndexEntry *entries = (NodeIndexEntry*)malloc(newCapacity * sizeof(NodeIndexEntry));
+    if (!entries)
+        return 0;
+    for (size_t i = 0; i < newCapacity; i++)
+        entries[i].value = NODEINDEX_EMPTY;
+    
+    NodeIndex grown = {entries, index->size, newCapacity, index->strings};
+    for (size_t i = 0; i < index->capacity; i++) {
+        NodeIndexEntry *e = &index->entries[i];
+        if (e->value != NODEINDEX_EMPTY)
+            *nodeIndex_slot(&grown, &e->key, e->hash) = *e;
+    }
+    free(index->entries);
+    *index = grown;
+    return 1;
+}
+
+// Look up a NodeId; returns its value or NODEINDEX_EMPTY
+static size_t nodeIndex_find(const NodeIndex *index, const UA_NodeId *nodeId) {
+    if (index->size == 0)
+        return NODEINDEX_EMPTY;
+    return nodeIndex_slot(index, nodeId, UA_NodeId_hash(nodeId))->value;
+}
+
+// Insert a NodeId unless it is already present. Returns the value stored
+// for the NodeId, which is the existing one if it was present.
+static size_t nodeIndex_insert(NodeIndex *index, const UA_NodeId *nodeId, size_t value) {
+    // Keep the load factor below 0.7
+    if ((index->size + 1) * 10 > index->capacity * 7 && !nodeIndex_grow(index))
+        return NODEINDEX_EMPTY;
+    
+    UA_UInt32 hash = UA_NodeId_hash(nodeId);
+    NodeIndexEntry *e = nodeIndex_slot(index, nodeId, hash);
+    if (e->value != NODEINDEX_EMPTY)
+        return e->value;
+    UA_StatusCode retval = index->strings ? stringPool_copyNodeId(index->strings, nodeId, &e->key)
+                                          : UA_NodeId_copy(nodeId, &e->key);
+    if (retval != UA_STATUSCODE_GOOD)
+        return NODEINDEX_EMPTY;
+    e->hash = hash;
+    e->value = value;
+    index->size++;
+    return value;
+}
+
+static void nodeIndex_clear(NodeIndex *index) {
+    for (size_t i = 0; i < index->capacity && !index->strings; i++) {
+        if (index->entries[i].value != NODEINDEX_EMPTY)
+            UA_NodeId_clear(&index->entries[i].key);
+    }
+    free(index->entries);
+    memset(index, 0, sizeof(NodeIndex));
+}
+
+// ========== CONTINUATION POINTS ==========
+
+// Called for every BrowseResult returned by BrowseNext; owner identifies
+// the node the continuation point was issued for. A failed request or a
+// missing result is passed on as a result with that status and no
+// references.
+typedef void (*BrowseResultHandler)(void *context, size_t owner, UA_BrowseResult *result);
+
+// Tell the server to free continuation points that will not be drained
+static void releaseContinuationPoints(UA_Client *client, UA_ByteString *cps, size_t count) {
+    if (count == 0)
+        return;
+    
+    UA_BrowseNextRequest req;
+    UA_BrowseNextRequest_init(&req);
+    req.releaseContinuationPoints = true;
+    req.continuationPoints = cps;
+    req.continuationPointsSize = count;
+    
+    UA_BrowseNextResponse resp = timedBrowseNext(client, req);
+    UA_BrowseNextResponse_clear(&resp);
+}
+
+// Drain continuation points with batched BrowseNext requests until every
+// node has returned all of its references. cps and owners are parallel
+// arrays of count entries; the continuation points are consumed. The
+// server frees a continuation point as soon as its last chunk is returned,
+// and the remaining ones are released explicitly if a request fails.
+static UA_StatusCode browseNextAll(UA_Client *client, UA_ByteString *cps, size_t *owners, size_t count,
+                                   BrowseResultHandler handler, void *context) {
+    UA_StatusCode retval = UA_STATUSCODE_GOOD;
+    
+    while (count > 0) {
+        UA_BrowseNextRequest req;
+        UA_BrowseNextRequest_init(&req);
+        req.continuationPoints = cps;
+        req.continuationPointsSize = count;
+        
+        UA_BrowseNextResponse resp = timedBrowseNext(client, req);
+        retval = resp.responseHeader.serviceResult;
+        UA_BrowseResult failed;
+        UA_BrowseResult_init(&failed);
+        if (retval != UA_STATUSCODE_GOOD) {
+            UA_BrowseNextResponse_clear(&resp);
+            releaseContinuationPoints(client, cps, count);
+            failed.statusCode = retval;
+            for (size_t i = 0; i < count; i++) {
+                UA_ByteString_clear(&cps[i]);
+                handler(context, owners[i], &failed);
+            }
+            break;
+        }
+        
+        // Points the response left unanswered are still held by the server
+        if (resp.resultsSize < count)
+            releaseContinuationPoints(client, &cps[resp.resultsSize], count - resp.resultsSize);
+        
+        // Keep only the continuation points that are still open
+        size_t remaining = 0;
+        for (size_t i = 0; i < count; i++) {
+            UA_ByteString_clear(&cps[i]);
+            if (i >= resp.resultsSize) {
+                failed.statusCode = UA_STATUSCODE_BADUNEXPECTEDERROR;
+                handler(context, owners[i], &failed);
+                continue;
+            }
+            UA_BrowseResult *result = &resp.results[i];
+            handler(context, owners[i], result);
+            if (result->continuationPoint.length > 0) {
+                cps[remaining] = result->continuationPoint;
+                UA_ByteString_init(&result->continuationPoint);
+                owners[remaining] = owners[i];
+                remaining++;
+            }
+        }
+        count = remaining;
+        UA_BrowseNextResponse_clear(&resp);
+    }
+    return retval;
+}
+
+// ========== ENDPOINT CACHE ==========
+
+// UA_Client_connect normally opens a SecureChannel, asks for the server's
+// endpoints, closes it and connects again to the endpoint it selected.
+// With --direct the selected endpoint and user token policy of every URL
+// are kept in a small text file and set in the client configuration on
+// the next run, which skips the discovery round trips. Each line holds
+// the URL, a hash of the server certificate (to spot a replaced
+// certificate when looking at the file) and the base64 encoded
+// EndpointDescription and UserTokenPolicy, separated by tabs.
+typedef struct {
+    char *url;
+    UA_EndpointDescription endpoint;
+    UA_UserTokenPolicy userTokenPolicy;
+} CachedEndpoint;
+
+typedef struct EndpointCache {
+    CachedEndpoint *entries;
+    size_t size;
+    size_t capacity;
+    const char *path;
+    int dirty;                      // Changed since loading, save at exit
+    pthread_mutex_t lock;           // Fleet and parallel scans connect concurrently
+} EndpointCache;
+
+static CachedEndpoint *endpointCache_find(EndpointCache *cache, const char *url) {
+    for (size_t i = 0; i < cache->size; i++) {
+        if (strcmp(cache->entries[i].url, url) == 0)
+            return &cache->entries[i];
+    }
+    return NULL;
+}
+
+static int endpointCache_decode(const char *text, void *p, const UA_DataType *type) {
+    UA_String base64 = UA_STRING((char*)(uintptr_t)text);
+    UA_ByteString encoded;
+    UA_ByteString_init(&encoded);
+    if (UA_ByteString_fromBase64(&encoded, &base64) != UA_STATUSCODE_GOOD)
+        return 0;
+    UA_StatusCode rc = UA_decodeBinary(&encoded, p, type, NULL);
+    UA_ByteString_clear(&encoded);
+    return rc == UA_STATUSCODE_GOOD;
+}
+
+static void endpointCache_writeField(FILE *fp, const void *p, const UA_DataType *type) {
+    UA_ByteString encoded;
+    UA_ByteString_init(&encoded);
+    UA_String text;
+    UA_String_init(&text);
+    if (UA_encodeBinary(p, type, &encoded) == UA_STATUSCODE_GOOD &&
+        UA_ByteString_toBase64(&encoded, &text) == UA_STATUSCODE_GOOD)
+        fwrite(text.data, 1, text.length, fp);
+    UA_String_clear(&text);
+    UA_ByteString_clear(&encoded);
+}
+
+// A missing file is an empty cache; malformed lines are ignored
+static void endpointCache_load(EndpointCache *cache, const char *path) {
+    memset(cache, 0, sizeof(EndpointCache));
+    cache->path = path;
+    pthread_mutex_init(&cache->lock, NULL);
+    FILE *fp = fopen(path, "r");
+    if (!fp)
+        return;
+    
+    char *line = NULL;
+    size_t lineCapacity = 0;
+    while (getline(&line, &lineCapacity, fp) > 0) {
+        line[strcspn(line, "\r\n")] = '\0';
+        char *url = strtok(line, "\t");
+        char *hash = strtok(NULL, "\t");
+        char *endpoint = strtok(NULL, "\t");
+        char *policy = strtok(NULL, "\t");
+        if (!url || !hash || !endpoint || !policy || url[0] == '#')
+            continue;
+        
+        if (cache->size == cache->capacity) {
+            size_t newCapacity = cache->capacity ? cache->capacity * 2 : 16;
+            CachedEndpoint *entries = (CachedEndpoint*)realloc(cache->entries,
+                                                               newCapacity * sizeof(CachedEndpoint));
+            if (!entries)
+                break;
+            cache->entries = entries;
+            cache->capacity = newCapacity;
+        }
+        CachedEndpoint *e = &cache->entries[cache->size];
+        memset(e, 0, sizeof(CachedEndpoint));
+        if (endpointCache_decode(endpoint, &e->endpoint, &UA_TYPES[UA_TYPES_ENDPOINTDESCRIPTION]) &&
+            endpointCache_decode(policy, &e->userTokenPolicy, &UA_TYPES[UA_TYPES_USERTOKENPOLICY]) &&
+            (e->url = strdup(url)) != NULL) {
+            cache->size++;
+        } else {
+            UA_EndpointDescription_clear(&e->endpoint);
+            UA_UserTokenPolicy_clear(&e->userTokenPolicy);
+        }
+    }
+    free(line);
+    fclose(fp);
+}
+
+// Write the cache back if it changed, then release it
+static void endpointCache_close(EndpointCache *cache) {
+    FILE *fp = cache->dirty ? fopen(cache->path, "w") : NULL;
+    if (cache->dirty && !fp)
+        printf("Error: Could not write endpoint cache %s\n", cache->path);
+    if (fp)
+        fprintf(fp, "# uaconsole endpoint cache: url, certificate hash, endpoint, user token policy\n");
+    for (size_t i = 0; i < cache->size; i++) {
+        CachedEndpoint *e = &cache->entries[i];
+        if (fp) {
+            const UA_ByteString *cert = &e->endpoint.serverCertificate;
+            fprintf(fp, "%s\t%08x\t", e->url, (unsigned)stringPool_hash(cert->data, cert->length));
+            endpointCache_writeField(fp, &e->endpoint, &UA_TYPES[UA_TYPES_ENDPOINTDESCRIPTION]);
+            fputc('\t', fp);
+            endpointCache_writeField(fp, &e->userTokenPolicy, &UA_TYPES[UA_TYPES_USERTOKENPOLICY]);
+            fputc('\n', fp);
+        }
+        free(e->url);
+        UA_EndpointDescription_clear(&e->endpoint);
+        UA_UserTokenPolicy_clear(&e->userTokenPolicy);
+    }
+    if (fp)
+        fclose(fp);
+    free(cache->entries);
+    pthread_mutex_destroy(&cache->lock);
+    memset(cache, 0, sizeof(EndpointCache));
+}
+
+// Remember the endpoint the client selected during a full connect
+static void endpointCache_store(EndpointCache *cache, const char *url, const UA_ClientConfig *config) {
+    if (config->endpoint.endpointUrl.length == 0)
+        return;
+    pthread_mutex_lock(&cache->lock);
+    CachedEndpoint *e = endpointCache_find(cache, url);
+    if (!e && cache->size == cache->capacity) {
+        size_t newCapacity = cache->capacity ? cache->capacity * 2 : 16;
+        CachedEndpoint *entries = (CachedEndpoint*)realloc(cache->entries,
+                                                           newCapacity * sizeof(CachedEndpoint));
+        if (entries) {
+            cache->entries = entries;
+            cache->capacity = newCapacity;
+        }
+    }
+    if (!e && cache->size < cache->capacity && (cache->entries[cache->size].url = strdup(url))) {
+        e = &cache->entries[cache->size++];
+        UA_EndpointDescription_init(&e->endpoint);
+        UA_UserTokenPolicy_init(&e->userTokenPolicy);
+    }
+    if (e) {
+        UA_EndpointDescription_clear(&e->endpoint);
+        UA_UserTokenPolicy_clear(&e->userTokenPolicy);
+        UA_EndpointDescription_copy(&config->endpoint, &e->endpoint);
+        UA_UserTokenPolicy_copy(&config->userTokenPolicy, &e->userTokenPolicy);
+        cache->dirty = 1;
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+// Connect to url, straight to the cached endpoint when there is one. If
+// that fails (the server was reconfigured, its certificate replaced, ...)
+// the entry is refreshed by a regular connect with endpoint discovery.
+static UA_StatusCode connectClient(UA_Client *client, const char *url, const ScanOptions *opts) {
+    EndpointCache *cache = opts->endpoints;
+    UA_ClientConfig *config = UA_Client_getConfig(client);
+    UA_StatusCode retval = UA_STATUSCODE_BADNOTCONNECTED;
+    UA_UInt64 start = stats_now();
+    
+    int cached = 0;
+    if (cache) {
+        pthread_mutex_lock(&cache->lock);
+        CachedEndpoint *e = endpointCache_find(cache, url);
+        if (e) {
+            UA_EndpointDescription_clear(&config->endpoint);
+            UA_UserTokenPolicy_clear(&config->userTokenPolicy);
+            cached = UA_EndpointDescription_copy(&e->endpoint, &config->endpoint) == UA_STATUSCODE_GOOD &&
+                     UA_UserTokenPolicy_copy(&e->userTokenPolicy, &config->userTokenPolicy) == UA_STATUSCODE_GOOD;
+        }
+        pthread_mutex_unlock(&cache->lock);
+    }
+    if (cached) {
+        retval = UA_Client_connect(client, url);
+        if (retval != UA_STATUSCODE_GOOD) {
+            if (opts->verbose)
+                printf("Cached endpoint of %s rejected (%s), rediscovering\n", url, UA_StatusCode_name(retval));
+            UA_Client_disconnect(client);
+            UA_EndpointDescription_clear(&config->endpoint);
+            UA_UserTokenPolicy_clear(&config->userTokenPolicy);
+        }
+    }
+    if (retval != UA_STATUSCODE_GOOD) {
+        retval = UA_Client_connect(client, url);
+        if (retval == UA_STATUSCODE_GOOD && cache)
+            endpointCache_store(cache, url, config);
+    }
+    stats_record(STAT_CONNECT, start, 1, 0, 0);
+    return retval;
+}
+
+// ========== CONNECTION RECOVERY ==========
+
+#define RECONNECT_ATTEMPTS 10
+#define RECONNECT_MAX_DELAY_S 60
+
+// Set by the client's state callback when the SecureChannel or the
+// session goes down after the session was activated
+typedef struct {
+    int activated;
+    int lost;
+} ConnectionWatch;
+
+static void connectionStateChanged(UA_Client *client, UA_SecureChannelState channelState,
+                                   UA_SessionState sessionState, UA_StatusCode connectStatus) {
+    ConnectionWatch *watch = (ConnectionWatch*)UA_Client_getContext(client);
+    if (!watch)
+        return;
+    if (sessionState == UA_SESSIONSTATE_ACTIVATED && channelState == UA_SECURECHANNELSTATE_OPEN &&
+        connectStatus == UA_STATUSCODE_GOOD) {
+        watch->activated = 1;
+        watch->lost = 0;
+    } else if (watch->activated) {
+        watch->lost = 1;
+    }
+}
+
+// Install the watch on an already connected client; NULL removes it
+static void connectionWatch_attach(UA_Client *client, ConnectionWatch *watch) {
+    UA_ClientConfig *config = UA_Client_getConfig(client);
+    if (watch) {
+        watch->activated = 1;
+        watch->lost = 0;
+    }
+    config->clientContext = watch;
+    config->stateCallback = watch ? connectionStateChanged : NULL;
+}
+
+// Reconnect after the connection dropped, waiting 1, 2, 4, ... seconds
+// (at most RECONNECT_MAX_DELAY_S) between attempts
+static int reconnectClient(UA_Client *client, const ScanOptions *opts) {
+    unsigned delay = 1;
+    for (int attempt = 1; attempt <= RECONNECT_ATTEMPTS; attempt++) {
+        printf("Connection lost, reconnecting in %u s (attempt %d of %d)\n",
+               delay, attempt, RECONNECT_ATTEMPTS);
+        fflush(stdout);
+        sleep(delay);
+        UA_Client_disconnect(client);
+        UA_StatusCode retval = connectClient(client, opts->serverUrl, opts);
+        if (retval == UA_STATUSCODE_GOOD) {
+            printf("Reconnected\n");
+            return 1;
+        }
+        if (opts->verbose)
+            printf("  Reconnect failed: %s\n", UA_StatusCode_name(retval));
+        delay = delay * 2 < RECONNECT_MAX_DELAY_S ? delay * 2 : RECONNECT_MAX_DELAY_S;
+    }
+    return 0;
+}
+
+// ========== DEPTH-FIRST TRAVERSAL ==========
+
+// Growable array of references collected over Browse and BrowseNext
+typedef struct {
+    UA_ReferenceDescription *refs;
+    size_t size;
+    size_t capacity;
+    UA_StatusCode status;   // First failed result, or references lost for lack of memory
+} RefList;
+
+// Move all references out of a BrowseResult into the list
+static void refList_take(RefList *list, UA_BrowseResult *result) {
+    if (result->referencesSize == 0)
+        return;
+    if (list->size + result->referencesSize > list->capacity) {
+        size_t newCapacity = (list->size + result->referencesSize) * 2;
+        UA_ReferenceDescription *refs = (UA_ReferenceDescription*)
+            realloc(list->refs, newCapacity * sizeof(UA_ReferenceDescription));
+        if (!refs) {
+            if (list->status == UA_STATUSCODE_GOOD)
+                list->status = UA_STATUSCODE_BADOUTOFMEMORY;
+            return;
+        }
+        list->refs = refs;
+        list->capacity = newCapacity;
+    }
+    memcpy(&list->refs[list->size], result->references,
+           result->referencesSize * sizeof(UA_ReferenceDescription));
+    list->size += result->referencesSize;
+    UA_free(result->references);
+    result->references = NULL;
+    result->referencesSize = 0;
+}
+
+static void refList_handler(void *context, size_t owner, UA_BrowseResult *result) {
+    (void)owner;
+    RefList *list = (RefList*)context;
+    if (result->statusCode != UA_STATUSCODE_GOOD && list->status == UA_STATUSCODE_GOOD)
+        list->status = result->statusCode;
+    refList_take(list, result);
+}
+
+static void refList_clear(RefList *list) {
+    for (size_t i = 0; i < list->size; i++)
+        UA_ReferenceDescription_clear(&list->refs[i]);
+    free(list->refs);
+    memset(list, 0, sizeof(RefList));
+}
+
+static UA_StatusCode browseChildrenOnce(UA_Client *client, const UA_NodeId *nodeId,
+                                        const ScanOptions *opts, RefList *children) {
+    UA_BrowseRequest bReq;
+    UA_BrowseRequest_init(&bReq);
+    bReq.requestedMaxReferencesPerNode = opts->maxReferencesPerNode;
+    bReq.nodesToBrowse = UA_BrowseDescription_new();
+    if (!bReq.nodesToBrowse)
+        return UA_STATUSCODE_BADOUTOFMEMORY;
+    bReq.nodesToBrowseSize = 1;
+    UA_NodeId_copy(nodeId, &bReq.nodesToBrowse[0].nodeId);
+    initBrowseDescription(&bReq.nodesToBrowse[0], opts);
+    
+    UA_BrowseResponse bResp = timedBrowse(client, bReq);
+    UA_BrowseRequest_clear(&bReq);
+    
+    UA_StatusCode retval = bResp.responseHeader.serviceResult;
+    if (retval == UA_STATUSCODE_GOOD && bResp.resultsSize < 1)
+        retval = UA_STATUSCODE_BADUNEXPECTEDERROR;
+    if (retval == UA_STATUSCODE_GOOD)
+        retval = bResp.results[0].statusCode;
+    if (retval != UA_STATUSCODE_GOOD) {
+        UA_BrowseResponse_clear(&bResp);
+        return retval;
+    }
+    
+    refList_take(children, &bResp.results[0]);
+    UA_ByteString cp = bResp.results[0].continuationPoint;
+    UA_ByteString_init(&bResp.results[0].continuationPoint);
+    UA_BrowseResponse_clear(&bResp);
+    
+    if (cp.length > 0) {
+        size_t owner = 0;
+        retval = browseNextAll(client, &cp, &owner, 1, refList_handler, children);
+    }
+    return retval != UA_STATUSCODE_GOOD ? retval : children->status;
+}
+
+// Browse all references of a single node, following continuation points.
+// A browse refused for overload starts over, as BrowseNext cannot resume.
+static UA_StatusCode browseChildren(UA_Client *client, const UA_NodeId *nodeId,
+                                    const ScanOptions *opts, RefList *children) {
+    unsigned overloads = 0;
+    for (;;) {
+        UA_StatusCode retval = browseChildrenOnce(client, nodeId, opts, children);
+        if (!throttle_retry(&overloads, throttle_overloadStatus(retval)))
+            return retval;
+        refList_clear(children);
+        throttle_backoff();
+    }
+}
+
+// Read the Value attribute of a single node with both timestamps, plus
+// the extra attributes into attributes[attrs->count]. The results are
+// always owned by the caller; failures become a bare status.
+static void readValue(UA_Client *client, const UA_NodeId *nodeId, const AttributeSet *attrs,
+                      UA_DataValue *value, UA_DataValue *attributes) {
+    UA_ReadValueId items[1 + MAX_EXTRA_ATTRIBUTES];
+    size_t count = 1 + attrs->count;
+    for (size_t i = 0; i < count; i++) {
+        UA_ReadValueId_init(&items[i]);
+        items[i].nodeId = *nodeId;
+        items[i].attributeId = i == 0 ? UA_ATTRIBUTEID_VALUE : attrs->ids[i - 1];
+    }
+    
+    UA_ReadRequest rReq;
+    UA_ReadRequest_init(&rReq);
+    rReq.nodesToRead = items;
+    rReq.nodesToReadSize = count;
+    rReq.timestampsToReturn = UA_TIMESTAMPSTORETURN_BOTH;
+    
+    // The request only borrows the NodeId and is not cleared
+    UA_ReadResponse rResp = timedRead(client, rReq);
+    unsigned overloads = 0;
+    while (throttle_retry(&overloads, throttle_overloadStatus(throttle_readStatus(&rResp)))) {
+        UA_ReadResponse_clear(&rResp);
+        throttle_backoff();
+        rResp = timedRead(client, rReq);
+    }
+    UA_StatusCode retval = rResp.responseHeader.serviceResult;
+    if (retval == UA_STATUSCODE_GOOD && rResp.resultsSize < count)
+        retval = UA_STATUSCODE_BADUNEXPECTEDERROR;
+    for (size_t i = 0; i < count; i++) {
+        UA_DataValue *dv = i == 0 ? value : &attributes[i - 1];
+        UA_DataValue_init(dv);
+        if (retval == UA_STATUSCODE_GOOD) {
+            *dv = rResp.results[i];
+            UA_DataValue_init(&rResp.results[i]);
+        } else {
+            dv->hasStatus = true;
+            dv->status = retval;
+        }
+    }
+    UA_ReadResponse_clear(&rResp);
+}
+
+// Pending node of the depth-first traversal. Only what the listing and
+// the next Browse need is kept; the rest of the ReferenceDescription is
+// released as soon as the parent's children have been filtered.
+typedef struct {
+    UA_NodeId nodeId;
+    UA_QualifiedName browseName;
+    UA_NodeClass nodeClass;
+    int depth;
+} TraversalItem;
+
+// Explicit work stack plus the NodeIds of the current path (parents of
+// the item being listed); both grow on demand, so the depth is unlimited
+typedef struct {
+    TraversalItem *items;
+    size_t size;
+    size_t capacity;
+    UA_NodeId *path;
+    size_t pathSize;
+    size_t pathCapacity;
+} TraversalStack;
+
+static int traversal_push(TraversalStack *stack, UA_NodeId *nodeId, UA_QualifiedName *browseName,
+                          UA_NodeClass nodeClass, int depth) {
+    if (stack->size == stack->capacity) {
+        size_t newCapacity = stack->capacity ? stack->capacity * 2 : 256;
+        TraversalItem *items = (TraversalItem*)realloc(stack->items, newCapacity * sizeof(TraversalItem));
+        if (!items)
+            return 0;
+        stack->items = items;
+        stack->capacity = newCapacity;
+    }
+    // The strings are moved, not copied
+    TraversalItem *item = &stack->items[stack->size++];
+    item->nodeId = *nodeId;
+    item->browseName = *browseName;
+    item->nodeClass = nodeClass;
+    item->depth = depth;
+    UA_NodeId_init(nodeId);
+    UA_QualifiedName_init(browseName);
+    return 1;
+}
+
+// Shorten the path to `depth` entries and append nodeId
+static int traversal_enter(TraversalStack *stack, size_t depth, const UA_NodeId *nodeId) {
+    while (stack->pathSize > depth)
+        UA_NodeId_clear(&stack->path[--stack->pathSize]);
+    if (stack->pathSize == stack->pathCapacity) {
+        size_t newCapacity = stack->pathCapacity ? stack->pathCapacity * 2 : 64;
+        UA_NodeId *path = (UA_NodeId*)realloc(stack->path, newCapacity * sizeof(UA_NodeId));
+        if (!path)
+            return 0;
+        stack->path = path;
+        stack->pathCapacity = newCapacity;
+    }
+    return UA_NodeId_copy(nodeId, &stack->path[stack->pathSize++]) == UA_STATUSCODE_GOOD;
+}
+
+static void traversal_clear(TraversalStack *stack) {
+    for (size_t i = 0; i < stack->size; i++) {
+        UA_NodeId_clear(&stack->items[i].nodeId);
+        UA_QualifiedName_clear(&stack->items[i].browseName);
+    }
+    for (size_t i = 0; i < stack->pathSize; i++)
+        UA_NodeId_clear(&stack->path[i]);
+    free(stack->items);
+    free(stack->path);
+    memset(stack, 0, sizeof(TraversalStack));
+}
+
+// Traversal checkpoint written by --checkpoint and read by --resume:
+//   CheckpointHeader
+//   NodeId                          Traversal root
+//   (NodeId, QualifiedName, UInt32 NodeClass, Int32 depth)[stackCount]
+//   NodeId[pathCount]               Parents of the next item
+//   NodeId[visitedCount]            Nodes already listed
+// Every value is a UA_UInt32 length followed by its open62541 binary
+// encoding. The file is replaced atomically, so a crash while writing
+// leaves the previous checkpoint intact.
+#define CHECKPOINT_MAGIC "UACKPT\0"
+#define CHECKPOINT_VERSION 1
+#define CHECKPOINT_INTERVAL_US (30 * 1000000ULL)
+
+typedef struct {
+    char magic[8];
+    UA_UInt32 version;
+    UA_UInt32 reserved;
+    UA_UInt64 stackCount;
+    UA_UInt64 pathCount;
+    UA_UInt64 visitedCount;
+} CheckpointHeader;
+
+static int checkpoint_put(FILE *fp, const void *p, const UA_DataType *type) {
+    UA_ByteString encoded;
+    UA_ByteString_init(&encoded);
+    if (UA_encodeBinary(p, type, &encoded) != UA_STATUSCODE_GOOD)
+        return 0;
+    UA_UInt32 len = (UA_UInt32)encoded.length;
+    int ok = fwrite(&len, sizeof(len), 1, fp) == 1 &&
+             fwrite(encoded.data, 1, encoded.length, fp) == encoded.length;
+    UA_ByteString_clear(&encoded);
+    return ok;
+}
+
+static int checkpoint_get(FILE *fp, void *p, const UA_DataType *type) {
+    UA_UInt32 len;
+    if (fread(&len, sizeof(len), 1, fp) != 1 || len > 1024 * 1024)
+        return 0;
+    UA_ByteString encoded;
+    if (UA_ByteString_allocBuffer(&encoded, len) != UA_STATUSCODE_GOOD)
+        return 0;
+    int ok = fread(encoded.data, 1, len, fp) == len &&
+             UA_decodeBinary(&encoded, p, type, NULL) == UA_STATUSCODE_GOOD;
+    UA_ByteString_clear(&encoded);
+    return ok;
+}
+
+static int checkpoint_save(const char *path, const UA_NodeId *rootId,
+                           const TraversalStack *stack, const NodeIndex *visited) {
+    char tmpPath[1024];
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path);
+    FILE *fp = fopen(tmpPath, "wb");
+    if (!fp) {
+        printf("Error: Could not write checkpoint %s\n", tmpPath);
+        return 0;
+    }
+    
+    CheckpointHeader header;
+    memset(&header, 0, sizeof(CheckpointHeader));
+    memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+    header.version = CHECKPOINT_VERSION;
+    header.stackCount = stack->size;
+    header.pathCount = stack->pathSize;
+    header.visitedCount = visited->size;
+    int ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+             checkpoint_put(fp, rootId, &UA_TYPES[UA_TYPES_NODEID]);
+    for (size_t i = 0; ok && i < stack->size; i++) {
+        const TraversalItem *item = &stack->items[i];
+        UA_UInt32 nodeClass = (UA_UInt32)item->nodeClass;
+        UA_Int32 depth = item->depth;
+        ok = checkpoint_put(fp, &item->nodeId, &UA_TYPES[UA_TYPES_NODEID]) &&
+             checkpoint_put(fp, &item->browseName, &UA_TYPES[UA_TYPES_QUALIFIEDNAME]) &&
+             fwrite(&nodeClass, sizeof(nodeClass), 1, fp) == 1 &&
+             fwrite(&depth, sizeof(depth), 1, fp) == 1;
+    }
+    for (size_t i = 0; ok && i < stack->pathSize; i++)
+        ok = checkpoint_put(fp, &stack->path[i], &UA_TYPES[UA_TYPES_NODEID]);
+    for (size_t i = 0; ok && i < visited->capacity; i++) {
+        if (visited->entries[i].value != NODEINDEX_EMPTY)
+            ok = checkpoint_put(fp, &visited->entries[i].key, &UA_TYPES[UA_TYPES_NODEID]);
+    }
+    
+    if (fclose(fp) != 0)
+        ok = 0;
+    if (!ok || rename(tmpPath, path) != 0) {
+        printf("Error: Could not write checkpoint %s\n", path);
+        remove(tmpPath);
+        return 0;
+    }
+    return 1;
+}
+
+// Restore the work stack, path and visited set of an interrupted scan
+// of the same root
+static int checkpoint_load(const char *path, const UA_NodeId *rootId,
+                           TraversalStack *stack, NodeIndex *visited) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        printf("Error: Could not open checkpoint %s\n", path);
+        return 0;
+    }
+    
+    CheckpointHeader header;
+    UA_NodeId nodeId;
+    UA_NodeId_init(&nodeId);
+    int ok = fread(&header, sizeof(header), 1, fp) == 1 &&
+             memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) == 0 &&
+             header.version == CHECKPOINT_VERSION &&
+             checkpoint_get(fp, &nodeId, &UA_TYPES[UA_TYPES_NODEID]);
+    if (!ok) {
+        printf("Error: %s is not a uaconsole checkpoint\n", path);
+        fclose(fp);
+        return 0;
+    }
+    if (!UA_NodeId_equal(&nodeId, rootId)) {
+        printf("Error: Checkpoint %s belongs to a scan of another root\n", path);
+        UA_NodeId_clear(&nodeId);
+        fclose(fp);
+        return 0;
+    }
+    UA_NodeId_clear(&nodeId);
+    
+    for (UA_UInt64 i = 0; ok && i < header.stackCount; i++) {
+        UA_QualifiedName browseName;
+        UA_QualifiedName_init(&browseName);
+        UA_UInt32 nodeClass;
+        UA_Int32 depth;
+        ok = checkpoint_get(fp, &nodeId, &UA_TYPES[UA_TYPES_NODEID]) &&
+             checkpoint_get(fp, &browseName, &UA_TYPES[UA_TYPES_QUALIFIEDNAME]) &&
+             fread(&nodeClass, sizeof(nodeClass), 1, fp) == 1 &&
+             fread(&depth, sizeof(depth), 1, fp) == 1 && depth >= 0 &&
+             traversal_push(stack, &nodeId, &browseName, (UA_NodeClass)nodeClass, depth);
+        UA_NodeId_clear(&nodeId);
+        UA_QualifiedName_clear(&browseName);
+    }
+    for (UA_UInt64 i = 0; ok && i < header.pathCount; i++) {
+        ok = checkpoint_get(fp, &nodeId, &UA_TYPES[UA_TYPES_NODEID]) &&
+             traversal_enter(stack, stack->pathSize, &nodeId);
+        UA_NodeId_clear(&nodeId);
+    }
+    for (UA_UInt64 i = 0; ok && i < header.visitedCount; i++) {
+        ok = checkpoint_get(fp, &nodeId, &UA_TYPES[UA_TYPES_NODEID]) &&
+             nodeIndex_insert(visited, &nodeId, visited->size) != NODEINDEX_EMPTY;
+        UA_NodeId_clear(&nodeId);
+    }
+    fclose(fp);
+    if (!ok)
+        printf("Error: Checkpoint %s is truncated or damaged\n", path);
+    return ok;
+}
+
+// Depth-first traversal and value reading with an explicit stack.
+// Node metadata (NodeId, BrowseName, NodeClass) comes from the parent's
+// ReferenceDescription, so only Variable values cost an extra round trip.
+// Objects, Views and Variables are expanded and read at most once; the
+// visited set also breaks reference cycles. Children are pushed in
+// reverse so the listing keeps the server's order; each Browse response
+// is released before its children are visited, so memory follows the
+// pending siblings rather than the depth of the hierarchy.
+//
+// A node is listed only after its Read or Browse succeeded on a live
+// session: when the connection drops it goes back on the stack and is
+// retried after reconnecting. With a checkpoint path the stack, path and
+// visited set are saved every CHECKPOINT_INTERVAL_US, and when the scan
+// has to give up. Returns 1 if the traversal ran to completion with every
+// node browsed.
+static int browseAndReadTree(UA_Client *client, UA_ReferenceDescription *root,
+                             const ScanOptions *opts, NodeIndex *visited, ConnectionWatch *watch) {
+    TraversalStack stack;
+    memset(&stack, 0, sizeof(TraversalStack));
+    UA_NodeId rootId;
+    if (UA_NodeId_copy(&root->nodeId.nodeId, &rootId) != UA_STATUSCODE_GOOD) {
+        printf("Error: Out of memory\n");
+        return 0;
+    }
+    
+    int ok;
+    if (opts->resume) {
+        ok = checkpoint_load(opts->checkpointPath, &rootId, &stack, visited);
+        if (ok)
+            printf("Resuming from %s: %zu nodes pending, %zu listed\n\n",
+                   opts->checkpointPath, stack.size, visited->size);
+    } else {
+        ok = traversal_push(&stack, &root->nodeId.nodeId, &root->browseName, root->nodeClass, 0);
+        if (!ok)
+            printf("Error: Out of memory\n");
+    }
+    
+    // Nodes browsed only partly are listed and the traversal goes on, but
+    // the scan does not count as complete
+    int complete = 1;
+    UA_UInt64 lastCheckpoint = stats_now();
+    while (ok && stack.size > 0) {
+        if (opts->checkpointPath && stats_now() - lastCheckpoint >= CHECKPOINT_INTERVAL_US) {
+            // Everything listed so far is on disk before the checkpoint is
+            out_flush(opts->out);
+            fflush(opts->out->fp);
+            checkpoint_save(opts->checkpointPath, &rootId, &stack, visited);
+            lastCheckpoint = stats_now();
+        }
+        
+        TraversalItem item = stack.items[--stack.size];
+        const UA_NodeId *nodeId = &item.nodeId;
+        const UA_NodeClass nodeClass = item.nodeClass;
+        
+        // Everything deeper than this item has been listed
+        while (stack.pathSize > (size_t)item.depth)
+            UA_NodeId_clear(&stack.path[--stack.pathSize]);
+        
+        NodeRecord rec;
+        memset(&rec, 0, sizeof(NodeRecord));
+        rec.nodeId = nodeId;
+        rec.browseName = &item.browseName;
+        rec.nodeClass = nodeClass;
+        rec.parentId = item.depth > 0 ? &stack.path[item.depth - 1] : NULL;
+        rec.depth = item.depth;
+        rec.attributeSet = &opts->attributes;
+        
+        if (isDeduplicated(nodeClass) && nodeIndex_find(visited, nodeId) != NODEINDEX_EMPTY) {
+            rec.backRef = 1;
+            if (opts->backReferences)
+                emitNode(opts->out, opts->format, &rec);
+            UA_NodeId_clear(&item.nodeId);
+            UA_QualifiedName_clear(&item.browseName);
+            continue;
+        }
+        
+        UA_DataValue value;
+        UA_DataValue attributes[MAX_EXTRA_ATTRIBUTES];
+        RefList children;
+        memset(&children, 0, sizeof(RefList));
+        int isVariable = nodeClass == UA_NODECLASS_VARIABLE;
+        int expand = (nodeClass == UA_NODECLASS_OBJECT || nodeClass == UA_NODECLASS_VIEW) &&
+                     expandAtDepth(opts, item.depth);
+        UA_StatusCode browsed = UA_STATUSCODE_GOOD;
+        if (isVariable)
+            readValue(client, nodeId, &opts->attributes, &value, attributes);
+        else if (expand)
+            browsed = browseChildren(client, nodeId, opts, &children);
+        
+        if (watch->lost) {
+            // Put the item back and retry it on the new session
+            if (isVariable) {
+                UA_DataValue_clear(&value);
+                for (size_t i = 0; i < opts->attributes.count; i++)
+                    UA_DataValue_clear(&attributes[i]);
+            }
+            refList_clear(&children);
+            stack.size++;
+            if (!reconnectClient(client, opts)) {
+                printf("Error: Could not reconnect to %s\n", opts->serverUrl);
+                if (opts->checkpointPath) {
+                    out_flush(opts->out);
+                    fflush(opts->out->fp);
+                    if (checkpoint_save(opts->checkpointPath, &rootId, &stack, visited))
+                        printf("Continue with --resume --checkpoint %s\n", opts->checkpointPath);
+                }
+                ok = 0;
+            }
+            continue;
+        }
+        
+        if (isDeduplicated(nodeClass))
+            nodeIndex_insert(visited, nodeId, visited->size);
+        if (isVariable) {
+            rec.value = &value;
+            rec.attributes = attributes;
+            emitNode(opts->out, opts->format, &rec);
+            UA_DataValue_clear(&value);
+            for (size_t i = 0; i < opts->attributes.count; i++)
+                UA_DataValue_clear(&attributes[i]);
+        } else {
+            emitNode(opts->out, opts->format, &rec);
+        }
+        
+        if (expand && browsed != UA_STATUSCODE_GOOD) {
+            printf("  Warning: %s %.*s (%s)\n",
+                   children.size > 0 ? "references missing below" : "could not browse",
+                   (int)item.browseName.name.length, (const char*)item.browseName.name.data,
+                   UA_StatusCode_name(browsed));
+            complete = 0;
+        }
+        if (expand) {
+            if (opts->verbose && opts->format == FORMAT_TREE && item.depth == 0 && children.size > 0) {
+                out_str(opts->out, "  Found ");
+                out_u64(opts->out, children.size);
+                out_str(opts->out, " references to browse\n");
+            }
+            int pushed = children.size == 0 || traversal_enter(&stack, (size_t)item.depth, nodeId);
+            for (size_t i = children.size; pushed && i-- > 0;) {
+                UA_ReferenceDescription *child = &children.refs[i];
+                if (acceptReference(opts, child))
+                    pushed = traversal_push(&stack, &child->nodeId.nodeId, &child->browseName,
+                                            child->nodeClass, item.depth + 1);
+            }
+            if (!pushed) {
+                printf("Error: Out of memory\n");
+                complete = 0;
+            }
+            refList_clear(&children);
+        }
+        
+        UA_NodeId_clear(&item.nodeId);
+        UA_QualifiedName_clear(&item.browseName);
+    }
+    
+    // A finished scan needs no checkpoint any more
+    if (ok && opts->checkpointPath)
+        remove(opts->checkpointPath);
+    traversal_clear(&stack);
+    UA_NodeId_clear(&rootId);
+    return ok && complete;
+}
+
+// Read NodeClass and BrowseName of a node that has no parent reference
+// (the traversal root) into a ReferenceDescription owning deep copies
+static UA_StatusCode readRootReference(UA_Client *client, UA_NodeId nodeId, UA_ReferenceDescription *root) {
+    UA_ReferenceDescription_init(root);
+    
+    UA_UInt64 start = stats_now();
+    UA_StatusCode retval = UA_Client_readNodeClassAttribute(client, nodeId, &root->nodeClass);
+    stats_record(STAT_READ_ATTRIBUTE, start, 1, 0, 0);
+    if (retval == UA_STATUSCODE_GOOD) {
+        start = stats_now();
+        retval = UA_Client_readBrowseNameAttribute(client, nodeId, &root->browseName);
+        stats_record(STAT_READ_ATTRIBUTE, start, 1, 0, 0);
+    }
+    if (retval == UA_STATUSCODE_GOOD)
+        retval = UA_NodeId_copy(&nodeId, &root->nodeId.nodeId);
+    
+    if (retval != UA_STATUSCODE_GOOD) {
+        UA_ReferenceDescription_clear(root);
+        return retval;
+    }
+    root->isForward = true;
+    return UA_STATUSCODE_GOOD;
+}
+
+// Entry point of the depth-first traversal. Returns 1 if it ran to
+// completion; otherwise the exit status tells a wrapper to --resume.
+static int browseAndReadRoot(UA_Client *client, UA_NodeId nodeId, const ScanOptions *opts) {
+    UA_ReferenceDescription root;
+    if (readRootReference(client, nodeId, &root) != UA_STATUSCODE_GOOD)
+        return 0;
+    
+    StringPool keys;
+    memset(&keys, 0, sizeof(StringPool));
+    NodeIndex visited;
+    memset(&visited, 0, sizeof(NodeIndex));
+    visited.strings = &keys;
+    
+    // A resumed scan appends to the output of the interrupted one
+    if (!opts->resume)
+        beginOutput(opts->out, opts->format, 0, &opts->attributes);
+    ConnectionWatch watch;
+    connectionWatch_attach(client, &watch);
+    int complete = browseAndReadTree(client, &root, opts, &visited, &watch);
+    connectionWatch_attach(client, NULL);
+    out_flush(opts->out);
+    stats_addNodes(visited.size);
+    if (opts->verbose)
+        printf("\nVisited %zu distinct nodes\n", visited.size);
+    nodeIndex_clear(&visited);
+    stringPool_clear(&keys);
+    UA_ReferenceDescription_clear(&root);
+    return complete;
+}
+
+// ========== SERVER LIMITS ==========
+
+// Limits the server publishes in ServerCapabilities; 0 = not reported
+typedef struct {
+    UA_UInt32 maxNodesPerRead;
+    UA_UInt32 maxNodesPerBrowse;
+    UA_UInt32 maxNodesPerRegisterNodes;
+    UA_UInt32 maxNodesPerTranslateBrowsePaths;
+    UA_UInt32 maxMonitoredItemsPerCall;
+    UA_UInt32 maxBrowseContinuationPoints;
+    UA_UInt32 maxArrayLength;
+    // Secure channel limits of this client. open62541 does not expose the
+    // values negotiated with the server, but they can only be smaller.
+    UA_UInt32 recvBufferSize;
+    UA_UInt32 maxMessageSize;
+} ServerLimits;
+
+// Rough encoded size of one DataValue in a Read response, used to keep a
+// Read response within one message
+#define READ_BYTES_PER_VALUE 64
+
+// Windows for pipelined traversal when --inflight auto is given
+#define INFLIGHT_AUTO_DEFAULT 16
+#define INFLIGHT_AUTO_SMALL 4
+#define INFLIGHT_AUTO_MAX 64
+
+// Limits at or below this many nodes per call mark an embedded server
+#define SMALL_SERVER_LIMIT 100
+
+// Read all relevant ServerCapabilities with one Read request
+static void discoverServerLimits(UA_Client *client, ServerLimits *limits) {
+    static const UA_UInt32 ids[] = {
+        UA_NS0ID_SERVER_SERVERCAPABILITIES_OPERATIONLIMITS_MAXNODESPERREAD,
+        UA_NS0ID_SERVER_SERVERCAPABILITIES_OPERATIONLIMITS_MAXNODESPERBROWSE,
+        UA_NS0ID_SERVER_SERVERCAPABILITIES_OPERATIONLIMITS_MAXNODESPERREGISTERNODES,
+        UA_NS0ID_SERVER_SERVERCAPABILITIES_OPERATIONLIMITS_MAXNODESPERTRANSLATEBROWSEPATHSTONODEIDS,
+        UA_NS0ID_SERVER_SERVERCAPABILITIES_OPERATIONLIMITS_MAXMONITOREDITEMSPERCALL,
+        UA_NS0ID_SERVER_SERVERCAPABILITIES_MAXBROWSECONTINUATIONPOINTS,
+        UA_NS0ID_SERVER_SERVERCAPABILITIES_MAXARRAYLENGTH
+    };
+    const size_t count = sizeof(ids) / sizeof(ids[0]);
+    memset(limits, 0, sizeof(ServerLimits));
+    UA_UInt32 *targets[sizeof(ids) / sizeof(ids[0])] = {
+        &limits->maxNodesPerRead, &limits->maxNodesPerBrowse,
+        &limits->maxNodesPerRegisterNodes, &limits->maxNodesPerTranslateBrowsePaths,
+        &limits->maxMonitoredItemsPerCall, &limits->maxBrowseContinuationPoints,
+        &limits->maxArrayLength
+    };
+    
+    UA_ReadValueId items[sizeof(ids) / sizeof(ids[0])];
+    for (size_t i = 0; i < count; i++) {
+        UA_ReadValueId_init(&items[i]);
+        items[i].nodeId = UA_NODEID_NUMERIC(0, ids[i]);
+        items[i].attributeId = UA_ATTRIBUTEID_VALUE;
+    }
+    
+    UA_ReadRequest rReq;
+    UA_ReadRequest_init(&rReq);
+    rReq.nodesToRead = items;
+    rReq.nodesToReadSize = count;
+    
+    UA_ReadResponse rResp = timedRead(client, rReq);
+    if (rResp.responseHeader.serviceResult == UA_STATUSCODE_GOOD) {
+        for (size_t i = 0; i < rResp.resultsSize && i < count; i++) {
+            const UA_DataValue *dv = &rResp.results[i];
+            if (!dv->hasValue)
+                continue;
+            // MaxBrowseContinuationPoints is a UInt16, the others UInt32
+            if (UA_Variant_hasScalarType(&dv->value, &UA_TYPES[UA_TYPES_UINT32]))
+                *targets[i] = *(UA_UInt32*)dv->value.data;
+            else if (UA_Variant_hasScalarType(&dv->value, &UA_TYPES[UA_TYPES_UINT16]))
+                *targets[i] = *(UA_UInt16*)dv->value.data;
+        }
+    }
+    UA_ReadResponse_clear(&rResp);
+    
+    const UA_ConnectionConfig *cc = &UA_Client_getConfig(client)->localConnectionConfig;
+    limits->recvBufferSize = cc->recvBufferSize;
+    limits->maxMessageSize = cc->localMaxMessageSize;
+    if (limits->maxMessageSize == 0 && cc->localMaxChunkCount > 0)
+        limits->maxMessageSize = cc->recvBufferSize * cc->localMaxChunkCount;
+}
+
+static size_t capSize(size_t size, UA_UInt32 limit) {
+    return limit > 0 && limit < size ? limit : size;
+}
+
+// Size every kind of batched request from the configured batch size and
+// the server's limits; also picks the pipelining window if it is "auto"
+static void chooseBatchSizes(const ServerLimits *limits, ScanOptions *opts) {
+    BatchSizes *sizes = &opts->sizes;
+    size_t base = capSize(opts->batchSize, limits->maxArrayLength);
+    sizes->browse = capSize(base, limits->maxNodesPerBrowse);
+    sizes->read = capSize(base, limits->maxNodesPerRead);
+    sizes->registerNodes = capSize(base, limits->maxNodesPerRegisterNodes);
+    sizes->translate = capSize(base, limits->maxNodesPerTranslateBrowsePaths);
+    sizes->monitoredItems = capSize(base, limits->maxMonitoredItemsPerCall);
+    
+    // With a per-node reference limit most browsed nodes need a
+    // continuation point, so more nodes per request than the server has
+    // continuation points only produces BadNoContinuationPoints retries
+    if (opts->maxReferencesPerNode > 0)
+        sizes->browse = capSize(sizes->browse, limits->maxBrowseContinuationPoints);
+    if (limits->maxMessageSize > 0)
+        sizes->read = capSize(sizes->read, limits->maxMessageSize / READ_BYTES_PER_VALUE);
+    
+    int small = (limits->maxNodesPerRead > 0 && limits->maxNodesPerRead <= SMALL_SERVER_LIMIT) ||
+                (limits->maxNodesPerBrowse > 0 && limits->maxNodesPerBrowse <= SMALL_SERVER_LIMIT);
+    if (opts->inflightAuto) {
+        size_t window = limits->maxBrowseContinuationPoints > 0 ?
+                        limits->maxBrowseContinuationPoints : INFLIGHT_AUTO_DEFAULT;
+        if (small && window > INFLIGHT_AUTO_SMALL)
+            window = INFLIGHT_AUTO_SMALL;
+        if (window > INFLIGHT_AUTO_MAX)
+            window = INFLIGHT_AUTO_MAX;
+        opts->inflight = window < 2 ? 2 : window;
+    }
+    
+    if (opts->verbose) {
+        printf("Server limits: MaxNodesPerRead=%u MaxNodesPerBrowse=%u MaxNodesPerRegisterNodes=%u\n",
+               limits->maxNodesPerRead, limits->maxNodesPerBrowse, limits->maxNodesPerRegisterNodes);
+        printf("               MaxNodesPerTranslateBrowsePaths=%u MaxMonitoredItemsPerCall=%u\n",
+               limits->maxNodesPerTranslateBrowsePaths, limits->maxMonitoredItemsPerCall);
+        printf("               MaxBrowseContinuationPoints=%u MaxArrayLength=%u\n",
+               limits->maxBrowseContinuationPoints, limits->maxArrayLength);
+        printf("Channel: receive buffer %u bytes, max message %u bytes (0 = unlimited)\n",
+               limits->recvBufferSize, limits->maxMessageSize);
+        printf("Using %zu nodes per Browse, %zu per Read, %zu MonitoredItems per call",
+               sizes->browse, sizes->read, sizes->monitoredItems);
+        if (opts->inflightAuto)
+            printf(", %zu requests in flight", opts->inflight);
+        printf("\n\n");
+    }
+}
+
+// ========== SCAN GRAPH ==========
+
+#define GRAPH_NONE ((size_t)-1)
+
+// One distinct node of the address space graph built level by level
+typedef struct {
+    UA_NodeId nodeId;
+    UA_QualifiedName browseName;
+    UA_NodeClass nodeClass;
+    size_t firstEdge;   // Forward references in browse order
+    size_t lastEdge;
+    int depth;              // Smallest depth at which the node was found
+    unsigned char unbrowsed; // Its references could not all be fetched
+    UA_DataValue value;     // Variables only
+    UA_DataValue *attributes; // --attributes of Variables, graph->attributeCount
+} GraphNode;
+
+typedef struct {
+    size_t target;
+    size_t next;
+} GraphEdge;
+
+// Nodes are unique per NodeId, so shared sub-objects are browsed and read
+// once and cycles terminate; the edges keep every reference so the graph
+// can be rendered depth-first in the same order as the recursive traversal.
+// Nodes and edges are contiguous arrays; the identifier and name strings
+// of the nodes and the index keys are interned in one string pool.
+typedef struct {
+    GraphNode *nodes;
+    size_t size;
+    size_t capacity;
+    GraphEdge *edges;
+    size_t edgesSize;
+    size_t edgesCapacity;
+    NodeIndex index;
+    StringPool strings;
+    size_t attributeCount;  // Entries of GraphNode.attributes
+    int incomplete;         // Part of the address space was dropped for lack of memory
+    size_t unbrowsed;       // Nodes whose references could not all be fetched
+    // Engines that do not discover nodes in breadth-first order set
+    // trackDepth with --max-depth; Objects and Views that come within the
+    // limit over a shorter path are collected in deepened to be browsed
+    int trackDepth;
+    int maxDepth;
+    size_t *deepened;
+    size_t deepenedSize;
+    size_t deepenedCapacity;
+} ScanGraph;
+
+static void graph_addEdge(ScanGraph *graph, size_t parent, size_t child) {
+    if (graph->edgesSize == graph->edgesCapacity) {
+        size_t newCapacity = graph->edgesCapacity ? graph->edgesCapacity * 2 : 1024;
+        GraphEdge *edges = (GraphEdge*)realloc(graph->edges, newCapacity * sizeof(GraphEdge));
+        if (!edges)
+            return;
+        graph->edges = edges;
+        graph->edgesCapacity = newCapacity;
+    }
+    
+    size_t e = graph->edgesSize++;
+    graph->edges[e].target = child;
+    graph->edges[e].next = GRAPH_NONE;
+    GraphNode *p = &graph->nodes[parent];
+    if (p->lastEdge == GRAPH_NONE)
+        p->firstEdge = e;
+    else
+        graph->edges[p->lastEdge].next = e;
+    p->lastEdge = e;
+}
+
+static int graph_expandsAt(const ScanGraph *graph, const GraphNode *node, int depth) {
+    return (node->nodeClass == UA_NODECLASS_OBJECT || node->nodeClass == UA_NODECLASS_VIEW) &&
+           (graph->maxDepth < 0 || depth < graph->maxDepth);
+}
+
+static int graph_pushIndex(size_t **items, size_t *size, size_t *capacity, size_t item) {
+    if (*size == *capacity) {
+        size_t newCapacity = *capacity ? *capacity * 2 : 64;
+        size_t *grown = (size_t*)realloc(*items, newCapacity * sizeof(size_t));
+        if (!grown)
+            return 0;
+        *items = grown;
+        *capacity = newCapacity;
+    }
+    (*items)[(*size)++] = item;
+    return 1;
+}
+
+// A known node was reached at a smaller depth. Lower it and everything
+// already found below it; a node pruned by --max-depth before that is now
+// within the limit goes to deepened, the others pass the new depth on to
+// their children. Children still to be browsed take it from their parent.
+static void graph_lowerDepth(ScanGraph *graph, size_t node, int depth) {
+    // Pairs of a lowered node and the next of its edges to look at
+    size_t *stack = NULL;
+    size_t size = 0;
+    size_t capacity = 0;
+    for (;;) {
+        GraphNode *n = &graph->nodes[node];
+        int expanded = graph_expandsAt(graph, n, n->depth);
+        n->depth = depth;
+        int ok = 1;
+        if (graph_expandsAt(graph, n, depth)) {
+            if (!expanded) {
+                ok = graph_pushIndex(&graph->deepened, &graph->deepenedSize,
+                                     &graph->deepenedCapacity, node);
+            } else {
+                ok = graph_pushIndex(&stack, &size, &capacity, node);
+                if (ok && !(ok = graph_pushIndex(&stack, &size, &capacity, n->firstEdge)))
+                    size--;
+            }
+        }
+        if (!ok)
+            graph->incomplete = 1;
+        
+        // Next child that is deeper than its parent now
+        node = GRAPH_NONE;
+        while (node == GRAPH_NONE && size > 0) {
+            size_t parent = stack[size - 2];
+            size_t e = stack[size - 1];
+            depth = graph->nodes[parent].depth + 1;
+            while (e != GRAPH_NONE && graph->nodes[graph->edges[e].target].depth <= depth)
+                e = graph->edges[e].next;
+            if (e == GRAPH_NONE) {
+                size -= 2;
+            } else {
+                node = graph->edges[e].target;
+                stack[size - 1] = graph->edges[e].next;
+            }
+        }
+        if (node == GRAPH_NONE)
+            break;
+    }
+    free(stack);
+}
+
+// Add the target of a reference as child of parent (GRAPH_NONE for the
+// root). A node that is already known only gets a new edge. Returns the
+// index of a newly created node, or GRAPH_NONE if the node was known or
+// memory ran out.
+static size_t graph_addChild(ScanGraph *graph, size_t parent, const UA_ReferenceDescription *ref) {
+    size_t existing = nodeIndex_find(&graph->index, &ref->nodeId.nodeId);
+    if (existing != NODEINDEX_EMPTY) {
+        if (parent != GRAPH_NONE) {
+            graph_addEdge(graph, parent, existing);
+            if (graph->trackDepth && graph->nodes[parent].depth + 1 < graph->nodes[existing].depth)
+                graph_lowerDepth(graph, existing, graph->nodes[parent].depth + 1);
+        }
+        return GRAPH_NONE;
+    }
+    
+    if (graph->size == graph->capacity) {
+        size_t newCapacity = graph->capacity ? graph->capacity * 2 : 1024;
+        GraphNode *nodes = (GraphNode*)realloc(graph->nodes, newCapacity * sizeof(GraphNode));
+        if (!nodes)
+            return GRAPH_NONE;
+        graph->nodes = nodes;
+        graph->capacity = newCapacity;
+    }
+    
+    size_t index = graph->size;
+    GraphNode *node = &graph->nodes[index];
+    memset(node, 0, sizeof(GraphNode));
+    graph->index.strings = &graph->strings;
+    if (stringPool_copyNodeId(&graph->strings, &ref->nodeId.nodeId, &node->nodeId) != UA_STATUSCODE_GOOD ||
+        stringPool_copyQualifiedName(&graph->strings, &ref->browseName, &node->browseName) != UA_STATUSCODE_GOOD ||
+        nodeIndex_insert(&graph->index, &node->nodeId, index) != index)
+        return GRAPH_NONE;
+    node->nodeClass = ref->nodeClass;
+    node->firstEdge = GRAPH_NONE;
+    node->lastEdge = GRAPH_NONE;
+    node->depth = parent != GRAPH_NONE ? graph->nodes[parent].depth + 1 : 0;
+    graph->size++;
+    
+    if (parent != GRAPH_NONE)
+        graph_addEdge(graph, parent, index);
+    return index;
+}
+
+// The references of a node, or the rest of them after a BrowseNext
+// (next), could not be fetched. Name it and mark it, so that the scan
+// does not pass as complete and a --diff does not take what lies below
+// it for removed.
+static void graph_dropped(ScanGraph *graph, size_t node, int next, UA_StatusCode status) {
+    GraphNode *n = &graph->nodes[node];
+    printf("  Warning: %s %.*s (%s)\n", next ? "references missing below" : "could not browse",
+           (int)n->browseName.name.length, (const char*)n->browseName.name.data,
+           UA_StatusCode_name(status));
+    if (!n->unbrowsed) {
+        n->unbrowsed = 1;
+        graph->unbrowsed++;
+    }
+}
+
+// A node is browsed again from the start after a BrowseNext was refused
+// for overload. Its children stay in the graph and get their edges back
+// from the new browse.
+static void graph_forgetEdges(ScanGraph *graph, size_t node) {
+    graph->nodes[node].firstEdge = GRAPH_NONE;
+    graph->nodes[node].lastEdge = GRAPH_NONE;
+}
+
+static int graph_complete(const ScanGraph *graph) {
+    return !graph->incomplete && graph->unbrowsed == 0;
+}
+
+static void graph_clear(ScanGraph *graph) {
+    for (size_t i = 0; i < graph->size; i++) {
+        UA_DataValue_clear(&graph->nodes[i].value);
+        if (graph->nodes[i].attributes)
+            UA_Array_delete(graph->nodes[i].attributes, graph->attributeCount,
+                            &UA_TYPES[UA_TYPES_DATAVALUE]);
+    }
+    free(graph->nodes);
+    free(graph->edges);
+    free(graph->deepened);
+    nodeIndex_clear(&graph->index);
+    stringPool_clear(&graph->strings);
+    memset(graph, 0, sizeof(ScanGraph));
+}
+
+static void graph_record(const ScanGraph *graph, size_t index, size_t parent, int depth,
+                         const ScanOptions *opts, NodeRecord *rec) {
+    const GraphNode *node = &graph->nodes[index];
+    memset(rec, 0, sizeof(NodeRecord));
+    rec->nodeId = &node->nodeId;
+    rec->browseName = &node->browseName;
+    rec->nodeClass = node->nodeClass;
+    rec->parentId = parent != GRAPH_NONE ? &graph->nodes[parent].nodeId : NULL;
+    rec->depth = depth;
+    rec->value = node->nodeClass == UA_NODECLASS_VARIABLE ? &node->value : NULL;
+    rec->attributeSet = &opts->attributes;
+    rec->attributes = node->attributes;
+    rec->server = opts->recordServer;
+}
+
+// Depth-first rendering of the collected graph. The first occurrence of a
+// deduplicated node is printed with its children; later occurrences are
+// omitted or printed as back-references.
+static void graph_print(const ScanGraph *graph, size_t index, size_t parent, int depth,
+                        unsigned char *printed, const ScanOptions *opts) {
+    const GraphNode *node = &graph->nodes[index];
+    NodeRecord rec;
+    graph_record(graph, index, parent, depth, opts, &rec);
+    
+    if (isDeduplicated(node->nodeClass)) {
+        if (printed[index]) {
+            rec.backRef = 1;
+            if (opts->backReferences)
+                emitNode(opts->out, opts->format, &rec);
+            return;
+        }
+        printed[index] = 1;
+    }
+    
+    emitNode(opts->out, opts->format, &rec);
+    for (size_t e = node->firstEdge; e != GRAPH_NONE; e = graph->edges[e].next)
+        graph_print(graph, graph->edges[e].target, index, depth + 1, printed, opts);
+}
+
+// ========== PARALLEL FORMATTING ==========
+
+// With --format-threads the rendering of a collected graph is split into
+// two stages. The calling thread walks the graph in listing order and
+// cuts the walk into batches of record descriptors; a pool of workers
+// formats the batches (value decoding and formatting is where the time
+// goes for large arrays and structures) into memory. Batches travel
+// through a bounded lock-free ring (one producer, many consumers) and
+// carry their sequence number, so the producer writes the finished text
+// strictly in order and the output is identical to the serial listing.
+
+#define FORMAT_RING_SIZE 64            // Batches in flight, a power of two
+#define FORMAT_BATCH_RECORDS 512
+#define FORMAT_PARALLEL_MIN 4096       // Smaller graphs are formatted inline
+
+typedef struct {
+    size_t index;
+    size_t parent;
+    int depth;
+    int backRef;
+} RenderItem;
+
+typedef struct {
+    RenderItem items[FORMAT_BATCH_RECORDS];
+    size_t size;
+    char *text;                     // Formatted records, from open_memstream
+    size_t textSize;
+    atomic_int done;
+} RenderBatch;
+
+// Bounded queue cell; seq tells producer and consumers whose turn it is
+typedef struct {
+    atomic_size_t seq;
+    RenderBatch *batch;
+} RenderCell;
+
+typedef struct {
+    const ScanGraph *graph;
+    const ScanOptions *opts;
+    RenderCell cells[FORMAT_RING_SIZE];
+    atomic_size_t head;             // Next cell to consume
+    size_t tail;                    // Next cell to fill, producer only
+    atomic_int finished;            // No more batches will be queued
+    RenderBatch *window[FORMAT_RING_SIZE]; // Queued, not yet written, by sequence
+    size_t written;                 // Sequence of the next batch to write
+    RenderBatch *current;           // Batch being filled
+    unsigned char *printed;
+    // Idle workers and a producer waiting for a batch sleep here instead
+    // of spinning; both sides take the lock once per batch at most
+    pthread_mutex_t lock;
+    pthread_cond_t queued;          // A batch was queued, or finished was set
+    pthread_cond_t formatted;       // A batch is done
+} RenderPipeline;
+
+static int renderRing_push(RenderPipeline *p, RenderBatch *batch) {
+    RenderCell *cell = &p->cells[p->tail & (FORMAT_RING_SIZE - 1)];
+    if (atomic_load_explicit(&cell->seq, memory_order_acquire) != p->tail)
+        return 0;
+    cell->batch = batch;
+    atomic_store_explicit(&cell->seq, p->tail + 1, memory_order_release);
+    p->tail++;
+    return 1;
+}
+
+static RenderBatch *renderRing_pop(RenderPipeline *p) {
+    size_t pos = atomic_load_explicit(&p->head, memory_order_relaxed);
+    for (;;) {
+        RenderCell *cell = &p->cells[pos & (FORMAT_RING_SIZE - 1)];
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        if (seq != pos + 1) {
+            // Either empty, or another consumer took the cell and has
+            // already moved head on
+            size_t now = atomic_load_explicit(&p->head, memory_order_relaxed);
+            if (now == pos)
+                return NULL;
+            pos = now;
+            continue;
+        }
+        if (atomic_compare_exchange_weak_explicit(&p->head, &pos, pos + 1,
+                                                  memory_order_relaxed, memory_order_relaxed)) {
+            RenderBatch *batch = cell->batch;
+            atomic_store_explicit(&cell->seq, pos + FORMAT_RING_SIZE, memory_order_release);
+            return batch;
+        }
+    }
+}
+
+static void *renderWorkerRun(void *arg) {
+    RenderPipeline *p = (RenderPipeline*)arg;
+    size_t capacity = 64 * 1024;
+    char *storage = (char*)malloc(capacity);
+    
+    for (;;) {
+        RenderBatch *batch = renderRing_pop(p);
+        if (!batch) {
+            // finished is read first: once it is set every batch is
+            // queued, so an empty ring then means there is no more work
+            pthread_mutex_lock(&p->lock);
+            for (;;) {
+                int finished = atomic_load_explicit(&p->finished, memory_order_acquire);
+                batch = renderRing_pop(p);
+                if (batch || finished)
+                    break;
+                pthread_cond_wait(&p->queued, &p->lock);
+            }
+            pthread_mutex_unlock(&p->lock);
+            if (!batch)
+                break;
+        }
+        
+        FILE *fp = storage ? open_memstream(&batch->text, &batch->textSize) : NULL;
+        if (fp) {
+            // The bytes are counted when the producer writes the batch
+            OutBuf out;
+            out_init(&out, storage, capacity, fp);
+            out.intermediate = 1;
+            for (size_t i = 0; i < batch->size; i++) {
+                const RenderItem *item = &batch->items[i];
+                NodeRecord rec;
+                graph_record(p->graph, item->index, item->parent, item->depth, p->opts, &rec);
+                rec.backRef = item->backRef;
+                emitNode(&out, p->opts->format, &rec);
+            }
+            out_flush(&out);
+            fclose(fp);
+        }
+        atomic_store_explicit(&batch->done, 1, memory_order_release);
+        pthread_mutex_lock(&p->lock);
+        pthread_cond_signal(&p->formatted);
+        pthread_mutex_unlock(&p->lock);
+    }
+    free(storage);
+    return NULL;
+}
+
+static void render_waitDone(RenderPipeline *p, RenderBatch *batch) {
+    pthread_mutex_lock(&p->lock);
+    while (!atomic_load_explicit(&batch->done, memory_order_acquire))
+        pthread_cond_wait(&p->formatted, &p->lock);
+    pthread_mutex_unlock(&p->lock);
+}
+
+// Write finished batches in sequence order; with `all` wait for every
+// queued batch
+static void render_drain(RenderPipeline *p, int all) {
+    while (p->written < p->tail) {
+        RenderBatch *batch = p->window[p->written & (FORMAT_RING_SIZE - 1)];
+        if (!atomic_load_explicit(&batch->done, memory_order_acquire)) {
+            if (!all)
+                return;
+            render_waitDone(p, batch);
+            continue;
+        }
+        if (batch->text)
+            out_write(p->opts->out, batch->text, batch->textSize);
+        else
+            printf("Error: Out of memory\n");
+        free(batch->text);
+        free(batch);
+        p->window[p->written & (FORMAT_RING_SIZE - 1)] = NULL;
+        p->written++;
+    }
+}
+
+static int render_submit(RenderPipeline *p) {
+    RenderBatch *batch = p->current;
+    p->current = NULL;
+    if (!batch || batch->size == 0) {
+        free(batch);
+        return 1;
+    }
+    // A full window means the oldest batch is still being formatted
+    while (p->tail - p->written == FORMAT_RING_SIZE) {
+        render_drain(p, 0);
+        if (p->tail - p->written == FORMAT_RING_SIZE)
+            render_waitDone(p, p->window[p->written & (FORMAT_RING_SIZE - 1)]);
+    }
+    // With the window below the ring size the cell has been consumed
+    p->window[p->tail & (FORMAT_RING_SIZE - 1)] = batch;
+    while (!renderRing_push(p, batch))
+        sched_yield();
+    pthread_mutex_lock(&p->lock);
+    pthread_cond_signal(&p->queued);
+    pthread_mutex_unlock(&p->lock);
+    render_drain(p, 0);
+    return 1;
+}
+
+static int render_add(RenderPipeline *p, size_t index, size_t parent, int depth, int backRef) {
+    if (!p->current) {
+        p->current = (RenderBatch*)calloc(1, sizeof(RenderBatch));
+        if (!p->current)
+            return 0;
+        atomic_init(&p->current->done, 0);
+    }
+    RenderItem *item = &p->current->items[p->current->size++];
+    item->index = index;
+    item->parent = parent;
+    item->depth = depth;
+    item->backRef = backRef;
+    return p->current->size < FORMAT_BATCH_RECORDS || render_submit(p);
+}
+
+// Listing order walk, mirroring graph_print()
+static int render_walk(RenderPipeline *p, size_t index, size_t parent, int depth) {
+    const ScanGraph *graph = p->graph;
+    const GraphNode *node = &graph->nodes[index];
+    if (isDeduplicated(node->nodeClass)) {
+        if (p->printed[index])
+            return !p->opts->backReferences || render_add(p, index, parent, depth, 1);
+        p->printed[index] = 1;
+    }
+    if (!render_add(p, index, parent, depth, 0))
+        return 0;
+    for (size_t e = node->firstEdge; e != GRAPH_NONE; e = graph->edges[e].next) {
+        if (!render_walk(p, graph->edges[e].target, index, depth + 1))
+            return 0;
+    }
+    return 1;
+}
+
+static void graph_renderParallel(const ScanGraph *graph, size_t root, unsigned char *printed,
+                                 const ScanOptions *opts) {
+    RenderPipeline *p = (RenderPipeline*)calloc(1, sizeof(RenderPipeline));
+    pthread_t *threads = (pthread_t*)calloc(opts->formatThreads, sizeof(pthread_t));
+    if (!p || !threads) {
+        free(p);
+        free(threads);
+        graph_print(graph, root, GRAPH_NONE, 0, printed, opts);
+        return;
+    }
+    p->graph = graph;
+    p->opts = opts;
+    p->printed = printed;
+    for (size_t i = 0; i < FORMAT_RING_SIZE; i++)
+        atomic_init(&p->cells[i].seq, i);
+    atomic_init(&p->head, 0);
+    atomic_init(&p->finished, 0);
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->queued, NULL);
+    pthread_cond_init(&p->formatted, NULL);
+    
+    size_t started = 0;
+    for (size_t i = 0; i < opts->formatThreads; i++) {
+        if (pthread_create(&threads[started], NULL, renderWorkerRun, p) == 0)
+            started++;
+    }
+    
+    int ok = started > 0 && render_walk(p, root, GRAPH_NONE, 0) && render_submit(p);
+    pthread_mutex_lock(&p->lock);
+    atomic_store_explicit(&p->finished, 1, memory_order_release);
+    pthread_cond_broadcast(&p->queued);
+    pthread_mutex_unlock(&p->lock);
+    if (!ok && started > 0)
+        printf("Error: Out of memory\n");
+    if (started == 0) {
+        graph_print(graph, root, GRAPH_NONE, 0, printed, opts);
+    } else {
+        render_drain(p, 1);
+        for (size_t i = 0; i < started; i++)
+            pthread_join(threads[i], NULL);
+    }
+    pthread_cond_destroy(&p->formatted);
+    pthread_cond_destroy(&p->queued);
+    pthread_mutex_destroy(&p->lock);
+    free(p->current);
+    free(threads);
+    free(p);
+}
+
+static void graph_render(const ScanGraph *graph, size_t root, const ScanOptions *opts) {
+    unsigned char *printed = (unsigned char*)calloc(graph->size, 1);
+    if (!printed) {
+        printf("Error: Out of memory\n");
+        return;
+    }
+    if (!opts->recordServer)
+        beginOutput(opts->out, opts->format, 0, &opts->attributes);
+    if (opts->formatThreads > 1 && graph->size >= FORMAT_PARALLEL_MIN)
+        graph_renderParallel(graph, root, printed, opts);
+    else
+        graph_print(graph, root, GRAPH_NONE, 0, printed, opts);
+    out_flush(opts->out);
+    free(printed);
+}
+
+#if UACONSOLE_WITH_SNAPSHOT
+// ========== BINARY SNAPSHOT ==========
+
+// Snapshot file layout. All fields are in host byte order and every
+// section starts on an 8-byte boundary:
+//   SnapshotHeader
+//   SnapshotNode[nodeCount]        Fixed-size node records
+//   UA_UInt32[edgeCount]           Child node indices, grouped per parent
+//   UA_UInt32[stringCount + 1]     String start offsets into the string data
+//   char[stringDataSize]           Interned strings, not NUL-terminated
+//   UA_Byte[valueDataSize]         DataValues in open62541 binary encoding
+// The loader maps the file read-only and renders it in place.
+
+#define SNAPSHOT_MAGIC "UASNAP\0"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_BYTE_ORDER 0x01020304u
+#define SNAPSHOT_NONE 0xFFFFFFFFu
+
+typedef struct {
+    char magic[8];
+    UA_UInt32 version;
+    UA_UInt32 byteOrder;            // SNAPSHOT_BYTE_ORDER as written
+    UA_DateTime createdAt;
+    UA_UInt32 serverUrl;            // String index
+    UA_UInt32 root;
+    UA_UInt32 nodeCount;
+    UA_UInt32 edgeCount;
+    UA_UInt32 stringCount;
+    UA_UInt32 reserved;
+    UA_UInt64 nodesOffset;
+    UA_UInt64 edgesOffset;
+    UA_UInt64 stringOffsetsOffset;
+    UA_UInt64 stringDataOffset;
+    UA_UInt64 stringDataSize;
+    UA_UInt64 valueDataOffset;
+    UA_UInt64 valueDataSize;
+} SnapshotHeader;
+
+typedef struct {
+    UA_UInt32 identifier;           // Numeric identifier, else string index
+    UA_UInt16 namespaceIndex;
+    UA_Byte identifierType;         // UA_NodeIdType
+    UA_Byte nodeClass;
+    UA_UInt32 browseName;           // String index
+    UA_UInt16 browseNameNs;
+    UA_UInt16 reserved;
+    UA_UInt32 firstEdge;
+    UA_UInt32 edgeCount;
+    UA_UInt32 valueOffset;          // Into the value data
+    UA_UInt32 valueSize;            // 0: no value recorded
+} SnapshotNode;
+
+// Growable byte array used to assemble the variable-size sections
+typedef struct {
+    UA_Byte *data;
+    size_t size;
+    size_t capacity;
+} ByteBuffer;
+
+static int bytes_append(ByteBuffer *buf, const void *data, size_t len) {
+    if (len > buf->capacity - buf->size) {
+        size_t newCapacity = buf->capacity ? buf->capacity : 4096;
+        while (newCapacity - buf->size < len)
+            newCapacity *= 2;
+        UA_Byte *grown = (UA_Byte*)realloc(buf->data, newCapacity);
+        if (!grown)
+            return 0;
+        buf->data = grown;
+        buf->capacity = newCapacity;
+    }
+    if (len > 0)
+        memcpy(buf->data + buf->size, data, len);
+    buf->size += len;
+    return 1;
+}
+
+typedef struct {
+    StringPool strings;             // Pool ids are the string indexes
+    ByteBuffer stringOffsets;       // UA_UInt32 start offsets (+ end)
+    ByteBuffer stringData;
+    ByteBuffer valueData;
+    UA_UInt32 stringCount;
+} SnapshotWriter;
+
+// Intern a string, returning its index or SNAPSHOT_NONE on failure
+static UA_UInt32 snapshot_intern(SnapshotWriter *w, const UA_Byte *data, size_t len) {
+    if (w->stringCount == SNAPSHOT_NONE - 1 || w->stringData.size + len > SNAPSHOT_NONE)
+        return SNAPSHOT_NONE;
+    UA_UInt32 id = stringPool_intern(&w->strings, data, len, NULL);
+    if (id == STRINGPOOL_NONE || id < w->stringCount)
+        return id;
+    
+    // A new string: append it to the string table
+    UA_UInt32 end = (UA_UInt32)(w->stringData.size + len);
+    if (!bytes_append(&w->stringData, data, len) ||
+        !bytes_append(&w->stringOffsets, &end, sizeof(UA_UInt32)))
+        return SNAPSHOT_NONE;
+    return w->stringCount++;
+}
+
+static UA_UInt32 snapshot_internString(SnapshotWriter *w, const UA_String *s) {
+    return snapshot_intern(w, s->data, s->length);
+}
+
+// Fill the identifier fields of a node record
+static int snapshot_encodeNodeId(SnapshotWriter *w, const UA_NodeId *id, SnapshotNode *rec) {
+    rec->namespaceIndex = id->namespaceIndex;
+    rec->identifierType = (UA_Byte)id->identifierType;
+    switch (id->identifierType) {
+        case UA_NODEIDTYPE_NUMERIC:
+            rec->identifier = id->identifier.numeric;
+            return 1;
+        case UA_NODEIDTYPE_STRING:
+            rec->identifier = snapshot_internString(w, &id->identifier.string);
+            break;
+        case UA_NODEIDTYPE_GUID:
+            rec->identifier = snapshot_intern(w, (const UA_Byte*)&id->identifier.guid, sizeof(UA_Guid));
+            break;
+        default:
+            rec->identifier = snapshot_internString(w, &id->identifier.byteString);
+    }
+    return rec->identifier != SNAPSHOT_NONE;
+}
+
+// Append one section and pad it to the next 8-byte boundary
+static int snapshot_section(FILE *fp, UA_UInt64 *pos, const void *data, size_t size) {
+    static const UA_Byte zeros[8] = {0};
+    size_t padding = (8 - (size & 7)) & 7;
+    if ((size > 0 && fwrite(data, 1, size, fp) != size) ||
+        (padding > 0 && fwrite(zeros, 1, padding, fp) != padding))
+        return 0;
+    *pos += size + padding;
+    return 1;
+}
+
+// Serialize a scan graph. Node records, adjacency and encoded values are
+// assembled in memory first, then written section by section.
+static int snapshot_write(const ScanGraph *graph, size_t root, const ScanOptions *opts) {
+    if (graph->size >= SNAPSHOT_NONE || graph->edgesSize >= SNAPSHOT_NONE) {
+        printf("Error: Address space too large for a snapshot\n");
+        return 0;
+    }
+    
+    SnapshotWriter w;
+    memset(&w, 0, sizeof(SnapshotWriter));
+    SnapshotNode *nodes = (SnapshotNode*)calloc(graph->size ? graph->size : 1, sizeof(SnapshotNode));
+    UA_UInt32 *edges = (UA_UInt32*)malloc((graph->edgesSize ? graph->edgesSize : 1) * sizeof(UA_UInt32));
+    UA_UInt32 zero = 0;
+    int ok = nodes && edges && bytes_append(&w.stringOffsets, &zero, sizeof(UA_UInt32));
+    
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(SnapshotHeader));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.byteOrder = SNAPSHOT_BYTE_ORDER;
+    header.createdAt = UA_DateTime_now();
+    header.root = (UA_UInt32)root;
+    header.nodeCount = (UA_UInt32)graph->size;
+    if (ok) {
+        header.serverUrl = snapshot_intern(&w, (const UA_Byte*)opts->serverUrl, strlen(opts->serverUrl));
+        ok = header.serverUrl != SNAPSHOT_NONE;
+    }
+    
+    size_t edgeCount = 0;
+    for (size_t i = 0; ok && i < graph->size; i++) {
+        const GraphNode *node = &graph->nodes[i];
+        SnapshotNode *rec = &nodes[i];
+        rec->nodeClass = (UA_Byte)node->nodeClass;
+        rec->browseNameNs = node->browseName.namespaceIndex;
+        rec->browseName = snapshot_internString(&w, &node->browseName.name);
+        ok = rec->browseName != SNAPSHOT_NONE && snapshot_encodeNodeId(&w, &node->nodeId, rec);
+        
+        rec->firstEdge = (UA_UInt32)edgeCount;
+        for (size_t e = node->firstEdge; e != GRAPH_NONE; e = graph->edges[e].next)
+            edges[edgeCount++] = (UA_UInt32)graph->edges[e].target;
+        rec->edgeCount = (UA_UInt32)edgeCount - rec->firstEdge;
+        
+        if (ok && node->nodeClass == UA_NODECLASS_VARIABLE) {
+            UA_ByteString encoded;
+            UA_ByteString_init(&encoded);
+            ok = UA_encodeBinary(&node->value, &UA_TYPES[UA_TYPES_DATAVALUE], &encoded) == UA_STATUSCODE_GOOD &&
+                 w.valueData.size + encoded.length <= SNAPSHOT_NONE;
+            rec->valueOffset = (UA_UInt32)w.valueData.size;
+            rec->valueSize = (UA_UInt32)encoded.length;
+            ok = ok && bytes_append(&w.valueData, encoded.data, encoded.length);
+            UA_ByteString_clear(&encoded);
+        }
+    }
+    header.edgeCount = (UA_UInt32)edgeCount;
+    header.stringCount = w.stringCount;
+    
+    // Written under a temporary name and renamed, so a snapshot that is
+    // mapped as the --diff baseline is never truncated underneath
+    size_t pathLen = strlen(opts->snapshotPath);
+    char *tmpPath = (char*)malloc(pathLen + 5);
+    if (tmpPath) {
+        memcpy(tmpPath, opts->snapshotPath, pathLen);
+        memcpy(tmpPath + pathLen, ".tmp", 5);
+    }
+    ok = ok && tmpPath;
+    FILE *fp = ok ? fopen(tmpPath, "wb") : NULL;
+    if (ok && !fp) {
+        printf("Error: Could not create snapshot %s\n", opts->snapshotPath);
+        ok = 0;
+    } else if (!ok) {
+        printf("Error: Could not encode snapshot\n");
+    }
+    
+    if (fp) {
+        UA_UInt64 pos = 0;
+        ok = snapshot_section(fp, &pos, &header, sizeof(SnapshotHeader));
+        header.nodesOffset = pos;
+        ok = ok && snapshot_section(fp, &pos, nodes, graph->size * sizeof(SnapshotNode));
+        header.edgesOffset = pos;
+        ok = ok && snapshot_section(fp, &pos, edges, edgeCount * sizeof(UA_UInt32));
+        header.stringOffsetsOffset = pos;
+        ok = ok && snapshot_section(fp, &pos, w.stringOffsets.data, w.stringOffsets.size);
+        header.stringDataOffset = pos;
+        header.stringDataSize = w.stringData.size;
+        ok = ok && snapshot_section(fp, &pos, w.stringData.data, w.stringData.size);
+        header.valueDataOffset = pos;
+        header.valueDataSize = w.valueData.size;
+        ok = ok && snapshot_section(fp, &pos, w.valueData.data, w.valueData.size);
+        
+        // The section offsets are only known now; rewrite the header
+        ok = ok && fseek(fp, 0, SEEK_SET) == 0 &&
+             fwrite(&header, sizeof(SnapshotHeader), 1, fp) == 1;
+        if (fclose(fp) != 0)
+            ok = 0;
+        ok = ok && rename(tmpPath, opts->snapshotPath) == 0;
+        if (!ok) {
+            printf("Error: Could not write snapshot %s\n", opts->snapshotPath);
+            remove(tmpPath);
+        } else if (opts->verbose) {
+            printf("\nSnapshot %s: %zu nodes, %zu references, %u strings, %llu bytes\n",
+                   opts->snapshotPath, graph->size, edgeCount, w.stringCount,
+                   (unsigned long long)pos);
+        }
+    }
+    
+    free(tmpPath);
+    stringPool_clear(&w.strings);
+    free(w.stringOffsets.data);
+    free(w.stringData.data);
+    free(w.valueData.data);
+    free(edges);
+    free(nodes);
+    return ok;
+}
+
+// A snapshot file mapped into memory
+typedef struct {
+    void *map;
+    size_t size;
+    const SnapshotHeader *header;
+    const SnapshotNode *nodes;
+    const UA_UInt32 *edges;
+    const UA_UInt32 *stringOffsets;
+    const char *stringData;
+    const UA_Byte *valueData;
+} Snapshot;
+
+// Does [offset, offset + count * elementSize) lie within the file?
+static int snapshot_inFile(const Snapshot *snap, UA_UInt64 offset, UA_UInt64 count, size_t elementSize) {
+    if (offset > snap->size || (offset & 7) != 0)
+        return 0;
+    return count <= (snap->size - offset) / elementSize;
+}
+
+// Check the structure once so rendering can trust every index. Only the
+// deduplicated node classes may have children: each of them is expanded
+// once, so every walk over the edges terminates even on a crafted file.
+static int snapshot_validate(const Snapshot *snap) {
+    const SnapshotHeader *h = snap->header;
+    if (!snapshot_inFile(snap, h->nodesOffset, h->nodeCount, sizeof(SnapshotNode)) ||
+        !snapshot_inFile(snap, h->edgesOffset, h->edgeCount, sizeof(UA_UInt32)) ||
+        !snapshot_inFile(snap, h->stringOffsetsOffset, (UA_UInt64)h->stringCount + 1, sizeof(UA_UInt32)) ||
+        !snapshot_inFile(snap, h->stringDataOffset, h->stringDataSize, 1) ||
+        !snapshot_inFile(snap, h->valueDataOffset, h->valueDataSize, 1) ||
+        h->root >= h->nodeCount || h->serverUrl >= h->stringCount)
+        return 0;
+    
+    const UA_UInt32 *offsets = snap->stringOffsets;
+    if (offsets[0] != 0)
+        return 0;
+    for (UA_UInt32 i = 0; i < h->stringCount; i++) {
+        if (offsets[i + 1] < offsets[i] || offsets[i + 1] > h->stringDataSize)
+            return 0;
+    }
+    for (UA_UInt32 i = 0; i < h->edgeCount; i++) {
+        if (snap->edges[i] >= h->nodeCount)
+            return 0;
+    }
+    for (UA_UInt32 i = 0; i < h->nodeCount; i++) {
+        const SnapshotNode *n = &snap->nodes[i];
+        if (n->browseName >= h->stringCount ||
+            (UA_UInt64)n->firstEdge + n->edgeCount > h->edgeCount ||
+            (UA_UInt64)n->valueOffset + n->valueSize > h->valueDataSize)
+            return 0;
+        // NodeClass is a single bit (or 0, Unspecified)
+        if ((n->nodeClass & (n->nodeClass - 1)) != 0 ||
+            (n->edgeCount > 0 && !isDeduplicated((UA_NodeClass)n->nodeClass)))
+            return 0;
+        if (n->identifierType > UA_NODEIDTYPE_BYTESTRING ||
+            (n->identifierType != UA_NODEIDTYPE_NUMERIC && n->identifier >= h->stringCount))
+            return 0;
+        if (n->identifierType == UA_NODEIDTYPE_GUID &&
+            offsets[n->identifier + 1] - offsets[n->identifier] != sizeof(UA_Guid))
+            return 0;
+    }
+    return 1;
+}
+
+static void snapshot_close(Snapshot *snap) {
+    if (snap->map)
+        munmap(snap->map, snap->size);
+    memset(snap, 0, sizeof(Snapshot));
+}
+
+static int snapshot_open(Snapshot *snap, const char *path) {
+    memset(snap, 0, sizeof(Snapshot));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        printf("Error: Could not open snapshot %s\n", path);
+        return 0;
+    }
+    
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(SnapshotHeader)) {
+        printf("Error: %s is not a snapshot\n", path);
+        close(fd);
+        return 0;
+    }
+    snap->size = (size_t)st.st_size;
+    snap->map = mmap(NULL, snap->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (snap->map == MAP_FAILED) {
+        snap->map = NULL;
+        printf("Error: Could not map snapshot %s\n", path);
+        return 0;
+    }
+    
+    const UA_Byte *base = (const UA_Byte*)snap->map;
+    snap->header = (const SnapshotHeader*)base;
+    if (memcmp(snap->header->magic, SNAPSHOT_MAGIC, sizeof(snap->header->magic)) != 0 ||
+        snap->header->version != SNAPSHOT_VERSION ||
+        snap->header->byteOrder != SNAPSHOT_BYTE_ORDER) {
+        printf("Error: %s is not a snapshot of this version and byte order\n", path);
+        snapshot_close(snap);
+        return 0;
+    }
+    snap->nodes = (const SnapshotNode*)(base + snap->header->nodesOffset);
+    snap->edges = (const UA_UInt32*)(base + snap->header->edgesOffset);
+    snap->stringOffsets = (const UA_UInt32*)(base + snap->header->stringOffsetsOffset);
+    snap->stringData = (const char*)(base + snap->header->stringDataOffset);
+    snap->valueData = base + snap->header->valueDataOffset;
+    if (!snapshot_validate(snap)) {
+        printf("Error: Snapshot %s is corrupt\n", path);
+        snapshot_close(snap);
+        return 0;
+    }
+    return 1;
+}
+
+// String of the string table; points into the mapping
+static UA_String snapshot_string(const Snapshot *snap, UA_UInt32 index) {
+    UA_String s;
+    s.length = snap->stringOffsets[index + 1] - snap->stringOffsets[index];
+    s.data = (UA_Byte*)(uintptr_t)(snap->stringData + snap->stringOffsets[index]);
+    return s;
+}
+
+// NodeId of a node record. String identifiers point into the mapping and
+// must not be cleared.
+static UA_NodeId snapshot_nodeId(const Snapshot *snap, const SnapshotNode *rec) {
+    UA_NodeId id;
+    memset(&id, 0, sizeof(UA_NodeId));
+    id.namespaceIndex = rec->namespaceIndex;
+    id.identifierType = (enum UA_NodeIdType)rec->identifierType;
+    if (rec->identifierType == UA_NODEIDTYPE_NUMERIC) {
+        id.identifier.numeric = rec->identifier;
+    } else if (rec->identifierType == UA_NODEIDTYPE_GUID) {
+        UA_String raw = snapshot_string(snap, rec->identifier);
+        memcpy(&id.identifier.guid, raw.data, sizeof(UA_Guid));
+    } else {
+        id.identifier.string = snapshot_string(snap, rec->identifier);
+    }
+    return id;
+}
+
+// Decode the recorded value of a node; the result is owned by the caller
+static void snapshot_value(const Snapshot *snap, const SnapshotNode *rec, UA_DataValue *value) {
+    UA_DataValue_init(value);
+    if (rec->valueSize == 0)
+        return;
+    UA_ByteString encoded;
+    encoded.length = rec->valueSize;
+    encoded.data = (UA_Byte*)(uintptr_t)(snap->valueData + rec->valueOffset);
+    if (UA_decodeBinary(&encoded, value, &UA_TYPES[UA_TYPES_DATAVALUE], NULL) != UA_STATUSCODE_GOOD) {
+        UA_DataValue_init(value);
+        value->hasStatus = true;
+        value->status = UA_STATUSCODE_BADDECODINGERROR;
+    }
+}
+
+// Depth-first rendering straight from the mapping, mirroring graph_print()
+// Emit one node; returns 1 if its children are to be listed next
+static int snapshot_emit(const Snapshot *snap, UA_UInt32 index, UA_UInt32 parent, int depth,
+                         unsigned char *printed, const ScanOptions *opts) {
+    const SnapshotNode *node = &snap->nodes[index];
+    UA_NodeId nodeId = snapshot_nodeId(snap, node);
+    UA_NodeId parentId;
+    UA_QualifiedName browseName;
+    browseName.namespaceIndex = node->browseNameNs;
+    browseName.name = snapshot_string(snap, node->browseName);
+    
+    NodeRecord rec;
+    memset(&rec, 0, sizeof(NodeRecord));
+    rec.nodeId = &nodeId;
+    rec.browseName = &browseName;
+    rec.nodeClass = (UA_NodeClass)node->nodeClass;
+    rec.depth = depth;
+    if (parent != SNAPSHOT_NONE) {
+        parentId = snapshot_nodeId(snap, &snap->nodes[parent]);
+        rec.parentId = &parentId;
+    }
+    
+    if (isDeduplicated(rec.nodeClass)) {
+        if (printed[index]) {
+            rec.backRef = 1;
+            if (opts->backReferences)
+                emitNode(opts->out, opts->format, &rec);
+            return 0;
+        }
+        printed[index] = 1;
+    }
+    
+    if (rec.nodeClass == UA_NODECLASS_VARIABLE) {
+        UA_DataValue value;
+        snapshot_value(snap, node, &value);
+        rec.value = &value;
+        emitNode(opts->out, opts->format, &rec);
+        UA_DataValue_clear(&value);
+    } else {
+        emitNode(opts->out, opts->format, &rec);
+    }
+    return node->edgeCount > 0;
+}
+
+// A node whose children are being listed
+typedef struct {
+    UA_UInt32 index;
+    UA_UInt32 nextEdge;
+    int depth;
+} SnapshotFrame;
+
+// Depth-first listing with an explicit stack, so the depth of the
+// recorded tree is not limited by the C stack. A node is expanded at most
+// once (see snapshot_validate), which bounds the stack by nodeCount.
+static int snapshot_print(const Snapshot *snap, unsigned char *printed, const ScanOptions *opts) {
+    UA_UInt32 root = snap->header->root;
+    if (!snapshot_emit(snap, root, SNAPSHOT_NONE, 0, printed, opts))
+        return 1;
+    
+    SnapshotFrame *stack = (SnapshotFrame*)malloc(snap->header->nodeCount * sizeof(SnapshotFrame));
+    if (!stack)
+        return 0;
+    size_t size = 1;
+    stack[0].index = root;
+    stack[0].nextEdge = 0;
+    stack[0].depth = 0;
+    while (size > 0) {
+        SnapshotFrame *top = &stack[size - 1];
+        const SnapshotNode *node = &snap->nodes[top->index];
+        if (top->nextEdge == node->edgeCount) {
+            size--;
+            continue;
+        }
+        UA_UInt32 child = snap->edges[node->firstEdge + top->nextEdge++];
+        int depth = top->depth + 1;
+        if (!snapshot_emit(snap, child, top->index, depth, printed, opts))
+            continue;
+        stack[size].index = child;
+        stack[size].nextEdge = 0;
+        stack[size].depth = depth;
+        size++;
+    }
+    free(stack);
+    return 1;
+}
+
+// Entry point of --load: render a snapshot without a server connection
+static int renderSnapshot(const char *path, const ScanOptions *opts) {
+    Snapshot snap;
+    if (!snapshot_open(&snap, path))
+        return 0;
+    
+    const SnapshotHeader *h = snap.header;
+    UA_String url = snapshot_string(&snap, h->serverUrl);
+    UA_DateTimeStruct t = UA_DateTime_toStruct(h->createdAt);
+    printf("Snapshot of %.*s taken %04u-%02u-%02u %02u:%02u:%02u\n",
+           (int)url.length, (const char*)url.data,
+           t.year, t.month, t.day, t.hour, t.min, t.sec);
+    if (opts->verbose)
+        printf("%u nodes, %u references, %u strings\n\n", h->nodeCount, h->edgeCount, h->stringCount);
+    
+    unsigned char *printed = (unsigned char*)calloc(h->nodeCount, 1);
+    if (!printed) {
+        printf("Error: Out of memory\n");
+        snapshot_close(&snap);
+        return 0;
+    }
+    beginOutput(opts->out, opts->format, 0, NULL);
+    int ok = snapshot_print(&snap, printed, opts);
+    out_flush(opts->out);
+    if (!ok)
+        printf("Error: Out of memory\n");
+    stats_addNodes(h->nodeCount);
+    free(printed);
+    snapshot_close(&snap);
+    return ok;
+}
+
+// ========== SNAPSHOT DIFF ==========
+
+// A previous snapshot used as the baseline of an incremental re-scan
+typedef struct ScanBaseline {
+    Snapshot snap;
+    const char *path;
+    NodeIndex index;            // NodeId -> snapshot node index
+    StringPool strings;         // Key identifiers of index
+    UA_UInt32 *nodeVersion;     // Per node: its NodeVersion property, or SNAPSHOT_NONE
+    UA_UInt32 *parent;          // Per node: first parent, or SNAPSHOT_NONE
+    size_t reused;              // Nodes whose recorded references were taken over
+    size_t browsed;             // Nodes browsed again
+} ScanBaseline;
+
+static int isNodeVersion(const Snapshot *snap, const SnapshotNode *node) {
+    static const char name[] = "NodeVersion";
+    UA_String s = snapshot_string(snap, node->browseName);
+    return node->nodeClass == UA_NODECLASS_VARIABLE && node->browseNameNs == 0 &&
+           s.length == sizeof(name) - 1 && memcmp(s.data, name, s.length) == 0;
+}
+
+static void baseline_close(ScanBaseline *b) {
+    nodeIndex_clear(&b->index);
+    stringPool_clear(&b->strings);
+    free(b->nodeVersion);
+    free(b->parent);
+    snapshot_close(&b->snap);
+    memset(b, 0, sizeof(ScanBaseline));
+}
+
+static int baseline_open(ScanBaseline *b, const char *path) {
+    memset(b, 0, sizeof(ScanBaseline));
+    if (!snapshot_open(&b->snap, path))
+        return 0;
+    b->index.strings = &b->strings;
+    b->path = path;
+    
+    const Snapshot *snap = &b->snap;
+    UA_UInt32 count = snap->header->nodeCount;
+    b->nodeVersion = (UA_UInt32*)malloc(count * sizeof(UA_UInt32));
+    b->parent = (UA_UInt32*)malloc(count * sizeof(UA_UInt32));
+    if (!b->nodeVersion || !b->parent) {
+        printf("Error: Out of memory\n");
+        baseline_close(b);
+        return 0;
+    }
+    for (UA_UInt32 i = 0; i < count; i++) {
+        b->nodeVersion[i] = SNAPSHOT_NONE;
+        b->parent[i] = SNAPSHOT_NONE;
+    }
+    
+    for (UA_UInt32 i = 0; i < count; i++) {
+        const SnapshotNode *node = &snap->nodes[i];
+        UA_NodeId nodeId = snapshot_nodeId(snap, node);
+        if (nodeIndex_insert(&b->index, &nodeId, i) == NODEINDEX_EMPTY) {
+            printf("Error: Out of memory\n");
+            baseline_close(b);
+            return 0;
+        }
+        for (UA_UInt32 e = 0; e < node->edgeCount; e++) {
+            UA_UInt32 child = snap->edges[node->firstEdge + e];
+            if (b->parent[child] == SNAPSHOT_NONE && child != snap->header->root)
+                b->parent[child] = i;
+            if (isNodeVersion(snap, &snap->nodes[child]))
+                b->nodeVersion[i] = child;
+        }
+    }
+    return 1;
+}
+
+// Same status and same value, ignoring timestamps
+static int sameValue(const UA_DataValue *a, const UA_DataValue *b) {
+    if (recordStatus(a) != recordStatus(b) || a->hasValue != b->hasValue)
+        return 0;
+    return !a->hasValue || UA_order(&a->value, &b->value, &UA_TYPES[UA_TYPES_VARIANT]) == UA_ORDER_EQ;
+}
+
+// Take over the recorded references of nodes whose NodeVersion property
+// still has the recorded value; the server changes NodeVersion whenever
+// references of the node are added or removed, so they need no Browse.
+// The nodes that still have to be browsed are compacted to the front of
+// the list; returns their number. Snapshots do not record reference
+// types, so nothing is reused while a reference type filter is active.
+static size_t baseline_reuse(UA_Client *client, ScanGraph *graph, size_t *nodes, size_t count,
+                             size_t readChunk, const ScanOptions *opts) {
+    ScanBaseline *b = opts->baseline;
+    const Snapshot *snap = &b->snap;
+    if (!UA_NodeId_isNull(&opts->referenceTypeId)) {
+        b->browsed += count;
+        return count;
+    }
+    UA_UInt32 *recorded = (UA_UInt32*)malloc((count ? count : 1) * sizeof(UA_UInt32));
+    size_t *candidates = (size_t*)malloc((count ? count : 1) * sizeof(size_t));
+    unsigned char *unchanged = (unsigned char*)calloc(count ? count : 1, 1);
+    if (!recorded || !candidates || !unchanged) {
+        free(recorded);
+        free(candidates);
+        free(unchanged);
+        return count;
+    }
+    
+    // Nodes of the baseline that have a NodeVersion property
+    size_t candidateCount = 0;
+    for (size_t i = 0; i < count; i++) {
+        size_t p = nodeIndex_find(&b->index, &graph->nodes[nodes[i]].nodeId);
+        recorded[i] = p != NODEINDEX_EMPTY ? (UA_UInt32)p : SNAPSHOT_NONE;
+        if (p != NODEINDEX_EMPTY && b->nodeVersion[p] != SNAPSHOT_NONE)
+            candidates[candidateCount++] = i;
+    }
+    
+    // Compare the current NodeVersion values with the recorded ones
+    for (size_t start = 0; start < candidateCount; start += readChunk) {
+        size_t chunk = candidateCount - start < readChunk ? candidateCount - start : readChunk;
+        UA_ReadRequest rReq;
+        UA_ReadRequest_init(&rReq);
+        rReq.nodesToRead = (UA_ReadValueId*)UA_Array_new(chunk, &UA_TYPES[UA_TYPES_READVALUEID]);
+        if (!rReq.nodesToRead)
+            break;
+        rReq.nodesToReadSize = chunk;
+        for (size_t c = 0; c < chunk; c++) {
+            UA_UInt32 version = b->nodeVersion[recorded[candidates[start + c]]];
+            UA_NodeId versionId = snapshot_nodeId(snap, &snap->nodes[version]);
+            UA_NodeId_copy(&versionId, &rReq.nodesToRead[c].nodeId);
+            rReq.nodesToRead[c].attributeId = UA_ATTRIBUTEID_VALUE;
+        }
+        
+        UA_ReadResponse rResp = timedRead(client, rReq);
+        UA_ReadRequest_clear(&rReq);
+        if (rResp.responseHeader.serviceResult == UA_STATUSCODE_GOOD) {
+            for (size_t c = 0; c < chunk && c < rResp.resultsSize; c++) {
+                size_t i = candidates[start + c];
+                UA_DataValue old;
+                snapshot_value(snap, &snap->nodes[b->nodeVersion[recorded[i]]], &old);
+                unchanged[i] = hasDisplayValue(&old) && hasDisplayValue(&rResp.results[c]) &&
+                               sameValue(&old, &rResp.results[c]);
+                UA_DataValue_clear(&old);
+            }
+        }
+        UA_ReadResponse_clear(&rResp);
+    }
+    
+    // Replay the recorded children of unchanged nodes, keep the others
+    size_t remaining = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (!unchanged[i]) {
+            nodes[remaining++] = nodes[i];
+            continue;
+        }
+        const SnapshotNode *node = &snap->nodes[recorded[i]];
+        for (UA_UInt32 e = 0; e < node->edgeCount; e++) {
+            const SnapshotNode *child = &snap->nodes[snap->edges[node->firstEdge + e]];
+            UA_ReferenceDescription ref;
+            UA_ReferenceDescription_init(&ref);
+            ref.nodeId.nodeId = snapshot_nodeId(snap, child);
+            ref.browseName.namespaceIndex = child->browseNameNs;
+            ref.browseName.name = snapshot_string(snap, child->browseName);
+            ref.nodeClass = (UA_NodeClass)child->nodeClass;
+            ref.isForward = true;
+            if (acceptReference(opts, &ref))
+                graph_addChild(graph, nodes[i], &ref);  // Copies; ref is borrowed
+        }
+    }
+    b->reused += count - remaining;
+    b->browsed += remaining;
+    
+    free(recorded);
+    free(candidates);
+    free(unchanged);
+    return remaining;
+}
+
+static int compareIndex(const void *a, const void *b) {
+    UA_UInt32 x = *(const UA_UInt32*)a, y = *(const UA_UInt32*)b;
+    return x < y ? -1 : x > y;
+}
+
+// Do a graph node and its baseline node reference the same children
+// (in any order)? The scratch buffer is grown as needed.
+static int sameChildren(const ScanGraph *graph, size_t index, const ScanBaseline *b, UA_UInt32 p,
+                        UA_UInt32 **scratch, size_t *scratchSize) {
+    const Snapshot *snap = &b->snap;
+    const SnapshotNode *prev = &snap->nodes[p];
+    size_t count = 0;
+    for (size_t e = graph->nodes[index].firstEdge; e != GRAPH_NONE; e = graph->edges[e].next)
+        count++;
+    if (count != prev->edgeCount)
+        return 0;
+    if (count == 0)
+        return 1;
+    
+    if (2 * count > *scratchSize) {
+        UA_UInt32 *grown = (UA_UInt32*)realloc(*scratch, 2 * count * sizeof(UA_UInt32));
+        if (!grown)
+            return 1;   // Cannot tell; do not report
+        *scratch = grown;
+        *scratchSize = 2 * count;
+    }
+    UA_UInt32 *current = *scratch;
+    UA_UInt32 *recorded = *scratch + count;
+    
+    size_t n = 0;
+    for (size_t e = graph->nodes[index].firstEdge; e != GRAPH_NONE; e = graph->edges[e].next) {
+        size_t q = nodeIndex_find(&b->index, &graph->nodes[graph->edges[e].target].nodeId);
+        if (q == NODEINDEX_EMPTY)
+            return 0;   // New child
+        current[n++] = (UA_UInt32)q;
+    }
+    memcpy(recorded, &snap->edges[prev->firstEdge], count * sizeof(UA_UInt32));
+    qsort(current, count, sizeof(UA_UInt32), compareIndex);
+    qsort(recorded, count, sizeof(UA_UInt32), compareIndex);
+    return memcmp(current, recorded, count * sizeof(UA_UInt32)) == 0;
+}
+
+// List the nodes that were added, removed or changed since the baseline.
+// A node has changed when its NodeClass, BrowseName, value or set of
+// children differs; timestamps are ignored.
+// A snapshot node is missing from the scan because the nearest of its
+// ancestors that was found could not be browsed
+static int baseline_belowUnbrowsed(const ScanGraph *graph, const ScanBaseline *b, UA_UInt32 p) {
+    const Snapshot *snap = &b->snap;
+    // The first parents of a snapshot can form a cycle
+    for (UA_UInt32 steps = 0, a = b->parent[p]; a != SNAPSHOT_NONE && steps < snap->header->nodeCount;
+         a = b->parent[a], steps++) {
+        UA_NodeId nodeId = snapshot_nodeId(snap, &snap->nodes[a]);
+        size_t index = nodeIndex_find(&graph->index, &nodeId);
+        if (index != NODEINDEX_EMPTY)
+            return graph->nodes[index].unbrowsed;
+    }
+    return 0;
+}
+
+static void baseline_report(const ScanGraph *graph, const ScanBaseline *b, const ScanOptions *opts) {
+    const Snapshot *snap = &b->snap;
+    size_t *parent = (size_t*)malloc((graph->size ? graph->size : 1) * sizeof(size_t));
+    if (!parent) {
+        printf("Error: Out of memory\n");
+        return;
+    }
+    for (size_t i = 0; i < graph->size; i++)
+        parent[i] = GRAPH_NONE;
+    for (size_t i = 0; i < graph->size; i++) {
+        for (size_t e = graph->nodes[i].firstEdge; e != GRAPH_NONE; e = graph->edges[e].next) {
+            if (parent[graph->edges[e].target] == GRAPH_NONE && graph->edges[e].target != i)
+                parent[graph->edges[e].target] = i;
+        }
+    }
+    
+    UA_UInt32 *scratch = NULL;
+    size_t scratchSize = 0;
+    size_t added = 0, removed = 0, changed = 0, unknown = 0;
+    beginOutput(opts->out, opts->format, 1, NULL);
+    
+    for (size_t i = 0; i < graph->size; i++) {
+        const GraphNode *node = &graph->nodes[i];
+        NodeRecord rec;
+        memset(&rec, 0, sizeof(NodeRecord));
+        rec.nodeId = &node->nodeId;
+        rec.browseName = &node->browseName;
+        rec.nodeClass = node->nodeClass;
+        rec.parentId = parent[i] != GRAPH_NONE ? &graph->nodes[parent[i]].nodeId : NULL;
+        rec.value = node->nodeClass == UA_NODECLASS_VARIABLE ? &node->value : NULL;
+        
+        size_t p = nodeIndex_find(&b->index, &node->nodeId);
+        if (p == NODEINDEX_EMPTY) {
+            rec.change = '+';
+            added++;
+            emitNode(opts->out, opts->format, &rec);
+            continue;
+        }
+        
+        const SnapshotNode *prev = &snap->nodes[p];
+        UA_String prevName = snapshot_string(snap, prev->browseName);
+        int differs = prev->nodeClass != (UA_Byte)node->nodeClass ||
+                      prev->browseNameNs != node->browseName.namespaceIndex ||
+                      !UA_String_equal(&prevName, &node->browseName.name);
+        UA_DataValue old;
+        UA_DataValue_init(&old);
+        if (node->nodeClass == UA_NODECLASS_VARIABLE) {
+            snapshot_value(snap, prev, &old);
+            if (!sameValue(&node->value, &old)) {
+                differs = 1;
+                rec.previous = &old;
+            }
+        }
+        if (!differs && !node->unbrowsed &&
+            !sameChildren(graph, i, b, (UA_UInt32)p, &scratch, &scratchSize))
+            differs = 1;
+        if (differs) {
+            rec.change = '~';
+            changed++;
+            emitNode(opts->out, opts->format, &rec);
+        }
+        UA_DataValue_clear(&old);
+    }
+    
+    for (UA_UInt32 p = 0; p < snap->header->nodeCount; p++) {
+        const SnapshotNode *prev = &snap->nodes[p];
+        UA_NodeId nodeId = snapshot_nodeId(snap, prev);
+        if (nodeIndex_find(&graph->index, &nodeId) != NODEINDEX_EMPTY)
+            continue;
+        if (graph->unbrowsed > 0 && baseline_belowUnbrowsed(graph, b, p)) {
+            unknown++;
+            continue;
+        }
+        
+        UA_QualifiedName browseName;
+        browseName.namespaceIndex = prev->browseNameNs;
+        browseName.name = snapshot_string(snap, prev->browseName);
+        UA_NodeId parentId;
+        UA_DataValue old;
+        UA_DataValue_init(&old);
+        
+        NodeRecord rec;
+        memset(&rec, 0, sizeof(NodeRecord));
+        rec.nodeId = &nodeId;
+        rec.browseName = &browseName;
+        rec.nodeClass = (UA_NodeClass)prev->nodeClass;
+        if (b->parent[p] != SNAPSHOT_NONE) {
+            parentId = snapshot_nodeId(snap, &snap->nodes[b->parent[p]]);
+            rec.parentId = &parentId;
+        }
+        if (rec.nodeClass == UA_NODECLASS_VARIABLE) {
+            snapshot_value(snap, prev, &old);
+            rec.value = &old;
+        }
+        rec.change = '-';
+        removed++;
+        emitNode(opts->out, opts->format, &rec);
+        UA_DataValue_clear(&old);
+    }
+    out_flush(opts->out);
+    
+    printf("\nChanges since %s: %zu added, %zu removed, %zu changed\n",
+           b->path, added, removed, changed);
+    if (unknown > 0)
+        printf("%zu nodes below nodes that could not be browsed were not compared\n", unknown);
+    if (opts->verbose)
+        printf("References taken over by NodeVersion for %zu nodes, %zu nodes browsed\n",
+               b->reused, b->browsed);
+    free(scratch);
+    free(parent);
+}
+
+#endif
+
+// Render the scan result, or the changes against the baseline, and save
+// it as a snapshot if requested. An incomplete scan is not saved: as a
+// baseline it would report the missing part as added on the next --diff.
+static void graph_finish(const ScanGraph *graph, size_t root, const ScanOptions *opts) {
+    stats_addNodes(graph->size);
+    if (opts->verbose)
+        printf("Graph: %zu nodes, %zu references, %zu distinct strings (%zu bytes)\n\n",
+               graph->size, graph->edgesSize, graph->strings.size, graph->strings.arena.allocated);
+#if UACONSOLE_WITH_SNAPSHOT
+    if (opts->baseline)
+        baseline_report(graph, opts->baseline, opts);
+    else
+        graph_render(graph, root, opts);
+#else
+    graph_render(graph, root, opts);
+#endif
+    if (graph->unbrowsed > 0)
+        printf("Error: %zu nodes could not be browsed, the listing is incomplete\n",
+               graph->unbrowsed);
+#if UACONSOLE_WITH_SNAPSHOT
+    if (opts->snapshotPath && !graph_complete(graph))
+        printf("Error: Incomplete scan, snapshot %s not written\n", opts->snapshotPath);
+    else if (opts->snapshotPath)
+        snapshot_write(graph, root, opts);
+#endif
+}
+
+// ========== BATCHED BREADTH-FIRST TRAVERSAL ==========
+
+typedef struct {
+    ScanGraph *graph;
+    const ScanOptions *opts;
+    int next;               // Handling BrowseNext results
+    int retry;              // Nodes refused for overload go to requeue
+    size_t *requeue;
+    size_t requeueSize;
+    size_t overloaded;
+} GraphBrowseContext;
+
+// Append the accepted references of a BrowseResult as children of the
+// graph node given as owner
+static void graphBrowseHandler(void *context, size_t owner, UA_BrowseResult *result) {
+    GraphBrowseContext *ctx = (GraphBrowseContext*)context;
+    if (result->statusCode != UA_STATUSCODE_GOOD) {
+        if (ctx->retry && throttle_overloadStatus(result->statusCode)) {
+            graph_forgetEdges(ctx->graph, owner);
+            ctx->requeue[ctx->requeueSize++] = owner;
+            ctx->overloaded++;
+        } else {
+            graph_dropped(ctx->graph, owner, ctx->next, result->statusCode);
+        }
+        return;
+    }
+    for (size_t r = 0; r < result->referencesSize; r++) {
+        if (acceptReference(ctx->opts, &result->references[r]))
+            graph_addChild(ctx->graph, owner, &result->references[r]);
+    }
+}
+
+// Browse a chunk of graph nodes with a single Browse request and add their
+// forward references as children. Newly discovered nodes are appended
+// contiguously at the graph's end.
+// Continuation points are drained with batched BrowseNext requests. Nodes
+// the server refuses with BadNoContinuationPoints are retried in smaller
+// chunks once the granted continuation points have been released, nodes
+// refused for overload in smaller chunks after a pause. Nodes that cannot
+// be browsed are left to graph_dropped().
+static void browseBatch(UA_Client *client, ScanGraph *graph, const size_t *parents, size_t count,
+                        const ScanOptions *opts) {
+    size_t *pending = (size_t*)malloc(count * sizeof(size_t));
+    size_t *retry = (size_t*)malloc(count * sizeof(size_t));
+    size_t *owners = (size_t*)malloc(count * sizeof(size_t));
+    UA_ByteString *cps = (UA_ByteString*)malloc(count * sizeof(UA_ByteString));
+    if (!pending || !retry || !owners || !cps) {
+        for (size_t i = 0; i < count; i++)
+            graph_dropped(graph, parents[i], 0, UA_STATUSCODE_BADOUTOFMEMORY);
+        free(pending);
+        free(retry);
+        free(owners);
+        free(cps);
+        return;
+    }
+    memcpy(pending, parents, count * sizeof(size_t));
+    size_t pendingSize = count;
+    GraphBrowseContext ctx;
+    memset(&ctx, 0, sizeof(GraphBrowseContext));
+    ctx.graph = graph;
+    ctx.opts = opts;
+    ctx.requeue = retry;
+    size_t chunk = count;
+    unsigned overloads = 0;
+    
+    while (pendingSize > 0) {
+        size_t sent = pendingSize < chunk ? pendingSize : chunk;
+        
+        UA_BrowseRequest bReq;
+        UA_BrowseRequest_init(&bReq);
+        bReq.requestedMaxReferencesPerNode = opts->maxReferencesPerNode;
+        bReq.nodesToBrowse = (UA_BrowseDescription*)
+            UA_Array_new(sent, &UA_TYPES[UA_TYPES_BROWSEDESCRIPTION]);
+        if (!bReq.nodesToBrowse) {
+            for (size_t i = 0; i < pendingSize; i++)
+                graph_dropped(graph, pending[i], 0, UA_STATUSCODE_BADOUTOFMEMORY);
+            break;
+        }
+        bReq.nodesToBrowseSize = sent;
+        for (size_t i = 0; i < sent; i++) {
+            UA_NodeId_copy(&graph->nodes[pending[i]].nodeId, &bReq.nodesToBrowse[i].nodeId);
+            initBrowseDescription(&bReq.nodesToBrowse[i], opts);
+        }
+        
+        UA_BrowseResponse bResp = timedBrowse(client, bReq);
+        UA_BrowseRequest_clear(&bReq);
+        UA_StatusCode serviceResult = bResp.responseHeader.serviceResult;
+        if (throttle_retry(&overloads, throttle_overloadStatus(serviceResult))) {
+            UA_BrowseResponse_clear(&bResp);
+            chunk = sent > 1 ? sent / 2 : 1;
+            throttle_backoff();
+            continue;
+        }
+        if (serviceResult != UA_STATUSCODE_GOOD) {
+            // The rest of the chunk is not sent to a server that fails
+            for (size_t i = 0; i < pendingSize; i++)
+                graph_dropped(graph, pending[i], 0, serviceResult);
+            UA_BrowseResponse_clear(&bResp);
+            break;
+        }
+        
+        size_t cpCount = 0;
+        size_t refused = 0;
+        ctx.retry = overloads < THROTTLE_RETRIES;
+        ctx.requeueSize = 0;
+        ctx.overloaded = 0;
+        for (size_t i = 0; i < sent; i++) {
+            if (i >= bResp.resultsSize) {
+                graph_dropped(graph, pending[i], 0, UA_STATUSCODE_BADUNEXPECTEDERROR);
+                continue;
+            }
+            UA_BrowseResult *result = &bResp.results[i];
+            if (result->statusCode == UA_STATUSCODE_BADNOCONTINUATIONPOINTS) {
+                retry[ctx.requeueSize++] = pending[i];
+                refused++;
+                continue;
+            }
+            ctx.next = 0;
+            graphBrowseHandler(&ctx, pending[i], result);
+            if (result->continuationPoint.length > 0) {
+                cps[cpCount] = result->continuationPoint;
+                UA_ByteString_init(&result->continuationPoint);
+                owners[cpCount++] = pending[i];
+            }
+        }
+        UA_BrowseResponse_clear(&bResp);
+        
+        size_t granted = cpCount;
+        ctx.next = 1;
+        browseNextAll(client, cps, owners, cpCount, graphBrowseHandler, &ctx);
+        
+        if (refused > 0 && sent == 1) {
+            // Not even a single continuation point is available
+            graph_dropped(graph, retry[0], 0, UA_STATUSCODE_BADNOCONTINUATIONPOINTS);
+            ctx.requeueSize = 0;
+        }
+        if (refused > 0)
+            chunk = granted > 0 ? granted : 1;
+        if (throttle_retry(&overloads, ctx.overloaded > 0)) {
+            if (sent / 2 < chunk)
+                chunk = sent > 1 ? sent / 2 : 1;
+            throttle_backoff();
+        }
+        size_t retrySize = ctx.requeueSize;
+        
+        // Retried nodes go first, followed by the ones not sent yet
+        memmove(&pending[retrySize], &pending[sent], (pendingSize - sent) * sizeof(size_t));
+        memcpy(pending, retry, retrySize * sizeof(size_t));
+        pendingSize = retrySize + pendingSize - sent;
+    }
+    
+    free(pending);
+    free(retry);
+    free(owners);
+    free(cps);
+}
+
+// Variables per value Read: each takes 1 + attrs->count operations
+static size_t readNodesPerRequest(const ScanOptions *opts) {
+    size_t n = opts->sizes.read / (1 + opts->attributes.count);
+    return n > 0 ? n : 1;
+}
+
+// Fill the items of a value Read for one Variable: the Value, then the
+// extra attributes. The NodeId is moved into the first item.
+static void initValueItems(UA_ReadValueId *items, UA_NodeId *nodeId, const AttributeSet *attrs) {
+    items[0].nodeId = *nodeId;
+    items[0].attributeId = UA_ATTRIBUTEID_VALUE;
+    for (size_t k = 0; k < attrs->count; k++) {
+        UA_NodeId_copy(nodeId, &items[1 + k].nodeId);
+        items[1 + k].attributeId = attrs->ids[k];
+    }
+    UA_NodeId_init(nodeId);
+}
+
+// Build a Read request for the Value (and extra attributes) of the given
+// graph nodes
+static UA_StatusCode initValueRead(UA_ReadRequest *rReq, const ScanGraph *graph,
+                                   const size_t *variables, size_t count, const AttributeSet *attrs) {
+    size_t stride = 1 + attrs->count;
+    UA_ReadRequest_init(rReq);
+    rReq->nodesToRead = (UA_ReadValueId*)UA_Array_new(count * stride, &UA_TYPES[UA_TYPES_READVALUEID]);
+    if (!rReq->nodesToRead)
+        return UA_STATUSCODE_BADOUTOFMEMORY;
+    rReq->nodesToReadSize = count * stride;
+    rReq->timestampsToReturn = UA_TIMESTAMPSTORETURN_BOTH;
+    for (size_t i = 0; i < count; i++) {
+        UA_NodeId nodeId;
+        UA_NodeId_copy(&graph->nodes[variables[i]].nodeId, &nodeId);
+        initValueItems(&rReq->nodesToRead[i * stride], &nodeId, attrs);
+    }
+    return UA_STATUSCODE_GOOD;
+}
+
+// Store the results of a value Read in the graph, taking ownership of the
+// decoded values. Failed reads are recorded as a bare status.
+static void applyValueRead(ScanGraph *graph, const size_t *variables, size_t count,
+                           UA_ReadResponse *rResp, const AttributeSet *attrs) {
+    size_t stride = 1 + attrs->count;
+    graph->attributeCount = attrs->count;
+    for (size_t i = 0; i < count; i++) {
+        GraphNode *node = &graph->nodes[variables[i]];
+        UA_DataValue_clear(&node->value);
+        if (rResp->responseHeader.serviceResult != UA_STATUSCODE_GOOD) {
+            node->value.hasStatus = true;
+            node->value.status = rResp->responseHeader.serviceResult;
+            continue;
+        }
+        if ((i + 1) * stride > rResp->resultsSize) {
+            node->value.hasStatus = true;
+            node->value.status = UA_STATUSCODE_BADUNEXPECTEDERROR;
+            continue;
+        }
+        node->value = rResp->results[i * stride];
+        UA_DataValue_init(&rResp->results[i * stride]);
+        if (attrs->count == 0)
+            continue;
+        if (!node->attributes)
+            node->attributes = (UA_DataValue*)UA_Array_new(attrs->count, &UA_TYPES[UA_TYPES_DATAVALUE]);
+        for (size_t k = 0; node->attributes && k < attrs->count; k++) {
+            UA_DataValue_clear(&node->attributes[k]);
+            node->attributes[k] = rResp->results[i * stride + 1 + k];
+            UA_DataValue_init(&rResp->results[i * stride + 1 + k]);
+        }
+    }
+}
+
+// Variables among items whose value Read was refused for overload, after
+// applyValueRead(); they are moved to the front of retry, which may be
+// items itself
+static size_t valueRead_overloaded(const ScanGraph *graph, const size_t *items, size_t count,
+                                   size_t *retry) {
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++) {
+        const GraphNode *node = &graph->nodes[items[i]];
+        int overloaded = node->value.hasStatus && throttle_overloadStatus(node->value.status);
+        for (size_t k = 0; !overloaded && node->attributes && k < graph->attributeCount; k++)
+            overloaded = node->attributes[k].hasStatus &&
+                         throttle_overloadStatus(node->attributes[k].status);
+        if (overloaded)
+            retry[n++] = items[i];
+    }
+    return n;
+}
+
+// Read the Value attribute of a chunk of Variables with a single Read
+// request; Variables refused for overload are read again after a pause
+static void readBatch(UA_Client *client, ScanGraph *graph, const size_t *variables, size_t count,
+                      const AttributeSet *attrs) {
+    size_t *retry = (size_t*)malloc(count * sizeof(size_t));
+    const size_t *items = variables;
+    unsigned overloads = 0;
+    while (count > 0) {
+        UA_ReadRequest rReq;
+        if (initValueRead(&rReq, graph, items, count, attrs) != UA_STATUSCODE_GOOD)
+            break;
+        
+        UA_ReadResponse rResp = timedRead(client, rReq);
+        applyValueRead(graph, items, count, &rResp, attrs);
+        
+        UA_ReadResponse_clear(&rResp);
+        UA_ReadRequest_clear(&rReq);
+        
+        count = retry ? valueRead_overloaded(graph, items, count, retry) : 0;
+        items = retry;
+        if (!throttle_retry(&overloads, count > 0))
+            break;
+        throttle_backoff();
+    }
+    free(retry);
+}
+
+// Breadth-first traversal: every level is browsed with as few Browse
+// requests as the server's MaxNodesPerBrowse allows, and the values of all
+// Variables found on that level are fetched with batched Read requests.
+// Fills the caller's graph; returns the root index or GRAPH_NONE.
+static size_t scanBatched(UA_Client *client, UA_NodeId rootId, const ScanOptions *opts, ScanGraph *graph) {
+    UA_ReferenceDescription rootRef;
+    if (readRootReference(client, rootId, &rootRef) != UA_STATUSCODE_GOOD)
+        return GRAPH_NONE;
+    
+    size_t browseChunk = opts->sizes.browse;
+    size_t valueChunk = readNodesPerRequest(opts);
+    
+    size_t root = graph_addChild(graph, GRAPH_NONE, &rootRef);
+    UA_ReferenceDescription_clear(&rootRef);
+    if (root == GRAPH_NONE) {
+        printf("Error: Out of memory\n");
+        return GRAPH_NONE;
+    }
+    
+    // Nodes discovered on the current level, in discovery order
+    size_t *level = (size_t*)malloc(sizeof(size_t));
+    if (!level) {
+        printf("Error: Out of memory\n");
+        return GRAPH_NONE;
+    }
+    size_t levelSize = 1;
+    level[0] = root;
+    
+    // The root itself may be a Variable
+    if (graph->nodes[root].nodeClass == UA_NODECLASS_VARIABLE && !opts->browseOnly)
+        readBatch(client, graph, level, 1, &opts->attributes);
+    
+    int depth = 0;
+    while (levelSize > 0) {
+        // Split the level into nodes to expand and Variables to read
+        size_t expandSize = 0;
+        size_t *expand = (size_t*)malloc(levelSize * sizeof(size_t));
+        if (!expand) {
+            graph->incomplete = 1;
+            break;
+        }
+        for (size_t i = 0; i < levelSize; i++) {
+            UA_NodeClass nc = graph->nodes[level[i]].nodeClass;
+            if ((nc == UA_NODECLASS_OBJECT || nc == UA_NODECLASS_VIEW) && expandAtDepth(opts, depth))
+                expand[expandSize++] = level[i];
+        }
+        free(level);
+        level = NULL;
+        levelSize = 0;
+        if (expandSize == 0) {
+            free(expand);
+            break;
+        }
+        
+        // Browse the level chunk by chunk; children are collected as the next level
+        size_t nextCapacity = 0;
+        size_t *next = NULL;
+        for (size_t start = 0, chunk; start < expandSize; start += chunk) {
+            chunk = throttle_scaled(browseChunk);
+            size_t count = expandSize - start < chunk ? expandSize - start : chunk;
+            size_t before = graph->size;
+#if UACONSOLE_WITH_SNAPSHOT
+            if (opts->baseline)
+                count = baseline_reuse(client, graph, &expand[start], count, opts->sizes.read, opts);
+#endif
+            if (count > 0)
+                browseBatch(client, graph, &expand[start], count, opts);
+            size_t added = graph->size - before;
+            if (levelSize + added > nextCapacity) {
+                nextCapacity = (levelSize + added) * 2;
+                size_t *grown = (size_t*)realloc(next, nextCapacity * sizeof(size_t));
+                if (!grown) {
+                    // The children already browsed stay in the graph as leaves
+                    graph->incomplete = 1;
+                    break;
+                }
+                next = grown;
+            }
+            for (size_t n = before; n < graph->size; n++)
+                next[levelSize++] = n;
+        }
+        free(expand);
+        level = next;
+        depth++;
+        
+        // Read all Variables of the new level in batches
+        size_t varSize = 0;
+        size_t *vars = (size_t*)malloc((levelSize ? levelSize : 1) * sizeof(size_t));
+        if (!vars) {
+            graph->incomplete = 1;
+            break;
+        }
+        for (size_t i = 0; i < levelSize; i++) {
+            if (graph->nodes[level[i]].nodeClass == UA_NODECLASS_VARIABLE)
+                vars[varSize++] = level[i];
+        }
+        for (size_t start = 0, chunk; start < varSize && !opts->browseOnly; start += chunk) {
+            chunk = throttle_scaled(valueChunk);
+            size_t count = varSize - start < chunk ? varSize - start : chunk;
+            readBatch(client, graph, &vars[start], count, &opts->attributes);
+        }
+        free(vars);
+        
+        if (opts->verbose)
+            printf("  Level %d: %zu nodes, %zu variables\n", depth, levelSize, varSize);
+        // Deeper levels would hang off an arbitrary subset of this one
+        if (graph->incomplete)
+            break;
+    }
+    free(level);
+    
+    if (graph->incomplete)
+        printf("Error: Out of memory, the listing is incomplete from level %d on\n", depth);
+    if (opts->verbose)
+        printf("\n");
+    return root;
+}
+
+// The batched result is rendered depth-first once the traversal is complete.
+// Returns 1 if the whole address space was listed.
+static int browseBatched(UA_Client *client, UA_NodeId rootId, const ScanOptions *opts) {
+    ScanGraph graph;
+    memset(&graph, 0, sizeof(ScanGraph));
+    size_t root = scanBatched(client, rootId, opts, &graph);
+    if (root != GRAPH_NONE)
+        graph_finish(&graph, root, opts);
+    int complete = root != GRAPH_NONE && graph_complete(&graph);
+    graph_clear(&graph);
+    return complete;
+}
+
+// ========== PIPELINED ASYNCHRONOUS TRAVERSAL ==========
+
+// FIFO of graph node indices waiting for a Browse or Read request
+typedef struct {
+    size_t *items;
+    size_t head;
+    size_t size;
+    size_t capacity;
+} IndexQueue;
+
+static void queue_push(IndexQueue *q, size_t item) {
+    if (q->head + q->size == q->capacity) {
+        if (q->head > 0) {
+            // Reclaim the consumed front before growing
+            memmove(q->items, &q->items[q->head], q->size * sizeof(size_t));
+            q->head = 0;
+        }
+        if (q->size == q->capacity) {
+            size_t newCapacity = q->capacity ? q->capacity * 2 : 1024;
+            size_t *items = (size_t*)realloc(q->items, newCapacity * sizeof(size_t));
+            if (!items)
+                return;
+            q->items = items;
+            q->capacity = newCapacity;
+        }
+    }
+    q->items[q->head + q->size++] = item;
+}
+
+// Pop up to max items into out; returns the number popped
+static size_t queue_pop(IndexQueue *q, size_t *out, size_t max) {
+    size_t n = q->size < max ? q->size : max;
+    memcpy(out, &q->items[q->head], n * sizeof(size_t));
+    q->head += n;
+    q->size -= n;
+    if (q->size == 0)
+        q->head = 0;
+    return n;
+}
+
+static void queue_clear(IndexQueue *q) {
+    free(q->items);
+    memset(q, 0, sizeof(IndexQueue));
+}
+
+#if UACONSOLE_WITH_ASYNC
+typedef struct {
+    UA_Client *client;
+    const ScanOptions *opts;
+    ScanGraph graph;
+    IndexQueue toBrowse;
+    IndexQueue toRead;
+    size_t inflight;
+    size_t browseChunk;
+    size_t readChunk;
+    UA_StatusCode error;
+    unsigned overloads;         // Overloaded responses in a row, see throttle_retry()
+    // Continuation points left behind after an error, released at the end
+    UA_ByteString *orphanedCps;
+    size_t orphanedCpsSize;
+} AsyncScan;
+
+// Per-request context: the graph nodes the request was sent for, in
+// request order
+typedef struct {
+    AsyncScan *scan;
+    UA_UInt64 sentAt;           // For --stats
+    size_t sentBytes;
+    size_t count;
+    size_t nodes[];
+} AsyncRequest;
+
+static AsyncRequest *asyncRequest_new(AsyncScan *scan, size_t count) {
+    AsyncRequest *req = (AsyncRequest*)malloc(sizeof(AsyncRequest) + count * sizeof(size_t));
+    if (req) {
+        req->scan = scan;
+        req->sentAt = stats_now();
+        req->sentBytes = 0;
+        req->count = count;
+    }
+    return req;
+}
+
+static void asyncScan_orphan(AsyncScan *scan, UA_ByteString *cp) {
+    UA_ByteString *cps = (UA_ByteString*)realloc(scan->orphanedCps,
+        (scan->orphanedCpsSize + 1) * sizeof(UA_ByteString));
+    if (!cps) {
+        UA_ByteString_clear(cp);
+        return;
+    }
+    scan->orphanedCps = cps;
+    scan->orphanedCps[scan->orphanedCpsSize++] = *cp;
+    UA_ByteString_init(cp);
+}
+
+// Queue newly discovered nodes for expansion or value reading
+static void asyncScan_addChildren(AsyncScan *scan, size_t parent, const UA_BrowseResult *result) {
+    for (size_t r = 0; r < result->referencesSize; r++) {
+        if (!acceptReference(scan->opts, &result->references[r]))
+            continue;
+        size_t child = graph_addChild(&scan->graph, parent, &result->references[r]);
+        if (child == GRAPH_NONE)
+            continue;
+        UA_NodeClass nc = scan->graph.nodes[child].nodeClass;
+        if (nc == UA_NODECLASS_OBJECT || nc == UA_NODECLASS_VIEW) {
+            if (expandAtDepth(scan->opts, scan->graph.nodes[child].depth))
+                queue_push(&scan->toBrowse, child);
+        }
+        else if (nc == UA_NODECLASS_VARIABLE)
+            queue_push(&scan->toRead, child);
+    }
+    for (size_t i = 0; i < scan->graph.deepenedSize; i++)
+        queue_push(&scan->toBrowse, scan->graph.deepened[i]);
+    scan->graph.deepenedSize = 0;
+}
+
+static void asyncSendBrowseNext(AsyncScan *scan, UA_ByteString *cps, const size_t *owners, size_t count);
+
+// Queue a node refused for overload to be browsed again from the start
+static void asyncScan_requeue(AsyncScan *scan, size_t node, int next) {
+    if (next)
+        graph_forgetEdges(&scan->graph, node);
+    queue_push(&scan->toBrowse, node);
+}
+
+// Shared handling of Browse and BrowseNext (next) results
+static void asyncHandleBrowseResults(AsyncScan *scan, AsyncRequest *req, int next, UA_StatusCode serviceResult,
+                                     UA_BrowseResult *results, size_t resultsSize) {
+    scan->inflight--;
+    int overloaded = throttle_overloadStatus(serviceResult);
+    for (size_t i = 0; !overloaded && serviceResult == UA_STATUSCODE_GOOD && i < resultsSize; i++)
+        overloaded = throttle_overloadStatus(results[i].statusCode);
+    int retry = throttle_retry(&scan->overloads, overloaded);
+    if (retry && serviceResult != UA_STATUSCODE_GOOD) {
+        for (size_t i = 0; i < req->count; i++)
+            asyncScan_requeue(scan, req->nodes[i], next);
+        free(req);
+        return;
+    }
+    if (serviceResult != UA_STATUSCODE_GOOD) {
+        if (scan->error == UA_STATUSCODE_GOOD)
+            scan->error = serviceResult;
+        for (size_t i = 0; i < req->count; i++)
+            graph_dropped(&scan->graph, req->nodes[i], next, serviceResult);
+        free(req);
+        return;
+    }
+    
+    UA_ByteString *cps = (UA_ByteString*)malloc(req->count * sizeof(UA_ByteString));
+    size_t *owners = (size_t*)malloc(req->count * sizeof(size_t));
+    size_t cpCount = 0;
+    for (size_t i = 0; i < req->count; i++) {
+        if (i >= resultsSize) {
+            graph_dropped(&scan->graph, req->nodes[i], next, UA_STATUSCODE_BADUNEXPECTEDERROR);
+            continue;
+        }
+        UA_BrowseResult *result = &results[i];
+        if (result->statusCode == UA_STATUSCODE_BADNOCONTINUATIONPOINTS && !next) {
+            // Retry once other requests have returned their continuation points
+            if (scan->inflight > 0 || cpCount > 0)
+                queue_push(&scan->toBrowse, req->nodes[i]);
+            else
+                graph_dropped(&scan->graph, req->nodes[i], next, result->statusCode);
+            continue;
+        }
+        if (retry && throttle_overloadStatus(result->statusCode)) {
+            asyncScan_requeue(scan, req->nodes[i], next);
+            continue;
+        }
+        if (result->statusCode != UA_STATUSCODE_GOOD)
+            graph_dropped(&scan->graph, req->nodes[i], next, result->statusCode);
+        asyncScan_addChildren(scan, req->nodes[i], result);
+        if (result->continuationPoint.length == 0)
+            continue;
+        if (cps && owners && scan->error == UA_STATUSCODE_GOOD) {
+            cps[cpCount] = result->continuationPoint;
+            UA_ByteString_init(&result->continuationPoint);
+            owners[cpCount++] = req->nodes[i];
+        } else {
+            asyncScan_orphan(scan, &result->continuationPoint);
+        }
+    }
+    
+    if (cpCount > 0)
+        asyncSendBrowseNext(scan, cps, owners, cpCount);
+    free(cps);
+    free(owners);
+    free(req);
+}
+
+static void asyncBrowseCallback(UA_Client *client, void *userdata, UA_UInt32 requestId,
+                                UA_BrowseResponse *response) {
+    AsyncRequest *req = (AsyncRequest*)userdata;
+    stats_record(STAT_BROWSE, req->sentAt, req->count, req->sentBytes,
+                 stats_size(response, &UA_TYPES[UA_TYPES_BROWSERESPONSE]));
+    throttle_observe(req->sentAt, req->count,
+                     throttle_browseStatus(response->responseHeader.serviceResult,
+                                           response->results, response->resultsSize));
+    asyncHandleBrowseResults(req->scan, req, 0, response->responseHeader.serviceResult,
+                             response->results, response->resultsSize);
+}
+
+static void asyncBrowseNextCallback(UA_Client *client, void *userdata, UA_UInt32 requestId,
+                                    void *response) {
+    AsyncRequest *req = (AsyncRequest*)userdata;
+    UA_BrowseNextResponse *resp = (UA_BrowseNextResponse*)response;
+    stats_record(STAT_BROWSENEXT, req->sentAt, req->count, req->sentBytes,
+                 stats_size(resp, &UA_TYPES[UA_TYPES_BROWSENEXTRESPONSE]));
+    throttle_observe(req->sentAt, req->count,
+                     throttle_browseStatus(resp->responseHeader.serviceResult,
+                                           resp->results, resp->resultsSize));
+    asyncHandleBrowseResults(req->scan, req, 1, resp->responseHeader.serviceResult,
+                             resp->results, resp->resultsSize);
+}
+
+static void asyncReadCallback(UA_Client *client, void *userdata, UA_UInt32 requestId,
+                              UA_ReadResponse *response) {
+    AsyncRequest *req = (AsyncRequest*)userdata;
+    AsyncScan *scan = req->scan;
+    stats_record(STAT_READ_VALUE, req->sentAt, req->count, req->sentBytes,
+                 stats_size(response, &UA_TYPES[UA_TYPES_READRESPONSE]));
+    throttle_observe(req->sentAt, req->count, throttle_readStatus(response));
+    scan->inflight--;
+    applyValueRead(&scan->graph, req->nodes, req->count, response, &scan->opts->attributes);
+    // Refused Variables are read again in later requests
+    size_t refused = valueRead_overloaded(&scan->graph, req->nodes, req->count, req->nodes);
+    if (throttle_retry(&scan->overloads, refused > 0)) {
+        for (size_t i = 0; i < refused; i++)
+            queue_push(&scan->toRead, req->nodes[i]);
+    }
+    free(req);
+}
+
+// Continue draining continuation points; consumes the entries of cps
+static void asyncSendBrowseNext(AsyncScan *scan, UA_ByteString *cps, const size_t *owners, size_t count) {
+    AsyncRequest *req = asyncRequest_new(scan, count);
+    if (!req) {
+        for (size_t i = 0; i < count; i++)
+            asyncScan_orphan(scan, &cps[i]);
+        return;
+    }
+    memcpy(req->nodes, owners, count * sizeof(size_t));
+    
+    UA_BrowseNextRequest bnReq;
+    UA_BrowseNextRequest_init(&bnReq);
+    bnReq.continuationPoints = cps;
+    bnReq.continuationPointsSize = count;
+    req->sentBytes = stats_size(&bnReq, &UA_TYPES[UA_TYPES_BROWSENEXTREQUEST]);
+    throttle_pace();
+    req->sentAt = stats_now();
+    UA_StatusCode retval = __UA_Client_AsyncService(scan->client, &bnReq,
+        &UA_TYPES[UA_TYPES_BROWSENEXTREQUEST], asyncBrowseNextCallback,
+        &UA_TYPES[UA_TYPES_BROWSENEXTRESPONSE], req, NULL);
+    
+    if (retval != UA_STATUSCODE_GOOD) {
+        if (scan->error == UA_STATUSCODE_GOOD)
+            scan->error = retval;
+        for (size_t i = 0; i < count; i++)
+            asyncScan_orphan(scan, &cps[i]);
+        free(req);
+        return;
+    }
+    scan->inflight++;
+    for (size_t i = 0; i < count; i++)
+        UA_ByteString_clear(&cps[i]);
+}
+
+static UA_StatusCode asyncSendBrowse(AsyncScan *scan) {
+    AsyncRequest *req = asyncRequest_new(scan, scan->browseChunk);
+    if (!req)
+        return UA_STATUSCODE_BADOUTOFMEMORY;
+    req->count = queue_pop(&scan->toBrowse, req->nodes, throttle_scaled(scan->browseChunk));
+    
+    UA_BrowseRequest bReq;
+    UA_BrowseRequest_init(&bReq);
+    bReq.requestedMaxReferencesPerNode = scan->opts->maxReferencesPerNode;
+    bReq.nodesToBrowse = (UA_BrowseDescription*)
+        UA_Array_new(req->count, &UA_TYPES[UA_TYPES_BROWSEDESCRIPTION]);
+    if (!bReq.nodesToBrowse) {
+        free(req);
+        return UA_STATUSCODE_BADOUTOFMEMORY;
+    }
+    bReq.nodesToBrowseSize = req->count;
+    for (size_t i = 0; i < req->count; i++) {
+        UA_NodeId_copy(&scan->graph.nodes[req->nodes[i]].nodeId, &bReq.nodesToBrowse[i].nodeId);
+        initBrowseDescription(&bReq.nodesToBrowse[i], scan->opts);
+    }
+    
+    req->sentBytes = stats_size(&bReq, &UA_TYPES[UA_TYPES_BROWSEREQUEST]);
+    throttle_pace();
+    req->sentAt = stats_now();
+    UA_StatusCode retval = UA_Client_sendAsyncBrowseRequest(scan->client, &bReq,
+                                                            asyncBrowseCallback, req, NULL);
+    UA_BrowseRequest_clear(&bReq);
+    if (retval != UA_STATUSCODE_GOOD) {
+        free(req);
+        return retval;
+    }
+    scan->inflight++;
+    return UA_STATUSCODE_GOOD;
+}
+
+static UA_StatusCode asyncSendRead(AsyncScan *scan) {
+    AsyncRequest *req = asyncRequest_new(scan, scan->readChunk);
+    if (!req)
+        return UA_STATUSCODE_BADOUTOFMEMORY;
+    req->count = queue_pop(&scan->toRead, req->nodes, throttle_scaled(scan->readChunk));
+    
+    UA_ReadRequest rReq;
+    UA_StatusCode retval = initValueRead(&rReq, &scan->graph, req->nodes, req->count,
+                                         &scan->opts->attributes);
+    if (retval == UA_STATUSCODE_GOOD) {
+        req->sentBytes = stats_size(&rReq, &UA_TYPES[UA_TYPES_READREQUEST]);
+        throttle_pace();
+        req->sentAt = stats_now();
+        retval = UA_Client_sendAsyncReadRequest(scan->client, &rReq, asyncReadCallback, req, NULL);
+        UA_ReadRequest_clear(&rReq);
+    }
+    if (retval != UA_STATUSCODE_GOOD) {
+        free(req);
+        return retval;
+    }
+    scan->inflight++;
+    return UA_STATUSCODE_GOOD;
+}
+
+// Pipelined traversal: Browse and Read requests (each batched as in the
+// breadth-first mode) are sent asynchronously and up to opts->inflight of
+// them are kept outstanding on the session. Responses are processed in
+// arrival order; the graph is rendered depth-first at the end, so the
+// output does not depend on response timing. Returns 1 if the whole
+// address space was listed.
+static int browsePipelined(UA_Client *client, UA_NodeId rootId, const ScanOptions *opts) {
+    UA_ReferenceDescription rootRef;
+    if (readRootReference(client, rootId, &rootRef) != UA_STATUSCODE_GOOD)
+        return 0;
+    
+    AsyncScan scan;
+    memset(&scan, 0, sizeof(AsyncScan));
+    scan.client = client;
+    scan.opts = opts;
+    scan.browseChunk = opts->sizes.browse;
+    scan.readChunk = readNodesPerRequest(opts);
+    // Responses arrive in any order, so a node may first be found deep
+    scan.graph.trackDepth = opts->maxDepth >= 0;
+    scan.graph.maxDepth = opts->maxDepth;
+    
+    size_t root = graph_addChild(&scan.graph, GRAPH_NONE, &rootRef);
+    UA_ReferenceDescription_clear(&rootRef);
+    if (root == GRAPH_NONE) {
+        printf("Error: Out of memory\n");
+        return 0;
+    }
+    UA_NodeClass rootClass = scan.graph.nodes[root].nodeClass;
+    if ((rootClass == UA_NODECLASS_OBJECT || rootClass == UA_NODECLASS_VIEW) && expandAtDepth(opts, 0))
+        queue_push(&scan.toBrowse, root);
+    else if (rootClass == UA_NODECLASS_VARIABLE)
+        queue_push(&scan.toRead, root);
+    
+    size_t requests = 0;
+    while (scan.error == UA_STATUSCODE_GOOD &&
+           (scan.inflight > 0 || scan.toBrowse.size > 0 || scan.toRead.size > 0)) {
+        // Fill the window; reads first so values do not pile up behind browsing
+        while (scan.error == UA_STATUSCODE_GOOD && scan.inflight < throttle_scaled(opts->inflight) &&
+               (scan.toBrowse.size > 0 || scan.toRead.size > 0)) {
+            UA_StatusCode retval = scan.toRead.size > 0 ? asyncSendRead(&scan) : asyncSendBrowse(&scan);
+            if (retval != UA_STATUSCODE_GOOD)
+                scan.error = retval;
+            requests++;
+        }
+        if (scan.inflight == 0)
+            continue;
+        
+        UA_StatusCode retval = UA_Client_run_iterate(client, 100);
+        if (retval != UA_STATUSCODE_GOOD && scan.error == UA_STATUSCODE_GOOD)
+            scan.error = retval;
+    }
+    
+    // Let outstanding requests finish so their contexts are freed. If the
+    // connection is gone, disconnecting cancels them; the callbacks run
+    // right away and must still find scan alive.
+    int connected = 1;
+    while (scan.inflight > 0) {
+        if (UA_Client_run_iterate(client, 100) != UA_STATUSCODE_GOOD) {
+            UA_Client_disconnect(client);
+            connected = 0;
+            break;
+        }
+    }
+    
+    if (scan.error != UA_STATUSCODE_GOOD)
+        printf("Warning: traversal aborted: %s\n", UA_StatusCode_name(scan.error));
+    // The session's continuation points ended with it
+    if (connected)
+        releaseContinuationPoints(client, scan.orphanedCps, scan.orphanedCpsSize);
+    for (size_t i = 0; i < scan.orphanedCpsSize; i++)
+        UA_ByteString_clear(&scan.orphanedCps[i]);
+    free(scan.orphanedCps);
+    
+    if (opts->verbose)
+        printf("  %zu requests, %zu distinct nodes\n\n", requests, scan.graph.size);
+    graph_finish(&scan.graph, root, opts);
+    // An aborted traversal leaves nodes queued
+    int complete = scan.error == UA_STATUSCODE_GOOD && graph_complete(&scan.graph);
+    
+    queue_clear(&scan.toBrowse);
+    queue_clear(&scan.toRead);
+    graph_clear(&scan.graph);
+    return complete;
+}
+
+#endif
+
+// ========== MULTI-SESSION PARALLEL TRAVERSAL ==========
+
+// Per-session work deque. The owning worker pushes and pops at the bottom
+// (depth-first locality), idle workers steal from the top, where the
+// oldest and usually largest subtrees are.
+typedef struct {
+    pthread_mutex_t lock;
+    size_t *items;
+    size_t top;
+    size_t bottom;
+    size_t capacity;
+} WorkDeque;
+
+static void deque_push(WorkDeque *d, const size_t *items, size_t count) {
+    pthread_mutex_lock(&d->lock);
+    if (d->bottom + count > d->capacity) {
+        size_t size = d->bottom - d->top;
+        memmove(d->items, &d->items[d->top], size * sizeof(size_t));
+        d->top = 0;
+        d->bottom = size;
+        if (size + count > d->capacity) {
+            size_t newCapacity = (size + count) * 2;
+            size_t *grown = (size_t*)realloc(d->items, newCapacity * sizeof(size_t));
+            if (!grown) {
+                pthread_mutex_unlock(&d->lock);
+                return;
+            }
+            d->items = grown;
+            d->capacity = newCapacity;
+        }
+    }
+    memcpy(&d->items[d->bottom], items, count * sizeof(size_t));
+    d->bottom += count;
+    pthread_mutex_unlock(&d->lock);
+}
+
+static size_t deque_pop(WorkDeque *d, size_t *out, size_t max) {
+    pthread_mutex_lock(&d->lock);
+    size_t size = d->bottom - d->top;
+    size_t n = size < max ? size : max;
+    d->bottom -= n;
+    memcpy(out, &d->items[d->bottom], n * sizeof(size_t));
+    pthread_mutex_unlock(&d->lock);
+    return n;
+}
+
+// Steal up to half of another worker's queue
+static size_t deque_steal(WorkDeque *d, size_t *out, size_t max) {
+    pthread_mutex_lock(&d->lock);
+    size_t size = d->bottom - d->top;
+    size_t n = (size + 1) / 2;
+    if (n > max)
+        n = max;
+    memcpy(out, &d->items[d->top], n * sizeof(size_t));
+    d->top += n;
+    pthread_mutex_unlock(&d->lock);
+    return n;
+}
+
+typedef struct {
+    const ScanOptions *opts;
+    ScanGraph graph;
+    pthread_mutex_t graphLock;
+    WorkDeque *deques;
+    size_t workers;
+    size_t browseChunk;
+    size_t readChunk;
+    // Queued plus in-process work items; the scan ends when it drops to 0
+    pthread_mutex_t stateLock;
+    pthread_cond_t stateCond;
+    size_t pending;
+} ParallelScan;
+
+typedef struct {
+    ParallelScan *scan;
+    size_t id;
+    UA_Client *client;      // Created by the worker unless set by the caller
+    pthread_t thread;
+    int started;
+    size_t nodes;
+    size_t requests;
+    UA_StatusCode status;
+    unsigned overloads;     // Overloaded responses in a row, see throttle_retry()
+} SessionWorker;
+
+// Queue work items on a worker's deque and wake idle workers
+static void parallel_addWork(ParallelScan *scan, size_t worker, const size_t *items, size_t count) {
+    if (count == 0)
+        return;
+    pthread_mutex_lock(&scan->stateLock);
+    scan->pending += count;
+    pthread_mutex_unlock(&scan->stateLock);
+    deque_push(&scan->deques[worker], items, count);
+    pthread_cond_broadcast(&scan->stateCond);
+}
+
+static void parallel_finishWork(ParallelScan *scan, size_t count) {
+    pthread_mutex_lock(&scan->stateLock);
+    scan->pending -= count;
+    if (scan->pending == 0)
+        pthread_cond_broadcast(&scan->stateCond);
+    pthread_mutex_unlock(&scan->stateLock);
+}
+
+// Collects nodes discovered by one worker's Browse/BrowseNext responses
+typedef struct {
+    ParallelScan *scan;
+    IndexQueue found;
+    int next;               // Handling BrowseNext results
+    int retry;              // Nodes refused for overload are queued again
+    size_t overloaded;
+} SessionBrowseContext;
+
+static void sessionBrowseHandler(void *context, size_t owner, UA_BrowseResult *result) {
+    SessionBrowseContext *ctx = (SessionBrowseContext*)context;
+    ParallelScan *scan = ctx->scan;
+    pthread_mutex_lock(&scan->graphLock);
+    if (ctx->retry && throttle_overloadStatus(result->statusCode)) {
+        graph_forgetEdges(&scan->graph, owner);
+        queue_push(&ctx->found, owner);
+        ctx->overloaded++;
+    } else if (result->statusCode != UA_STATUSCODE_GOOD) {
+        graph_dropped(&scan->graph, owner, ctx->next, result->statusCode);
+    }
+    for (size_t r = 0; r < result->referencesSize; r++) {
+        if (!acceptReference(scan->opts, &result->references[r]))
+            continue;
+        size_t child = graph_addChild(&scan->graph, owner, &result->references[r]);
+        if (child == GRAPH_NONE)
+            continue;
+        UA_NodeClass nc = scan->graph.nodes[child].nodeClass;
+        int expand = (nc == UA_NODECLASS_OBJECT || nc == UA_NODECLASS_VIEW) &&
+                     expandAtDepth(scan->opts, scan->graph.nodes[child].depth);
+        if (expand || nc == UA_NODECLASS_VARIABLE)
+            queue_push(&ctx->found, child);
+    }
+    for (size_t i = 0; i < scan->graph.deepenedSize; i++)
+        queue_push(&ctx->found, scan->graph.deepened[i]);
+    scan->graph.deepenedSize = 0;
+    pthread_mutex_unlock(&scan->graphLock);
+}
+
+// Nodes of a request that produced no result at all
+static void sessionBrowse_dropped(ParallelScan *scan, const size_t *items, size_t count,
+                                  UA_StatusCode status) {
+    pthread_mutex_lock(&scan->graphLock);
+    for (size_t i = 0; i < count; i++)
+        graph_dropped(&scan->graph, items[i], 0, status);
+    pthread_mutex_unlock(&scan->graphLock);
+}
+
+// Browse a set of nodes on this worker's session; work items refused with
+// BadNoContinuationPoints or for overload go back onto the worker's deque
+static void sessionBrowse(SessionWorker *w, const size_t *items, UA_NodeId *nodeIds, size_t count) {
+    ParallelScan *scan = w->scan;
+    UA_BrowseRequest bReq;
+    UA_BrowseRequest_init(&bReq);
+    bReq.requestedMaxReferencesPerNode = scan->opts->maxReferencesPerNode;
+    bReq.nodesToBrowse = (UA_BrowseDescription*)
+        UA_Array_new(count, &UA_TYPES[UA_TYPES_BROWSEDESCRIPTION]);
+    if (!bReq.nodesToBrowse) {
+        for (size_t i = 0; i < count; i++)
+            UA_NodeId_clear(&nodeIds[i]);
+        sessionBrowse_dropped(scan, items, count, UA_STATUSCODE_BADOUTOFMEMORY);
+        return;
+    }
+    bReq.nodesToBrowseSize = count;
+    for (size_t i = 0; i < count; i++) {
+        bReq.nodesToBrowse[i].nodeId = nodeIds[i];
+        UA_NodeId_init(&nodeIds[i]);
+        initBrowseDescription(&bReq.nodesToBrowse[i], scan->opts);
+    }
+    
+    UA_BrowseResponse bResp = timedBrowse(w->client, bReq);
+    UA_BrowseRequest_clear(&bReq);
+    w->requests++;
+    if (throttle_retry(&w->overloads, throttle_overloadStatus(bResp.responseHeader.serviceResult))) {
+        UA_BrowseResponse_clear(&bResp);
+        parallel_addWork(scan, w->id, items, count);
+        throttle_backoff();
+        return;
+    }
+    if (bResp.responseHeader.serviceResult != UA_STATUSCODE_GOOD) {
+        w->status = bResp.responseHeader.serviceResult;
+        sessionBrowse_dropped(scan, items, count, w->status);
+        UA_BrowseResponse_clear(&bResp);
+        return;
+    }
+    if (bResp.resultsSize < count)
+        sessionBrowse_dropped(scan, &items[bResp.resultsSize], count - bResp.resultsSize,
+                              UA_STATUSCODE_BADUNEXPECTEDERROR);
+    
+    SessionBrowseContext ctx;
+    memset(&ctx, 0, sizeof(SessionBrowseContext));
+    ctx.scan = scan;
+    ctx.retry = w->overloads < THROTTLE_RETRIES;
+    UA_ByteString *cps = (UA_ByteString*)malloc(count * sizeof(UA_ByteString));
+    size_t *owners = (size_t*)malloc(count * sizeof(size_t));
+    size_t cpCount = 0;
+    for (size_t i = 0; i < bResp.resultsSize && i < count; i++) {
+        UA_BrowseResult *result = &bResp.results[i];
+        // Alone in a request it would be refused again
+        if (result->statusCode == UA_STATUSCODE_BADNOCONTINUATIONPOINTS && count > 1) {
+            parallel_addWork(scan, w->id, &items[i], 1);
+            continue;
+        }
+        sessionBrowseHandler(&ctx, items[i], result);
+        if (result->continuationPoint.length > 0 && cps && owners) {
+            cps[cpCount] = result->continuationPoint;
+            UA_ByteString_init(&result->continuationPoint);
+            owners[cpCount++] = items[i];
+        }
+    }
+    UA_BrowseResponse_clear(&bResp);
+    
+    ctx.next = 1;
+    browseNextAll(w->client, cps, owners, cpCount, sessionBrowseHandler, &ctx);
+    free(cps);
+    free(owners);
+    
+    parallel_addWork(scan, w->id, &ctx.found.items[ctx.found.head], ctx.found.size);
+    queue_clear(&ctx.found);
+    if (throttle_retry(&w->overloads, ctx.overloaded > 0))
+        throttle_backoff();
+}
+
+// Read the values of a set of Variables on this worker's session
+static void sessionRead(SessionWorker *w, const size_t *items, UA_NodeId *nodeIds, size_t count) {
+    ParallelScan *scan = w->scan;
+    const AttributeSet *attrs = &scan->opts->attributes;
+    size_t stride = 1 + attrs->count;
+    UA_ReadRequest rReq;
+    UA_ReadRequest_init(&rReq);
+    rReq.nodesToRead = (UA_ReadValueId*)UA_Array_new(count * stride, &UA_TYPES[UA_TYPES_READVALUEID]);
+    if (!rReq.nodesToRead)
+        return;
+    rReq.nodesToReadSize = count * stride;
+    rReq.timestampsToReturn = UA_TIMESTAMPSTORETURN_BOTH;
+    for (size_t i = 0; i < count; i++)
+        initValueItems(&rReq.nodesToRead[i * stride], &nodeIds[i], attrs);
+    
+    UA_ReadResponse rResp = timedRead(w->client, rReq);
+    UA_ReadRequest_clear(&rReq);
+    w->requests++;
+    
+    // Variables refused for overload go back onto the worker's deque
+    size_t *retry = (size_t*)malloc(count * sizeof(size_t));
+    size_t refused = 0;
+    pthread_mutex_lock(&scan->graphLock);
+    applyValueRead(&scan->graph, items, count, &rResp, attrs);
+    if (retry)
+        refused = valueRead_overloaded(&scan->graph, items, count, retry);
+    pthread_mutex_unlock(&scan->graphLock);
+    UA_ReadResponse_clear(&rResp);
+    if (throttle_retry(&w->overloads, refused > 0)) {
+        parallel_addWork(scan, w->id, retry, refused);
+        throttle_backoff();
+    }
+    free(retry);
+}
+
+// Take a batch of work: own deque first, then steal from the others
+static size_t session_takeWork(SessionWorker *w, size_t *batch, size_t max) {
+    ParallelScan *scan = w->scan;
+    size_t n = deque_pop(&scan->deques[w->id], batch, max);
+    for (size_t k = 1; n == 0 && k < scan->workers; k++)
+        n = deque_steal(&scan->deques[(w->id + k) % scan->workers], batch, max);
+    return n;
+}
+
+static void *sessionWorkerRun(void *arg) {
+    SessionWorker *w = (SessionWorker*)arg;
+    ParallelScan *scan = w->scan;
+    const ScanOptions *opts = scan->opts;
+    
+    int ownClient = (w->client == NULL);
+    if (ownClient) {
+        w->client = createClient(opts->timeoutMs);
+        w->status = w->client ? connectClient(w->client, opts->serverUrl, opts)
+                              : UA_STATUSCODE_BADOUTOFMEMORY;
+        if (w->status != UA_STATUSCODE_GOOD) {
+            // Items seeded to this worker are stolen by the others
+            if (w->client)
+                UA_Client_delete(w->client);
+            w->client = NULL;
+            return NULL;
+        }
+    }
+    
+    size_t max = scan->browseChunk > scan->readChunk ? scan->browseChunk : scan->readChunk;
+    size_t *batch = (size_t*)malloc(max * sizeof(size_t));
+    size_t *browseItems = (size_t*)malloc(max * sizeof(size_t));
+    size_t *readItems = (size_t*)malloc(max * sizeof(size_t));
+    UA_NodeId *browseIds = (UA_NodeId*)calloc(max, sizeof(UA_NodeId));
+    UA_NodeId *readIds = (UA_NodeId*)calloc(max, sizeof(UA_NodeId));
+    
+    while (batch && browseItems && readItems && browseIds && readIds) {
+        size_t n = session_takeWork(w, batch, throttle_scaled(scan->browseChunk));
+        if (n == 0) {
+            // Wait until new work shows up or everything is done
+            pthread_mutex_lock(&scan->stateLock);
+            if (scan->pending == 0) {
+                pthread_mutex_unlock(&scan->stateLock);
+                break;
+            }
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += 50 * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&scan->stateCond, &scan->stateLock, &deadline);
+            pthread_mutex_unlock(&scan->stateLock);
+            continue;
+        }
+        
+        // Copy what the requests need while holding the graph lock
+        size_t browseCount = 0, readCount = 0;
+        pthread_mutex_lock(&scan->graphLock);
+        for (size_t i = 0; i < n; i++) {
+            const GraphNode *node = &scan->graph.nodes[batch[i]];
+            if (node->nodeClass == UA_NODECLASS_VARIABLE) {
+                readItems[readCount] = batch[i];
+                UA_NodeId_copy(&node->nodeId, &readIds[readCount++]);
+            } else {
+                browseItems[browseCount] = batch[i];
+                UA_NodeId_copy(&node->nodeId, &browseIds[browseCount++]);
+            }
+        }
+        pthread_mutex_unlock(&scan->graphLock);
+        
+        if (browseCount > 0)
+            sessionBrowse(w, browseItems, browseIds, browseCount);
+        for (size_t start = 0, chunk; start < readCount; start += chunk) {
+            chunk = throttle_scaled(scan->readChunk);
+            size_t count = readCount - start < chunk ? readCount - start : chunk;
+            sessionRead(w, &readItems[start], &readIds[start], count);
+        }
+        w->nodes += n;
+        parallel_finishWork(scan, n);
+    }
+    
+    free(batch);
+    free(browseItems);
+    free(readItems);
+    free(browseIds);
+    free(readIds);
+    if (ownClient) {
+        UA_Client_disconnect(w->client);
+        UA_Client_delete(w->client);
+        w->client = NULL;
+    }
+    return NULL;
+}
+
+// Multi-session traversal: N sessions (the already connected one plus
+// N-1 worker threads with their own UA_Client) pull work from per-session
+// deques seeded by a browse of the root, stealing from each other when
+// idle. All sessions fill one shared graph, which is rendered depth-first
+// at the end so the output is in tree order. Returns 1 if the whole
+// address space was listed.
+static int browseParallel(UA_Client *client, UA_NodeId rootId, const ScanOptions *opts) {
+    UA_ReferenceDescription rootRef;
+    if (readRootReference(client, rootId, &rootRef) != UA_STATUSCODE_GOOD)
+        return 0;
+    
+    ParallelScan scan;
+    memset(&scan, 0, sizeof(ParallelScan));
+    scan.opts = opts;
+    scan.workers = opts->sessions;
+    scan.browseChunk = opts->sizes.browse;
+    scan.readChunk = readNodesPerRequest(opts);
+    // Sessions race, so a node may first be found deep
+    scan.graph.trackDepth = opts->maxDepth >= 0;
+    scan.graph.maxDepth = opts->maxDepth;
+    pthread_mutex_init(&scan.graphLock, NULL);
+    pthread_mutex_init(&scan.stateLock, NULL);
+    pthread_cond_init(&scan.stateCond, NULL);
+    
+    scan.deques = (WorkDeque*)calloc(scan.workers, sizeof(WorkDeque));
+    SessionWorker *workers = (SessionWorker*)calloc(scan.workers, sizeof(SessionWorker));
+    size_t root = graph_addChild(&scan.graph, GRAPH_NONE, &rootRef);
+    UA_ReferenceDescription_clear(&rootRef);
+    if (!scan.deques || !workers || root == GRAPH_NONE) {
+        printf("Error: Out of memory\n");
+        free(scan.deques);
+        free(workers);
+        graph_clear(&scan.graph);
+        return 0;
+    }
+    for (size_t i = 0; i < scan.workers; i++)
+        pthread_mutex_init(&scan.deques[i].lock, NULL);
+    
+    // Seed: browse the root on the main session and deal its children out
+    // round-robin so every session starts on a different subtree
+    UA_NodeClass rootClass = scan.graph.nodes[root].nodeClass;
+    if (rootClass == UA_NODECLASS_VARIABLE) {
+        readBatch(client, &scan.graph, &root, 1, &opts->attributes);
+    } else if ((rootClass == UA_NODECLASS_OBJECT || rootClass == UA_NODECLASS_VIEW) &&
+               expandAtDepth(opts, 0)) {
+        SessionBrowseContext seed;
+        memset(&seed, 0, sizeof(SessionBrowseContext));
+        seed.scan = &scan;
+        RefList children;
+        memset(&children, 0, sizeof(RefList));
+        UA_StatusCode retval = browseChildren(client, &scan.graph.nodes[root].nodeId, opts, &children);
+        if (retval != UA_STATUSCODE_GOOD)
+            graph_dropped(&scan.graph, root, children.size > 0, retval);
+        UA_BrowseResult all;
+        memset(&all, 0, sizeof(UA_BrowseResult));
+        all.references = children.refs;
+        all.referencesSize = children.size;
+        sessionBrowseHandler(&seed, root, &all);
+        refList_clear(&children);
+        for (size_t i = 0; i < seed.found.size; i++)
+            parallel_addWork(&scan, i % scan.workers, &seed.found.items[seed.found.head + i], 1);
+        queue_clear(&seed.found);
+    }
+    
+    for (size_t i = 0; i < scan.workers; i++) {
+        workers[i].scan = &scan;
+        workers[i].id = i;
+    }
+    workers[0].client = client;
+    throttle_setConcurrency(scan.workers);
+    for (size_t i = 1; i < scan.workers; i++) {
+        if (pthread_create(&workers[i].thread, NULL, sessionWorkerRun, &workers[i]) == 0)
+            workers[i].started = 1;
+        else
+            workers[i].status = UA_STATUSCODE_BADRESOURCEUNAVAILABLE;
+    }
+    sessionWorkerRun(&workers[0]);
+    for (size_t i = 1; i < scan.workers; i++) {
+        if (workers[i].started)
+            pthread_join(workers[i].thread, NULL);
+    }
+    throttle_setConcurrency(1);
+    
+    if (scan.pending > 0)
+        printf("Warning: %zu nodes were not processed\n", scan.pending);
+    if (opts->verbose) {
+        for (size_t i = 0; i < scan.workers; i++) {
+            if (i > 0 && workers[i].nodes == 0 && workers[i].status != UA_STATUSCODE_GOOD)
+                printf("  Session %zu: not connected (%s)\n", i, UA_StatusCode_name(workers[i].status));
+            else
+                printf("  Session %zu: %zu nodes, %zu requests\n", i, workers[i].nodes, workers[i].requests);
+        }
+        printf("  %zu distinct nodes\n\n", scan.graph.size);
+    }
+    graph_finish(&scan.graph, root, opts);
+    int complete = scan.pending == 0 && graph_complete(&scan.graph);
+    
+    for (size_t i = 0; i < scan.workers; i++) {
+        free(scan.deques[i].items);
+        pthread_mutex_destroy(&scan.deques[i].lock);
+    }
+    free(scan.deques);
+    free(workers);
+    pthread_cond_destroy(&scan.stateCond);
+    pthread_mutex_destroy(&scan.stateLock);
+    pthread_mutex_destroy(&scan.graphLock);
+    graph_clear(&scan.graph);
+    return complete;
+}
+
+// ========== PATH RESOLUTION ==========
+
+// One --path and, once translated, the node it leads to
+typedef struct {
+    const char *text;
+    UA_NodeId nodeId;
+    UA_QualifiedName browseName;    // Last path element
+    UA_StatusCode status;
+} ResolvedPath;
+
+// Parse a path of BrowseNames separated by '/'. A leading '/' starts at the
+// Root folder, otherwise at rootId. Elements may carry a namespace index
+// as in "2:Temp"; without one they are in namespace 0. Every element
+// follows hierarchical references and their subtypes.
+static int parseBrowsePath(const char *text, const UA_NodeId *rootId, UA_BrowsePath *path) {
+    UA_BrowsePath_init(path);
+    UA_NodeId rootFolder = UA_NODEID_NUMERIC(0, UA_NS0ID_ROOTFOLDER);
+    UA_StatusCode retval = UA_NodeId_copy(text[0] == '/' ? &rootFolder : rootId, &path->startingNode);
+    
+    while (retval == UA_STATUSCODE_GOOD && *text) {
+        while (*text == '/')
+            text++;
+        size_t len = strcspn(text, "/");
+        if (len == 0)
+            break;
+        
+        UA_UInt16 ns = 0;
+        size_t digits = 0;
+        while (digits < len && text[digits] >= '0' && text[digits] <= '9')
+            digits++;
+        const char *name = text;
+        size_t nameLen = len;
+        if (digits > 0 && digits < len && text[digits] == ':') {
+            ns = (UA_UInt16)atoi(text);
+            name = &text[digits + 1];
+            nameLen = len - digits - 1;
+        }
+        
+        UA_RelativePathElement *elements = (UA_RelativePathElement*)
+            UA_realloc(path->relativePath.elements,
+                       (path->relativePath.elementsSize + 1) * sizeof(UA_RelativePathElement));
+        if (!elements) {
+            retval = UA_STATUSCODE_BADOUTOFMEMORY;
+            break;
+        }
+        path->relativePath.elements = elements;
+        UA_RelativePathElement *e = &elements[path->relativePath.elementsSize++];
+        UA_RelativePathElement_init(e);
+        e->referenceTypeId = UA_NODEID_NUMERIC(0, UA_NS0ID_HIERARCHICALREFERENCES);
+        e->includeSubtypes = true;
+        e->targetName.namespaceIndex = ns;
+        UA_String target;
+        target.length = nameLen;
+        target.data = (UA_Byte*)(uintptr_t)name;
+        retval = UA_String_copy(&target, &e->targetName.name);
+        text += len;
+    }
+    if (retval != UA_STATUSCODE_GOOD) {
+        UA_BrowsePath_clear(path);
+        return 0;
+    }
+    return 1;
+}
+
+static UA_TranslateBrowsePathsToNodeIdsResponse
+timedTranslate(UA_Client *client, const UA_TranslateBrowsePathsToNodeIdsRequest request) {
+    UA_UInt64 start = throttle_begin();
+    UA_TranslateBrowsePathsToNodeIdsResponse response =
+        UA_Client_Service_translateBrowsePathsToNodeIds(client, request);
+    throttle_end(start, request.browsePathsSize, response.responseHeader.serviceResult);
+    stats_record(STAT_TRANSLATE, start, request.browsePathsSize,
+                 stats_size(&request, &UA_TYPES[UA_TYPES_TRANSLATEBROWSEPATHSTONODEIDSREQUEST]),
+                 stats_size(&response, &UA_TYPES[UA_TYPES_TRANSLATEBROWSEPATHSTONODEIDSRESPONSE]));
+    return response;
+}
+
+// Translate all paths with as few TranslateBrowsePathsToNodeIds calls as
+// the batch size allows. Paths that do not lead to exactly one local node
+// keep a bad status. Returns the number of unresolved paths.
+static size_t resolvePaths(UA_Client *client, const UA_NodeId *rootId, const ScanOptions *opts,
+                           ResolvedPath *paths, size_t count) {
+    size_t failed = 0;
+    size_t chunk = opts->sizes.translate;
+    for (size_t start = 0; start < count; start += chunk) {
+        size_t n = count - start < chunk ? count - start : chunk;
+        UA_TranslateBrowsePathsToNodeIdsRequest req;
+        UA_TranslateBrowsePathsToNodeIdsRequest_init(&req);
+        req.browsePaths = (UA_BrowsePath*)UA_Array_new(n, &UA_TYPES[UA_TYPES_BROWSEPATH]);
+        if (!req.browsePaths)
+            return count;
+        req.browsePathsSize = n;
+        
+        // A path without elements is its starting node and is not sent
+        size_t *sent = (size_t*)malloc(n * sizeof(size_t));
+        size_t sentSize = 0;
+        for (size_t i = 0; sent && i < n; i++) {
+            ResolvedPath *p = &paths[start + i];
+            UA_NodeId_init(&p->nodeId);
+            UA_QualifiedName_init(&p->browseName);
+            p->status = UA_STATUSCODE_BADBROWSENAMEINVALID;
+            UA_BrowsePath *bp = &req.browsePaths[sentSize];
+            if (!parseBrowsePath(p->text, rootId, bp))
+                continue;
+            if (bp->relativePath.elementsSize == 0) {
+                p->status = UA_NodeId_copy(&bp->startingNode, &p->nodeId);
+                UA_BrowsePath_clear(bp);
+                continue;
+            }
+            UA_QualifiedName_copy(&bp->relativePath.elements[bp->relativePath.elementsSize - 1].targetName,
+                                  &p->browseName);
+            sent[sentSize++] = start + i;
+        }
+        req.browsePathsSize = sentSize;
+        
+        if (sent && sentSize > 0) {
+            UA_TranslateBrowsePathsToNodeIdsResponse resp = timedTranslate(client, req);
+            for (size_t i = 0; i < sentSize; i++) {
+                ResolvedPath *p = &paths[sent[i]];
+                p->status = resp.responseHeader.serviceResult;
+                if (p->status != UA_STATUSCODE_GOOD || i >= resp.resultsSize)
+                    continue;
+                const UA_BrowsePathResult *r = &resp.results[i];
+                p->status = r->statusCode;
+                if (p->status != UA_STATUSCODE_GOOD)
+                    continue;
+                if (r->targetsSize == 0 || r->targets[0].remainingPathIndex != UA_UINT32_MAX ||
+                    r->targets[0].targetId.serverIndex != 0) {
+                    p->status = UA_STATUSCODE_BADNOMATCH;
+                    continue;
+                }
+                if (r->targetsSize > 1 && opts->verbose)
+                    printf("  %s matches %zu nodes, using the first\n", p->text, r->targetsSize);
+                p->status = UA_NodeId_copy(&r->targets[0].targetId.nodeId, &p->nodeId);
+            }
+            UA_TranslateBrowsePathsToNodeIdsResponse_clear(&resp);
+        }
+        req.browsePathsSize = n;
+        UA_TranslateBrowsePathsToNodeIdsRequest_clear(&req);
+        free(sent);
+    }
+    
+    for (size_t i = 0; i < count; i++) {
+        if (paths[i].status != UA_STATUSCODE_GOOD) {
+            printf("Error: %s: %s\n", paths[i].text, UA_StatusCode_name(paths[i].status));
+            failed++;
+        }
+    }
+    return failed;
+}
+
+static void resolvedPaths_clear(ResolvedPath *paths, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        UA_NodeId_clear(&paths[i].nodeId);
+        UA_QualifiedName_clear(&paths[i].browseName);
+    }
+    free(paths);
+}
+
+static ResolvedPath *resolvedPaths_new(const ScanOptions *opts) {
+    ResolvedPath *paths = (ResolvedPath*)calloc(opts->pathCount, sizeof(ResolvedPath));
+    for (size_t i = 0; paths && i < opts->pathCount; i++)
+        paths[i].text = opts->paths[i];
+    return paths;
+}
+
+// Entry point of --path: translate the paths, then read NodeClass, Value
+// and the --attributes of every target in batched Reads. Two round trips
+// for a few paths instead of a crawl. Returns the number of paths that
+// could not be resolved.
+static size_t readPaths(UA_Client *client, UA_NodeId rootId, const ScanOptions *opts) {
+    ResolvedPath *paths = resolvedPaths_new(opts);
+    if (!paths) {
+        printf("Error: Out of memory\n");
+        return opts->pathCount;
+    }
+    size_t failed = resolvePaths(client, &rootId, opts, paths, opts->pathCount);
+    
+    size_t *resolved = (size_t*)malloc(opts->pathCount * sizeof(size_t));
+    size_t resolvedSize = 0;
+    for (size_t i = 0; resolved && i < opts->pathCount; i++) {
+        if (paths[i].status == UA_STATUSCODE_GOOD)
+            resolved[resolvedSize++] = i;
+    }
+    
+    const AttributeSet *attrs = &opts->attributes;
+    size_t perNode = 2 + attrs->count;
+    size_t chunk = opts->sizes.read / perNode > 0 ? opts->sizes.read / perNode : 1;
+    beginOutput(opts->out, opts->format, 0, attrs);
+    for (size_t start = 0; start < resolvedSize; start += chunk) {
+        size_t n = resolvedSize - start < chunk ? resolvedSize - start : chunk;
+        UA_ReadRequest rReq;
+        UA_ReadRequest_init(&rReq);
+        rReq.timestampsToReturn = UA_TIMESTAMPSTORETURN_BOTH;
+        rReq.nodesToRead = (UA_ReadValueId*)UA_Array_new(n * perNode, &UA_TYPES[UA_TYPES_READVALUEID]);
+        if (!rReq.nodesToRead)
+            break;
+        rReq.nodesToReadSize = n * perNode;
+        for (size_t i = 0; i < n; i++) {
+            UA_ReadValueId *items = &rReq.nodesToRead[i * perNode];
+            for (size_t k = 0; k < perNode; k++) {
+                UA_NodeId_copy(&paths[resolved[start + i]].nodeId, &items[k].nodeId);
+                items[k].attributeId = k == 0 ? UA_ATTRIBUTEID_NODECLASS :
+                                       k == 1 ? UA_ATTRIBUTEID_VALUE : attrs->ids[k - 2];
+            }
+        }
+        
+        UA_ReadResponse rResp = timedRead(client, rReq);
+        UA_ReadRequest_clear(&rReq);
+        UA_DataValue failure;
+        UA_DataValue_init(&failure);
+        failure.hasStatus = true;
+        failure.status = rResp.responseHeader.serviceResult != UA_STATUSCODE_GOOD
+                         ? rResp.responseHeader.serviceResult : UA_STATUSCODE_BADUNEXPECTEDERROR;
+        for (size_t i = 0; i < n; i++) {
+            const ResolvedPath *p = &paths[resolved[start + i]];
+            int complete = rResp.resultsSize >= (i + 1) * perNode;
+            const UA_DataValue *results = complete ? &rResp.results[i * perNode] : NULL;
+            NodeRecord rec;
+            memset(&rec, 0, sizeof(NodeRecord));
+            rec.nodeId = &p->nodeId;
+            rec.browseName = &p->browseName;
+            rec.nodeClass = UA_NODECLASS_VARIABLE;
+            if (results && results[0].hasValue &&
+                UA_Variant_hasScalarType(&results[0].value, &UA_TYPES[UA_TYPES_NODECLASS]))
+                rec.nodeClass = *(UA_NodeClass*)results[0].value.data;
+            rec.value = results ? &results[1] : &failure;
+            rec.attributeSet = attrs;
+            rec.attributes = results ? &results[2] : NULL;
+            emitNode(opts->out, opts->format, &rec);
+        }
+        UA_ReadResponse_clear(&rResp);
+    }
+    out_flush(opts->out);
+    
+    free(resolved);
+    resolvedPaths_clear(paths, opts->pathCount);
+    return failed;
+}
+
+#if UACONSOLE_WITH_MONITOR
+// ========== VALUE PROFILING ==========
+
+// Streaming per-item statistics for --profile-values. Every sample is
+// folded into running accumulators (Welford mean and variance, min/max,
+// a log2 histogram of inter-arrival times) and then dropped, so the
+// memory use depends only on the number of items, not on the length of
+// the window. The table is a struct of arrays indexed by item.
+
+#define PROFILE_BUCKETS 16              // <1 ms, <2 ms, <4 ms ... >=16 s
+
+typedef struct {
+    size_t size;
+    double requestedMs;                 // Sampling or polling interval asked for
+    UA_UInt64 *samples;                 // Notifications or read results
+    UA_UInt64 *bad;                     // ... with a non-Good status
+    UA_UInt64 *updates;                 // Samples with a new source timestamp
+    UA_UInt64 *numeric;                 // Updates with a numeric scalar value
+    double *mean;                       // Welford accumulators over the values
+    double *m2;
+    double *min;
+    double *max;
+    UA_DateTime *lastArrival;           // Client monotonic clock
+    double *arrivalMean;                // Inter-arrival time, ms
+    UA_DateTime *lastSource;
+    UA_UInt64 *intervals;               // Intervals between two source timestamps
+    double *intervalMean;               // Source timestamp interval, ms
+    double *intervalM2;
+    double *revisedMs;                  // Server's revised sampling interval, <0 = none
+    UA_UInt32 *histogram;               // size * PROFILE_BUCKETS inter-arrival counts
+} ValueProfile;
+
+static void profile_clear(ValueProfile *p) {
+    free(p->samples);
+    free(p->bad);
+    free(p->updates);
+    free(p->numeric);
+    free(p->mean);
+    free(p->m2);
+    free(p->min);
+    free(p->max);
+    free(p->lastArrival);
+    free(p->arrivalMean);
+    free(p->lastSource);
+    free(p->intervals);
+    free(p->intervalMean);
+    free(p->intervalM2);
+    free(p->revisedMs);
+    free(p->histogram);
+    memset(p, 0, sizeof(ValueProfile));
+}
+
+static int profile_init(ValueProfile *p, size_t size, double requestedMs) {
+    memset(p, 0, sizeof(ValueProfile));
+    p->size = size;
+    p->requestedMs = requestedMs;
+    p->samples = (UA_UInt64*)calloc(size, sizeof(UA_UInt64));
+    p->bad = (UA_UInt64*)calloc(size, sizeof(UA_UInt64));
+    p->updates = (UA_UInt64*)calloc(size, sizeof(UA_UInt64));
+    p->numeric = (UA_UInt64*)calloc(size, sizeof(UA_UInt64));
+    p->mean = (double*)calloc(size, sizeof(double));
+    p->m2 = (double*)calloc(size, sizeof(double));
+    p->min = (double*)calloc(size, sizeof(double));
+    p->max = (double*)calloc(size, sizeof(double));
+    p->lastArrival = (UA_DateTime*)calloc(size, sizeof(UA_DateTime));
+    p->arrivalMean = (double*)calloc(size, sizeof(double));
+    p->lastSource = (UA_DateTime*)calloc(size, sizeof(UA_DateTime));
+    p->intervals = (UA_UInt64*)calloc(size, sizeof(UA_UInt64));
+    p->intervalMean = (double*)calloc(size, sizeof(double));
+    p->intervalM2 = (double*)calloc(size, sizeof(double));
+    p->revisedMs = (double*)malloc(size * sizeof(double));
+    p->histogram = (UA_UInt32*)calloc(size * PROFILE_BUCKETS, sizeof(UA_UInt32));
+    if (!p->samples || !p->bad || !p->updates || !p->numeric || !p->mean || !p->m2 ||
+        !p->min || !p->max || !p->lastArrival || !p->arrivalMean || !p->lastSource ||
+        !p->intervals || !p->intervalMean || !p->intervalM2 || !p->revisedMs || !p->histogram) {
+        profile_clear(p);
+        return 0;
+    }
+    for (size_t i = 0; i < size; i++)
+        p->revisedMs[i] = -1.0;
+    return 1;
+}
+
+// Numeric scalars as a double; other values are only counted
+static int profile_numeric(const UA_DataValue *dv, double *x) {
+    if (!dv->hasValue || !dv->value.type || !UA_Variant_isScalar(&dv->value))
+        return 0;
+    const void *d = dv->value.data;
+    switch (dv->value.type->typeKind) {
+        case UA_DATATYPEKIND_BOOLEAN: *x = *(const UA_Boolean*)d ? 1.0 : 0.0; return 1;
+        case UA_DATATYPEKIND_SBYTE:   *x = *(const UA_SByte*)d; return 1;
+        case UA_DATATYPEKIND_BYTE:    *x = *(const UA_Byte*)d; return 1;
+        case UA_DATATYPEKIND_INT16:   *x = *(const UA_Int16*)d; return 1;
+        case UA_DATATYPEKIND_UINT16:  *x = *(const UA_UInt16*)d; return 1;
+        case UA_DATATYPEKIND_INT32:   *x = *(const UA_Int32*)d; return 1;
+        case UA_DATATYPEKIND_UINT32:  *x = *(const UA_UInt32*)d; return 1;
+        case UA_DATATYPEKIND_INT64:   *x = (double)*(const UA_Int64*)d; return 1;
+        case UA_DATATYPEKIND_UINT64:  *x = (double)*(const UA_UInt64*)d; return 1;
+        case UA_DATATYPEKIND_FLOAT:   *x = *(const UA_Float*)d; return 1;
+        case UA_DATATYPEKIND_DOUBLE:  *x = *(const UA_Double*)d; return 1;
+        default: return 0;
+    }
+}
+
+static size_t profile_bucket(double ms) {
+    size_t b = 0;
+    for (UA_UInt64 limit = 1; b < PROFILE_BUCKETS - 1 && ms >= (double)limit; limit <<= 1)
+        b++;
+    return b;
+}
+
+// Fold one sample of item i into the table. Polling reads the same
+// sample again until the source updates it; repeated source timestamps
+// count as samples but not as updates.
+static void profile_sample(ValueProfile *p, size_t i, const UA_DataValue *dv, UA_DateTime arrival) {
+    p->samples[i]++;
+    if (dv->hasStatus && dv->status != UA_STATUSCODE_GOOD)
+        p->bad[i]++;
+    
+    if (p->lastArrival[i] != 0) {
+        double ms = (double)(arrival - p->lastArrival[i]) / UA_DATETIME_MSEC;
+        p->arrivalMean[i] += (ms - p->arrivalMean[i]) / (double)(p->samples[i] - 1);
+        p->histogram[i * PROFILE_BUCKETS + profile_bucket(ms)]++;
+    }
+    p->lastArrival[i] = arrival;
+    
+    if (dv->hasSourceTimestamp) {
+        if (dv->sourceTimestamp == p->lastSource[i])
+            return;
+        if (p->lastSource[i] != 0) {
+            // Welford over the intervals. They have their own count, as
+            // samples without a source timestamp count as updates
+            double ms = (double)(dv->sourceTimestamp - p->lastSource[i]) / UA_DATETIME_MSEC;
+            double n = (double)++p->intervals[i];
+            double delta = ms - p->intervalMean[i];
+            p->intervalMean[i] += delta / n;
+            p->intervalM2[i] += delta * (ms - p->intervalMean[i]);
+        }
+        p->lastSource[i] = dv->sourceTimestamp;
+    }
+    p->updates[i]++;
+    
+    double x;
+    if (!profile_numeric(dv, &x))
+        return;
+    UA_UInt64 n = ++p->numeric[i];
+    if (n == 1 || x < p->min[i])
+        p->min[i] = x;
+    if (n == 1 || x > p->max[i])
+        p->max[i] = x;
+    double delta = x - p->mean[i];
+    p->mean[i] += delta / (double)n;
+    p->m2[i] += delta * (x - p->mean[i]);
+}
+
+static double profile_stddev(double m2, UA_UInt64 n) {
+    return n > 1 ? sqrt(m2 / (double)(n - 1)) : 0.0;
+}
+
+// Overall totals and the merged inter-arrival histogram, on stdout
+static void profile_summary(const ValueProfile *p, double windowS) {
+    UA_UInt64 samples = 0, bad = 0, updates = 0;
+    UA_UInt64 histogram[PROFILE_BUCKETS];
+    memset(histogram, 0, sizeof(histogram));
+    size_t silent = 0;
+    for (size_t i = 0; i < p->size; i++) {
+        samples += p->samples[i];
+        bad += p->bad[i];
+        updates += p->updates[i];
+        if (p->samples[i] == 0)
+            silent++;
+        for (size_t b = 0; b < PROFILE_BUCKETS; b++)
+            histogram[b] += p->histogram[i * PROFILE_BUCKETS + b];
+    }
+    printf("\nProfiled %zu items for %.1f s: %llu samples (%llu bad), %llu updates, "
+           "%.1f updates/s, %zu items silent\n", p->size, windowS,
+           (unsigned long long)samples, (unsigned long long)bad, (unsigned long long)updates,
+           windowS > 0.0 ? (double)updates / windowS : 0.0, silent);
+    printf("Inter-arrival times:\n");
+    for (size_t b = 0; b < PROFILE_BUCKETS; b++) {
+        if (histogram[b] == 0)
+            continue;
+        if (b == 0)
+            printf("  %8s < %5u ms %12llu\n", "", 1u, (unsigned long long)histogram[b]);
+        else if (b == PROFILE_BUCKETS - 1)
+            printf("  %8s >=%5u ms %12llu\n", "", 1u << (b - 1), (unsigned long long)histogram[b]);
+        else
+            printf("  %5u ms .. %5u ms %12llu\n", 1u << (b - 1), 1u << b, (unsigned long long)histogram[b]);
+    }
+    fflush(stdout);
+}
+
+#endif
+
+// ========== LIVE MONITORING ==========
+
+#if UACONSOLE_WITH_MONITOR || UACONSOLE_WITH_SHELL
+// Also ends the shell's watch command
+static volatile sig_atomic_t monitorRunning = 1;
+
+static void monitorStop(int sig) {
+    (void)sig;
+    monitorRunning = 0;
+}
+#endif
+
+#if UACONSOLE_WITH_MONITOR
+
+// Seconds on the monotonic clock since started
+static double monitor_elapsed(UA_DateTime started) {
+    return (double)(UA_DateTime_nowMonotonic() - started) / UA_DATETIME_SEC;
+}
+
+// False once the --duration window has passed
+static int monitor_windowOpen(const ScanOptions *opts, UA_DateTime started) {
+    return opts->duration <= 0.0 || monitor_elapsed(started) < opts->duration;
+}
+
+// One monitored Variable; its address is the MonitoredItem context
+typedef struct {
+    UA_NodeId nodeId;
+    UA_QualifiedName browseName;
+} MonitorItem;
+
+typedef struct {
+    MonitorItem *items;
+    size_t size;
+    size_t capacity;
+    const ScanOptions *opts;
+    size_t notifications;
+    ValueProfile *profile;          // --profile-values: accumulate instead of streaming
+} MonitorSet;
+
+static int monitor_add(MonitorSet *set, const UA_NodeId *nodeId, const UA_QualifiedName *browseName) {
+    if (set->size == set->capacity) {
+        size_t newCapacity = set->capacity ? set->capacity * 2 : 256;
+        MonitorItem *items = (MonitorItem*)realloc(set->items, newCapacity * sizeof(MonitorItem));
+        if (!items)
+            return 0;
+        set->items = items;
+        set->capacity = newCapacity;
+    }
+    MonitorItem *item = &set->items[set->size];
+    if (UA_NodeId_copy(nodeId, &item->nodeId) != UA_STATUSCODE_GOOD)
+        return 0;
+    if (UA_QualifiedName_copy(browseName, &item->browseName) != UA_STATUSCODE_GOOD) {
+        UA_NodeId_clear(&item->nodeId);
+        return 0;
+    }
+    set->size++;
+    return 1;
+}
+
+static void monitor_clear(MonitorSet *set) {
+    for (size_t i = 0; i < set->size; i++) {
+        UA_NodeId_clear(&set->items[i].nodeId);
+        UA_QualifiedName_clear(&set->items[i].browseName);
+    }
+    free(set->items);
+    memset(set, 0, sizeof(MonitorSet));
+}
+
+// Collect all Variables below the root with a browse-only batched scan
+static int monitor_collectSubtree(UA_Client *client, UA_NodeId rootId, MonitorSet *set) {
+    ScanOptions scanOpts = *set->opts;
+    scanOpts.browseOnly = 1;
+    scanOpts.baseline = NULL;
+    
+    ScanGraph graph;
+    memset(&graph, 0, sizeof(ScanGraph));
+    int ok = scanBatched(client, rootId, &scanOpts, &graph) != GRAPH_NONE && graph_complete(&graph);
+    if (!ok && graph.unbrowsed > 0)
+        printf("Error: %zu nodes of the subtree could not be browsed\n", graph.unbrowsed);
+    for (size_t i = 0; ok && i < graph.size; i++) {
+        const GraphNode *node = &graph.nodes[i];
+        if (node->nodeClass == UA_NODECLASS_VARIABLE)
+            ok = monitor_add(set, &node->nodeId, &node->browseName);
+    }
+    graph_clear(&graph);
+    return ok;
+}
+
+// Collect the NodeIds listed in a file, one per line in the usual
+// "ns=2;s=Name" notation; empty lines and lines starting with # are
+// skipped. BrowseNames are read in batches for display.
+static int monitor_collectList(UA_Client *client, const char *path, MonitorSet *set) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        printf("Error: Could not open %s\n", path);
+        return 0;
+    }
+    
+    char line[1024];
+    int lineNo = 0;
+    UA_QualifiedName unnamed;
+    UA_QualifiedName_init(&unnamed);
+    while (fgets(line, sizeof(line), fp)) {
+        lineNo++;
+        size_t len = strlen(line);
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r' ||
+                           line[len - 1] == ' ' || line[len - 1] == '\t'))
+            line[--len] = '\0';
+        char *text = line;
+        while (*text == ' ' || *text == '\t')
+            text++;
+        if (*text == '\0' || *text == '#')
+            continue;
+        
+        UA_NodeId nodeId;
+        if (UA_NodeId_parse(&nodeId, UA_STRING(text)) != UA_STATUSCODE_GOOD) {
+            printf("Error: %s:%d: Invalid NodeId '%s'\n", path, lineNo, text);
+            fclose(fp);
+            return 0;
+        }
+        int added = monitor_add(set, &nodeId, &unnamed);
+        UA_NodeId_clear(&nodeId);
+        if (!added) {
+            fclose(fp);
+            return 0;
+        }
+    }
+    fclose(fp);
+    
+    size_t chunk = set->opts->sizes.read;
+    for (size_t start = 0; start < set->size; start += chunk) {
+        size_t count = set->size - start < chunk ? set->size - start : chunk;
+        UA_ReadRequest rReq;
+        UA_ReadRequest_init(&rReq);
+        rReq.nodesToRead = (UA_ReadValueId*)UA_Array_new(count, &UA_TYPES[UA_TYPES_READVALUEID]);
+        if (!rReq.nodesToRead)
+            return 0;
+        rReq.nodesToReadSize = count;
+        for (size_t i = 0; i < count; i++) {
+            UA_NodeId_copy(&set->items[start + i].nodeId, &rReq.nodesToRead[i].nodeId);
+            rReq.nodesToRead[i].attributeId = UA_ATTRIBUTEID_BROWSENAME;
+        }
+        
+        UA_ReadResponse rResp = timedRead(client, rReq);
+        UA_ReadRequest_clear(&rReq);
+        for (size_t i = 0; i < count && i < rResp.resultsSize; i++) {
+            UA_DataValue *dv = &rResp.results[i];
+            if (dv->hasValue && UA_Variant_hasScalarType(&dv->value, &UA_TYPES[UA_TYPES_QUALIFIEDNAME])) {
+                UA_QualifiedName_clear(&set->items[start + i].browseName);
+                UA_QualifiedName_copy((UA_QualifiedName*)dv->value.data, &set->items[start + i].browseName);
+            }
+        }
+        UA_ReadResponse_clear(&rResp);
+    }
+    return 1;
+}
+
+// Collect the targets of the --path options; unresolved paths are reported
+static int monitor_collectPaths(UA_Client *client, UA_NodeId rootId, MonitorSet *set) {
+    const ScanOptions *opts = set->opts;
+    ResolvedPath *paths = resolvedPaths_new(opts);
+    if (!paths)
+        return 0;
+    resolvePaths(client, &rootId, opts, paths, opts->pathCount);
+    int ok = 1;
+    for (size_t i = 0; ok && i < opts->pathCount; i++) {
+        if (paths[i].status == UA_STATUSCODE_GOOD)
+            ok = monitor_add(set, &paths[i].nodeId, &paths[i].browseName);
+    }
+    resolvedPaths_clear(paths, opts->pathCount);
+    return ok;
+}
+
+#define PROFILE_CSV_COLUMNS "nodeId,browseName,samples,bad,updates,min,max,mean,stddev," \
+                            "requestedMs,revisedMs,intervalMs,jitterMs,arrivalMs,arrivalHistogram"
+
+// A statistic or nothing: tree lines leave it out, JSON writes null and
+// CSV an empty field
+static void profile_field(OutBuf *out, OutputFormat format, const char *name, int valid, double v) {
+    if (format == FORMAT_TREE) {
+        if (!valid)
+            return;
+        out_char(out, ' ');
+        out_str(out, name);
+        out_char(out, '=');
+        out_real(out, v, 6);
+    } else if (format == FORMAT_NDJSON) {
+        out_str(out, ",\"");
+        out_str(out, name);
+        out_str(out, "\":");
+        if (valid)
+            out_real(out, v, 10);
+        else
+            out_str(out, "null");
+    } else {
+        out_char(out, ',');
+        if (valid)
+            out_real(out, v, 10);
+    }
+}
+
+// One record per item with the --profile-values statistics, in the
+// chosen output format
+static void monitor_report(const MonitorSet *set, const ValueProfile *p) {
+    OutBuf *out = set->opts->out;
+    OutputFormat format = set->opts->format;
+    if (format == FORMAT_CSV)
+        out_str(out, PROFILE_CSV_COLUMNS "\n");
+    
+    for (size_t i = 0; i < set->size; i++) {
+        const MonitorItem *item = &set->items[i];
+        int numeric = p->numeric[i] > 0;
+        int intervals = p->intervals[i] > 0;
+        
+        if (format == FORMAT_TREE) {
+            out_uastr(out, &item->browseName.name);
+            out_str(out, "  [");
+            out_nodeid(out, &item->nodeId);
+            out_str(out, "] samples=");
+        }
+#if UACONSOLE_WITH_EXPORT
+        else if (format == FORMAT_NDJSON) {
+            out_str(out, "{\"nodeId\":");
+            out_nodeid_field(out, &item->nodeId, out_json_string);
+            out_str(out, ",\"browseName\":");
+            out_json_string(out, (const char*)item->browseName.name.data, item->browseName.name.length);
+            out_str(out, ",\"samples\":");
+        } else {
+            out_nodeid_field(out, &item->nodeId, out_csv_field);
+            out_char(out, ',');
+            out_csv_field(out, (const char*)item->browseName.name.data, item->browseName.name.length);
+            out_char(out, ',');
+        }
+#endif
+        out_u64(out, p->samples[i]);
+        out_str(out, format == FORMAT_TREE ? " bad=" : format == FORMAT_NDJSON ? ",\"bad\":" : ",");
+        out_u64(out, p->bad[i]);
+        out_str(out, format == FORMAT_TREE ? " updates=" : format == FORMAT_NDJSON ? ",\"updates\":" : ",");
+        out_u64(out, p->updates[i]);
+        profile_field(out, format, "min", numeric, p->min[i]);
+        profile_field(out, format, "max", numeric, p->max[i]);
+        profile_field(out, format, "mean", numeric, p->mean[i]);
+        profile_field(out, format, "stddev", numeric, profile_stddev(p->m2[i], p->numeric[i]));
+        profile_field(out, format, "requestedMs", 1, p->requestedMs);
+        profile_field(out, format, "revisedMs", p->revisedMs[i] >= 0.0, p->revisedMs[i]);
+        profile_field(out, format, "intervalMs", intervals, p->intervalMean[i]);
+        profile_field(out, format, "jitterMs", intervals,
+                      profile_stddev(p->intervalM2[i], p->intervals[i]));
+        profile_field(out, format, "arrivalMs", p->samples[i] > 1, p->arrivalMean[i]);
+        
+        // Inter-arrival histogram, buckets of doubling width from 1 ms
+        const UA_UInt32 *h = &p->histogram[i * PROFILE_BUCKETS];
+        if (format == FORMAT_NDJSON) {
+            out_str(out, ",\"arrivalHistogram\":[");
+            for (size_t b = 0; b < PROFILE_BUCKETS; b++) {
+                if (b > 0)
+                    out_char(out, ',');
+                out_u64(out, h[b]);
+            }
+            out_str(out, "]}\n");
+        } else if (format == FORMAT_CSV) {
+            out_char(out, ',');
+            for (size_t b = 0; b < PROFILE_BUCKETS; b++) {
+                if (b > 0)
+                    out_char(out, ';');
+                out_u64(out, h[b]);
+            }
+            out_char(out, '\n');
+        } else {
+            out_char(out, '\n');
+        }
+    }
+}
+
+static void monitorDataChange(UA_Client *client, UA_UInt32 subId, void *subContext,
+                              UA_UInt32 monId, void *monContext, UA_DataValue *value) {
+    MonitorSet *set = (MonitorSet*)subContext;
+    const MonitorItem *item = (const MonitorItem*)monContext;
+    const ScanOptions *opts = set->opts;
+    set->notifications++;
+    if (set->profile) {
+        profile_sample(set->profile, (size_t)(item - set->items), value, UA_DateTime_nowMonotonic());
+        return;
+    }
+    
+    NodeRecord rec;
+    memset(&rec, 0, sizeof(NodeRecord));
+    rec.nodeId = &item->nodeId;
+    rec.browseName = &item->browseName;
+    rec.nodeClass = UA_NODECLASS_VARIABLE;
+    rec.value = value;
+    
+    // The tree listing has no timestamp column; prefix the line instead
+    if (opts->format == FORMAT_TREE) {
+        out_isotime(opts->out, value->hasSourceTimestamp ? value->sourceTimestamp : UA_DateTime_now());
+        out_char(opts->out, ' ');
+    }
+    emitNode(opts->out, opts->format, &rec);
+}
+
+// Create MonitoredItems for the given items with as few
+// CreateMonitoredItems calls as the batch size allows. Items the server
+// refuses a deadband filter for (non-numeric values) are returned in
+// noFilter so they can be created again without one. Returns the number
+// of items created.
+static size_t monitor_create(UA_Client *client, MonitorSet *set, UA_UInt32 subId,
+                             const size_t *indices, size_t count, int withFilter,
+                             size_t *noFilter, size_t *noFilterSize) {
+    const ScanOptions *opts = set->opts;
+    UA_DataChangeFilter filter;
+    UA_DataChangeFilter_init(&filter);
+    filter.trigger = UA_DATACHANGETRIGGER_STATUSVALUE;
+    filter.deadbandType = UA_DEADBANDTYPE_ABSOLUTE;
+    filter.deadbandValue = opts->monitorDeadband;
+    
+    size_t created = 0;
+    size_t chunk = opts->sizes.monitoredItems;
+    void **contexts = (void**)malloc((chunk < count ? chunk : count) * sizeof(void*));
+    UA_Client_DataChangeNotificationCallback *callbacks = (UA_Client_DataChangeNotificationCallback*)
+        malloc((chunk < count ? chunk : count) * sizeof(UA_Client_DataChangeNotificationCallback));
+    if (!contexts || !callbacks) {
+        free(contexts);
+        free(callbacks);
+        return 0;
+    }
+    
+    for (size_t start = 0; start < count; start += chunk) {
+        size_t n = count - start < chunk ? count - start : chunk;
+        UA_CreateMonitoredItemsRequest mReq;
+        UA_CreateMonitoredItemsRequest_init(&mReq);
+        mReq.subscriptionId = subId;
+        mReq.timestampsToReturn = UA_TIMESTAMPSTORETURN_BOTH;
+        mReq.itemsToCreate = (UA_MonitoredItemCreateRequest*)
+            UA_Array_new(n, &UA_TYPES[UA_TYPES_MONITOREDITEMCREATEREQUEST]);
+        if (!mReq.itemsToCreate)
+            break;
+        mReq.itemsToCreateSize = n;
+        for (size_t i = 0; i < n; i++) {
+            MonitorItem *item = &set->items[indices[start + i]];
+            UA_MonitoredItemCreateRequest *c = &mReq.itemsToCreate[i];
+            UA_NodeId_copy(&item->nodeId, &c->itemToMonitor.nodeId);
+            c->itemToMonitor.attributeId = UA_ATTRIBUTEID_VALUE;
+            c->monitoringMode = UA_MONITORINGMODE_REPORTING;
+            c->requestedParameters.samplingInterval = opts->monitorSamplingMs;
+            c->requestedParameters.queueSize = opts->monitorQueueSize;
+            c->requestedParameters.discardOldest = true;
+            // The filter is only referenced; clearing the request leaves it alone
+            if (withFilter)
+                UA_ExtensionObject_setValue(&c->requestedParameters.filter, &filter,
+                                            &UA_TYPES[UA_TYPES_DATACHANGEFILTER]);
+            contexts[i] = item;
+            callbacks[i] = monitorDataChange;
+        }
+        
+        UA_CreateMonitoredItemsResponse mResp =
+            UA_Client_MonitoredItems_createDataChanges(client, mReq, contexts, callbacks, NULL);
+        UA_CreateMonitoredItemsRequest_clear(&mReq);
+        
+        if (mResp.responseHeader.serviceResult != UA_STATUSCODE_GOOD) {
+            printf("Error: CreateMonitoredItems failed: %s\n",
+                   UA_StatusCode_name(mResp.responseHeader.serviceResult));
+        }
+        for (size_t i = 0; i < n && i < mResp.resultsSize; i++) {
+            UA_StatusCode rc = mResp.results[i].statusCode;
+            if (rc == UA_STATUSCODE_GOOD) {
+                created++;
+                if (set->profile)
+                    set->profile->revisedMs[indices[start + i]] = mResp.results[i].revisedSamplingInterval;
+            } else if (withFilter && noFilter &&
+                       (rc == UA_STATUSCODE_BADFILTERNOTALLOWED ||
+                        rc == UA_STATUSCODE_BADMONITOREDITEMFILTERUNSUPPORTED)) {
+                noFilter[(*noFilterSize)++] = indices[start + i];
+            } else if (opts->verbose) {
+                const MonitorItem *item = &set->items[indices[start + i]];
+                printf("  Not monitored: %.*s (%s)\n", (int)item->browseName.name.length,
+                       (const char*)item->browseName.name.data, UA_StatusCode_name(rc));
+            }
+        }
+        UA_CreateMonitoredItemsResponse_clear(&mResp);
+    }
+    
+    free(contexts);
+    free(callbacks);
+    return created;
+}
+
+// Entry point of --monitor: subscribe to the Variables below the root (or
+// listed in opts->monitorList, or the --path targets) and stream their
+// DataChange notifications to the output sink until interrupted
+static void monitorValues(UA_Client *client, UA_NodeId rootId, const ScanOptions *opts) {
+    MonitorSet set;
+    memset(&set, 0, sizeof(MonitorSet));
+    set.opts = opts;
+    
+    int collected = opts->pathCount ? monitor_collectPaths(client, rootId, &set) :
+                    opts->monitorList ? monitor_collectList(client, opts->monitorList, &set)
+                                      : monitor_collectSubtree(client, rootId, &set);
+    if (!collected || set.size == 0) {
+        printf("Error: No Variables to monitor\n");
+        monitor_clear(&set);
+        return;
+    }
+    ValueProfile profile;
+    if (opts->profileValues) {
+        if (!profile_init(&profile, set.size, opts->monitorSamplingMs)) {
+            printf("Error: Out of memory\n");
+            monitor_clear(&set);
+            return;
+        }
+        set.profile = &profile;
+    }
+    
+    // Publish as often as values are sampled so changes are delivered promptly
+    UA_CreateSubscriptionRequest sReq = UA_CreateSubscriptionRequest_default();
+    sReq.requestedPublishingInterval = opts->monitorSamplingMs;
+    sReq.maxNotificationsPerPublish = 0;
+    UA_CreateSubscriptionResponse sResp = UA_Client_Subscriptions_create(client, sReq, &set, NULL, NULL);
+    if (sResp.responseHeader.serviceResult != UA_STATUSCODE_GOOD) {
+        printf("Error: Could not create subscription: %s\n",
+               UA_StatusCode_name(sResp.responseHeader.serviceResult));
+        if (set.profile)
+            profile_clear(&profile);
+        monitor_clear(&set);
+        return;
+    }
+    UA_UInt32 subId = sResp.subscriptionId;
+    
+    size_t *indices = (size_t*)malloc(set.size * sizeof(size_t));
+    size_t *noFilter = (size_t*)malloc(set.size * sizeof(size_t));
+    size_t created = 0;
+    if (indices && noFilter) {
+        for (size_t i = 0; i < set.size; i++)
+            indices[i] = i;
+        size_t noFilterSize = 0;
+        int withFilter = opts->monitorDeadband > 0.0;
+        created = monitor_create(client, &set, subId, indices, set.size, withFilter,
+                                 noFilter, &noFilterSize);
+        if (noFilterSize > 0)
+            created += monitor_create(client, &set, subId, noFilter, noFilterSize, 0, NULL, NULL);
+    }
+    free(indices);
+    free(noFilter);
+    
+    printf("%s %zu of %zu Variables (publishing interval %.0f ms), Ctrl+C to stop\n\n",
+           set.profile ? "Profiling" : "Monitoring", created, set.size, sResp.revisedPublishingInterval);
+    fflush(stdout);
+    
+    signal(SIGINT, monitorStop);
+    signal(SIGTERM, monitorStop);
+    if (!set.profile)
+        beginOutput(opts->out, opts->format, 0, NULL);
+    UA_DateTime started = UA_DateTime_nowMonotonic();
+    while (created > 0 && monitorRunning && monitor_windowOpen(opts, started)) {
+        UA_StatusCode retval = UA_Client_run_iterate(client, 100);
+        out_flush(opts->out);
+        fflush(opts->out->fp);
+        if (retval != UA_STATUSCODE_GOOD) {
+            printf("Error: Connection lost: %s\n", UA_StatusCode_name(retval));
+            break;
+        }
+    }
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    
+    UA_Client_Subscriptions_deleteSingle(client, subId);
+    if (opts->verbose)
+        printf("\n%zu notifications received\n", set.notifications);
+    if (set.profile) {
+        monitor_report(&set, &profile);
+        out_flush(opts->out);
+        fflush(opts->out->fp);
+        profile_summary(&profile, monitor_elapsed(started));
+        profile_clear(&profile);
+    }
+    monitor_clear(&set);
+}
+
+// ========== REGISTERED POLLING ==========
+
+// Register the items' NodeIds in batches and store the server's aliases;
+// items the server could not register keep their original NodeId
+static size_t poll_register(UA_Client *client, const MonitorSet *set, UA_NodeId *aliases) {
+    size_t registered = 0;
+    size_t chunk = set->opts->sizes.registerNodes;
+    for (size_t start = 0; start < set->size; start += chunk) {
+        size_t count = set->size - start < chunk ? set->size - start : chunk;
+        UA_RegisterNodesRequest req;
+        UA_RegisterNodesRequest_init(&req);
+        req.nodesToRegister = (UA_NodeId*)UA_Array_new(count, &UA_TYPES[UA_TYPES_NODEID]);
+        if (!req.nodesToRegister)
+            break;
+        req.nodesToRegisterSize = count;
+        for (size_t i = 0; i < count; i++)
+            UA_NodeId_copy(&set->items[start + i].nodeId, &req.nodesToRegister[i]);
+        
+        UA_RegisterNodesResponse resp = UA_Client_Service_registerNodes(client, req);
+        UA_RegisterNodesRequest_clear(&req);
+        if (resp.responseHeader.serviceResult != UA_STATUSCODE_GOOD) {
+            printf("Error: RegisterNodes failed: %s, reading unregistered NodeIds\n",
+                   UA_StatusCode_name(resp.responseHeader.serviceResult));
+            UA_RegisterNodesResponse_clear(&resp);
+            break;
+        }
+        if (resp.registeredNodeIdsSize != count) {
+            printf("Error: RegisterNodes returned %zu NodeIds for %zu nodes, reading unregistered NodeIds\n",
+                   resp.registeredNodeIdsSize, count);
+            UA_RegisterNodesResponse_clear(&resp);
+            break;
+        }
+        for (size_t i = 0; i < count; i++) {
+            UA_NodeId_clear(&aliases[start + i]);
+            aliases[start + i] = resp.registeredNodeIds[i];
+        }
+        // The aliases were moved out of the response
+        UA_free(resp.registeredNodeIds);
+        resp.registeredNodeIds = NULL;
+        resp.registeredNodeIdsSize = 0;
+        UA_RegisterNodesResponse_clear(&resp);
+        registered += count;
+    }
+    return registered;
+}
+
+static void poll_unregister(UA_Client *client, const MonitorSet *set,
+                            UA_NodeId *aliases, size_t registered) {
+    size_t chunk = set->opts->sizes.registerNodes;
+    for (size_t start = 0; start < registered; start += chunk) {
+        size_t count = registered - start < chunk ? registered - start : chunk;
+        UA_UnregisterNodesRequest req;
+        UA_UnregisterNodesRequest_init(&req);
+        req.nodesToUnregister = &aliases[start];
+        req.nodesToUnregisterSize = count;
+        UA_UnregisterNodesResponse resp = UA_Client_Service_unregisterNodes(client, req);
+        UA_UnregisterNodesResponse_clear(&resp);
+    }
+}
+
+// Milliseconds between two CLOCK_MONOTONIC readings
+static double poll_elapsedMs(const struct timespec *from, const struct timespec *to) {
+    return (to->tv_sec - from->tv_sec) * 1000.0 + (to->tv_nsec - from->tv_nsec) / 1000000.0;
+}
+
+static void poll_advance(struct timespec *t, long intervalMs) {
+    t->tv_sec += intervalMs / 1000;
+    t->tv_nsec += (intervalMs % 1000) * 1000000L;
+    if (t->tv_nsec >= 1000000000L) {
+        t->tv_sec++;
+        t->tv_nsec -= 1000000000L;
+    }
+}
+
+// Entry point of --read-list: register the listed NodeIds once, then read
+// their Values with prebuilt batched Read requests on a fixed schedule and
+// write every result to the output sink until interrupted. Cycles are
+// timed against absolute deadlines so jitter does not accumulate; a cycle
+// that overruns skips the ticks it missed instead of bursting to catch up.
+static void pollValues(UA_Client *client, const ScanOptions *opts) {
+    MonitorSet set;
+    memset(&set, 0, sizeof(MonitorSet));
+    set.opts = opts;
+    
+    if (!monitor_collectList(client, opts->readList, &set) || set.size == 0) {
+        printf("Error: No Variables to read\n");
+        monitor_clear(&set);
+        return;
+    }
+    ValueProfile profile;
+    if (opts->profileValues) {
+        if (!profile_init(&profile, set.size, opts->pollIntervalMs)) {
+            printf("Error: Out of memory\n");
+            monitor_clear(&set);
+            return;
+        }
+        set.profile = &profile;
+    }
+    
+    size_t chunk = opts->sizes.read;
+    size_t requestCount = (set.size + chunk - 1) / chunk;
+    UA_NodeId *aliases = (UA_NodeId*)calloc(set.size, sizeof(UA_NodeId));
+    UA_ReadRequest *requests = (UA_ReadRequest*)calloc(requestCount, sizeof(UA_ReadRequest));
+    if (!aliases || !requests) {
+        printf("Error: Out of memory\n");
+        free(aliases);
+        free(requests);
+        if (set.profile)
+            profile_clear(&profile);
+        monitor_clear(&set);
+        return;
+    }
+    for (size_t i = 0; i < set.size; i++)
+        UA_NodeId_copy(&set.items[i].nodeId, &aliases[i]);
+    size_t registered = poll_register(client, &set, aliases);
+    
+    // The requests are built once and sent unchanged every cycle
+    int built = 1;
+    for (size_t r = 0; r < requestCount && built; r++) {
+        size_t start = r * chunk;
+        size_t count = set.size - start < chunk ? set.size - start : chunk;
+        UA_ReadRequest *req = &requests[r];
+        UA_ReadRequest_init(req);
+        req->timestampsToReturn = UA_TIMESTAMPSTORETURN_BOTH;
+        req->nodesToRead = (UA_ReadValueId*)UA_Array_new(count, &UA_TYPES[UA_TYPES_READVALUEID]);
+        if (!req->nodesToRead) {
+            built = 0;
+            break;
+        }
+        req->nodesToReadSize = count;
+        for (size_t i = 0; i < count; i++) {
+            UA_NodeId_copy(&aliases[start + i], &req->nodesToRead[i].nodeId);
+            req->nodesToRead[i].attributeId = UA_ATTRIBUTEID_VALUE;
+        }
+    }
+    
+    if (built) {
+        printf("%s %zu Variables (%zu registered) every %d ms in %zu Read requests, Ctrl+C to stop\n\n",
+               set.profile ? "Profiling" : "Polling", set.size, registered, opts->pollIntervalMs, requestCount);
+        fflush(stdout);
+    } else {
+        printf("Error: Out of memory\n");
+    }
+    
+    size_t cycles = 0;
+    size_t missed = 0;
+    double maxLateMs = 0.0;
+    double maxCycleMs = 0.0;
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    
+    signal(SIGINT, monitorStop);
+    signal(SIGTERM, monitorStop);
+    if (!set.profile)
+        beginOutput(opts->out, opts->format, 0, NULL);
+    UA_DateTime started = UA_DateTime_nowMonotonic();
+    while (built && monitorRunning && monitor_windowOpen(opts, started)) {
+        struct timespec began;
+        clock_gettime(CLOCK_MONOTONIC, &began);
+        double late = poll_elapsedMs(&next, &began);
+        if (late > maxLateMs)
+            maxLateMs = late;
+        
+        int failed = 0;
+        for (size_t r = 0; r < requestCount && !failed; r++) {
+            UA_ReadResponse resp = timedRead(client, requests[r]);
+            if (resp.responseHeader.serviceResult != UA_STATUSCODE_GOOD) {
+                printf("Error: Read failed: %s\n", UA_StatusCode_name(resp.responseHeader.serviceResult));
+                failed = 1;
+            }
+            UA_DateTime arrival = UA_DateTime_nowMonotonic();
+            for (size_t i = 0; i < resp.resultsSize && i < requests[r].nodesToReadSize; i++) {
+                const MonitorItem *item = &set.items[r * chunk + i];
+                UA_DataValue *dv = &resp.results[i];
+                if (set.profile) {
+                    profile_sample(set.profile, r * chunk + i, dv, arrival);
+                    continue;
+                }
+                NodeRecord rec;
+                memset(&rec, 0, sizeof(NodeRecord));
+                rec.nodeId = &item->nodeId;
+                rec.browseName = &item->browseName;
+                rec.nodeClass = UA_NODECLASS_VARIABLE;
+                rec.value = dv;
+                if (opts->format == FORMAT_TREE) {
+                    out_isotime(opts->out, dv->hasSourceTimestamp ? dv->sourceTimestamp : UA_DateTime_now());
+                    out_char(opts->out, ' ');
+                }
+                emitNode(opts->out, opts->format, &rec);
+            }
+            UA_ReadResponse_clear(&resp);
+        }
+        out_flush(opts->out);
+        fflush(opts->out->fp);
+        if (failed)
+            break;
+        if (++cycles == opts->cycles)
+            break;
+        
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        double cycle = poll_elapsedMs(&began, &now);
+        if (cycle > maxCycleMs)
+            maxCycleMs = cycle;
+        poll_advance(&next, opts->pollIntervalMs);
+        while (poll_elapsedMs(&next, &now) > 0.0) {
+            poll_advance(&next, opts->pollIntervalMs);
+            missed++;
+        }
+        // Restarted after other signals; the deadline stays absolute
+        int slept;
+        do {
+            slept = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+        } while (slept != 0 && monitorRunning);
+    }
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    
+    if (opts->verbose)
+        printf("\n%zu cycles, %zu ticks missed, max lateness %.2f ms, max cycle time %.2f ms\n",
+               cycles, missed, maxLateMs, maxCycleMs);
+    if (set.profile) {
+        monitor_report(&set, &profile);
+        out_flush(opts->out);
+        fflush(opts->out->fp);
+        profile_summary(&profile, monitor_elapsed(started));
+        profile_clear(&profile);
+    }
+    
+    for (size_t r = 0; r < requestCount; r++)
+        UA_ReadRequest_clear(&requests[r]);
+    free(requests);
+    poll_unregister(client, &set, aliases, registered);
+    for (size_t i = 0; i < set.size; i++)
+        UA_NodeId_clear(&aliases[i]);
+    free(aliases);
+    monitor_clear(&set);
+}
+
+#endif
+
+// ========== FLEET SCAN ==========
+
+// Targets of --targets, handed out to the workers in file order
+typedef struct {
+    char **urls;
+    size_t size;
+    size_t capacity;
+    size_t next;
+    size_t scanned;
+    size_t incomplete;              // Listed, but part of the address space is missing
+    size_t failed;
+    UA_NodeId rootId;
+    const ScanOptions *opts;
+    const char *outDir;             // One output file per target, NULL = combined
+    pthread_mutex_t lock;           // Guards next and the combined output stream
+} FleetScan;
+
+static void fleet_clear(FleetScan *fleet) {
+    for (size_t i = 0; i < fleet->size; i++)
+        free(fleet->urls[i]);
+    free(fleet->urls);
+    fleet->urls = NULL;
+    fleet->size = fleet->capacity = 0;
+}
+
+// Read endpoint URLs, one per line; empty lines and # comments are skipped
+static int fleet_load(FleetScan *fleet, const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        printf("Error: Could not open %s\n", path);
+        return 0;
+    }
+    
+    char line[1024];
+    while (fgets(line, sizeof(line), fp)) {
+        size_t len = strlen(line);
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r' ||
+                           line[len - 1] == ' ' || line[len - 1] == '\t'))
+            line[--len] = '\0';
+        char *text = line;
+        while (*text == ' ' || *text == '\t')
+            text++;
+        if (*text == '\0' || *text == '#')
+            continue;
+        
+        if (fleet->size == fleet->capacity) {
+            size_t newCapacity = fleet->capacity ? fleet->capacity * 2 : 64;
+            char **urls = (char**)realloc(fleet->urls, newCapacity * sizeof(char*));
+            if (!urls) {
+                fclose(fp);
+                return 0;
+            }
+            fleet->urls = urls;
+            fleet->capacity = newCapacity;
+        }
+        if (!(fleet->urls[fleet->size] = strdup(text))) {
+            fclose(fp);
+            return 0;
+        }
+        fleet->size++;
+    }
+    fclose(fp);
+    return 1;
+}
+
+// Output file of one target: the URL with everything but letters, digits,
+// dots and dashes replaced, e.g. opc.tcp___10.0.0.128_4840-0688b492.ndjson.
+// The replacement is not unique (.../x and ..._x map to the same name), so
+// a hash of the full URL keeps the files of distinct targets apart.
+static void fleet_outputPath(const FleetScan *fleet, const char *url, char *path, size_t size) {
+    static const char *extensions[] = {"txt", "ndjson", "csv"};
+    const size_t suffix = 16;       // "-%08x" and the longest extension
+    int n = snprintf(path, size, "%s/", fleet->outDir);
+    for (const char *c = url; *c && n > 0 && (size_t)n + suffix + 1 < size; c++) {
+        int keep = (*c >= 'a' && *c <= 'z') || (*c >= 'A' && *c <= 'Z') ||
+                   (*c >= '0' && *c <= '9') || *c == '.' || *c == '-';
+        path[n++] = keep ? *c : '_';
+    }
+    if (n > 0 && (size_t)n < size)
+        snprintf(&path[n], size - (size_t)n, "-%08x.%s",
+                 (unsigned)stringPool_hash((const UA_Byte*)url, strlen(url)),
+                 extensions[fleet->opts->format]);
+}
+
+// Connect to one target and scan it with the batched engine into fp.
+// Returns the number of nodes, or 0 with the status in *status; *complete
+// tells whether the whole address space was listed.
+static size_t fleet_scanTarget(FleetScan *fleet, const char *url, FILE *fp, char *storage,
+                               size_t capacity, UA_StatusCode *status, int *complete) {
+    OutBuf out;
+    out_init(&out, storage, capacity, fp);
+    ScanOptions opts = *fleet->opts;
+    opts.out = &out;
+    opts.serverUrl = url;
+    opts.recordServer = fleet->outDir ? NULL : url;
+    opts.verbose = 0;
+    opts.sessions = 0;
+    opts.inflight = 0;
+    opts.formatThreads = 0;         // Targets are already formatted in parallel
+    
+    UA_Client *client = createClient(opts.timeoutMs);
+    if (!client) {
+        *status = UA_STATUSCODE_BADOUTOFMEMORY;
+        return 0;
+    }
+    *status = connectClient(client, url, &opts);
+    if (*status != UA_STATUSCODE_GOOD) {
+        UA_Client_delete(client);
+        return 0;
+    }
+    
+    ServerLimits limits;
+    discoverServerLimits(client, &limits);
+    chooseBatchSizes(&limits, &opts);
+    
+    ScanGraph graph;
+    memset(&graph, 0, sizeof(ScanGraph));
+    size_t root = scanBatched(client, fleet->rootId, &opts, &graph);
+    size_t nodes = 0;
+    if (root != GRAPH_NONE) {
+        graph_finish(&graph, root, &opts);
+        nodes = graph.size;
+        *complete = graph_complete(&graph);
+    } else {
+        *status = UA_STATUSCODE_BADNODEIDUNKNOWN;
+    }
+    out_flush(&out);
+    graph_clear(&graph);
+    UA_Client_disconnect(client);
+    UA_Client_delete(client);
+    return nodes;
+}
+
+static void *fleetWorkerRun(void *arg) {
+    FleetScan *fleet = (FleetScan*)arg;
+    const ScanOptions *opts = fleet->opts;
+    size_t capacity = 64 * 1024;
+    char *storage = (char*)malloc(capacity);
+    if (!storage)
+        return NULL;
+    
+    for (;;) {
+        pthread_mutex_lock(&fleet->lock);
+        size_t index = fleet->next < fleet->size ? fleet->next++ : fleet->size;
+        pthread_mutex_unlock(&fleet->lock);
+        if (index == fleet->size)
+            break;
+        const char *url = fleet->urls[index];
+        
+        // Combined output is collected in memory and written in one piece
+        // so the records of concurrent targets do not interleave
+        char path[1024];
+        char *text = NULL;
+        size_t textSize = 0;
+        FILE *fp;
+        if (fleet->outDir) {
+            fleet_outputPath(fleet, url, path, sizeof(path));
+            fp = fopen(path, "w");
+        } else {
+            fp = open_memstream(&text, &textSize);
+        }
+        
+        // Every target is a different server with its own rate control
+        Throttle throttle;
+        throttle_init(&throttle);
+        throttle_bind(&throttle);
+        UA_StatusCode status = UA_STATUSCODE_BADOUTOFMEMORY;
+        int complete = 0;
+        size_t nodes = fp ? fleet_scanTarget(fleet, url, fp, storage, capacity, &status, &complete) : 0;
+        throttle_bind(NULL);
+        throttle_destroy(&throttle);
+        if (fp)
+            fclose(fp);
+        
+        pthread_mutex_lock(&fleet->lock);
+        if (nodes > 0) {
+            // What an incomplete scan found is still written out
+            if (complete)
+                fleet->scanned++;
+            else
+                fleet->incomplete++;
+            if (!fleet->outDir && opts->format == FORMAT_TREE)
+                fprintf(opts->out->fp, "=== %s: %zu nodes%s ===\n", url, nodes,
+                        complete ? "" : ", incomplete");
+            if (text)
+                fwrite(text, 1, textSize, opts->out->fp);
+            fflush(opts->out->fp);
+            if (!complete)
+                printf("%s: %zu nodes, incomplete\n", url, nodes);
+            else if (opts->verbose)
+                printf("%s: %zu nodes\n", url, nodes);
+        } else {
+            fleet->failed++;
+            printf("%s: %s\n", url, UA_StatusCode_name(status));
+        }
+        pthread_mutex_unlock(&fleet->lock);
+        free(text);
+    }
+    
+    free(storage);
+    return NULL;
+}
+
+// Entry point of --targets: scan every endpoint listed in the file with a
+// pool of worker threads, one session per target at a time. Dead hosts
+// only occupy their worker for the connect timeout. Returns the number of
+// targets that could not be scanned completely.
+static size_t scanFleet(const char *path, size_t workerCount, const char *outDir,
+                        UA_NodeId rootId, const ScanOptions *opts) {
+    FleetScan fleet;
+    memset(&fleet, 0, sizeof(FleetScan));
+    fleet.rootId = rootId;
+    fleet.opts = opts;
+    fleet.outDir = outDir;
+    if (!fleet_load(&fleet, path) || fleet.size == 0) {
+        printf("Error: No targets to scan\n");
+        fleet_clear(&fleet);
+        return 1;
+    }
+    if (workerCount > fleet.size)
+        workerCount = fleet.size;
+    printf("Scanning %zu targets with %zu workers\n\n", fleet.size, workerCount);
+    fflush(stdout);
+    
+    pthread_t *threads = (pthread_t*)calloc(workerCount, sizeof(pthread_t));
+    if (!threads) {
+        printf("Error: Out of memory\n");
+        size_t targets = fleet.size;
+        fleet_clear(&fleet);
+        return targets;
+    }
+    pthread_mutex_init(&fleet.lock, NULL);
+    
+    // Combined output has a single CSV header with a server column; the
+    // per-target scans leave it out
+    if (!outDir && opts->format == FORMAT_CSV) {
+        out_str(opts->out, "server,");
+        beginOutput(opts->out, opts->format, 0, &opts->attributes);
+        out_flush(opts->out);
+    }
+    size_t started = 0;
+    for (size_t i = 0; i < workerCount; i++) {
+        if (pthread_create(&threads[started], NULL, fleetWorkerRun, &fleet) == 0)
+            started++;
+    }
+    if (started == 0)
+        fleetWorkerRun(&fleet);
+    for (size_t i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+    
+    printf("\n%zu of %zu targets scanned, %zu incomplete, %zu failed\n",
+           fleet.scanned, fleet.size, fleet.incomplete, fleet.failed);
+    size_t failed = fleet.size - fleet.scanned;
+    free(threads);
+    pthread_mutex_destroy(&fleet.lock);
+    fleet_clear(&fleet);
+    return failed;
+}
+
+#if UACONSOLE_WITH_SHELL
+// ========== INTERACTIVE SHELL ==========
+
+#define SHELL_CACHE_ENTRIES 4096
+#define SHELL_REFERENCES_TTL_US (60 * 1000000ULL)
+#define SHELL_VALUE_TTL_US (5 * 1000000ULL)
+#define SHELL_FIND_DEPTH 4
+
+// Cached children and value of one node. Entries stay at their slot
+// until evicted, so pointers remain valid while a command runs; entries
+// used by the current command are never evicted.
+typedef struct {
+    UA_NodeId nodeId;               // Null for a free slot
+    RefList children;
+    UA_UInt64 childrenAt;           // stats_now() of the Browse, 0 = not browsed
+    UA_DataValue value;
+    UA_UInt64 valueAt;              // 0 = not read
+    UA_UInt64 lastUsed;             // Command counter of the last access
+    int prefetching;                // Background Browse outstanding
+} ShellEntry;
+
+typedef struct {
+    UA_Client *client;
+    const ScanOptions *opts;
+    ShellEntry *entries;            // SHELL_CACHE_ENTRIES slots
+    size_t used;
+    NodeIndex index;                // NodeId to slot
+    UA_UInt64 tick;                 // Incremented for every command
+    TraversalStack cwd;             // Current location, the root first
+    UA_ByteString *orphans;         // Continuation points of prefetches, released later
+    size_t orphansSize;
+    size_t prefetches;              // Background Browse requests outstanding
+    size_t hits;
+    size_t misses;
+    char input[4096];               // Bytes read from stdin, not yet a full line
+    size_t inputSize;
+} Shell;
+
+static void shellEntry_clear(ShellEntry *e) {
+    UA_NodeId_clear(&e->nodeId);
+    refList_clear(&e->children);
+    UA_DataValue_clear(&e->value);
+    memset(e, 0, sizeof(ShellEntry));
+}
+
+static int compareTick(const void *a, const void *b) {
+    UA_UInt64 x = *(const UA_UInt64*)a, y = *(const UA_UInt64*)b;
+    return x < y ? -1 : x > y;
+}
+
+// Evict the least recently used quarter of the cache and rebuild the
+// index, which has no deletion
+static void shell_evict(Shell *shell) {
+    UA_UInt64 *ticks = (UA_UInt64*)malloc(SHELL_CACHE_ENTRIES * sizeof(UA_UInt64));
+    if (!ticks)
+        return;
+    for (size_t i = 0; i < SHELL_CACHE_ENTRIES; i++)
+        ticks[i] = shell->entries[i].lastUsed;
+    qsort(ticks, SHELL_CACHE_ENTRIES, sizeof(UA_UInt64), compareTick);
+    UA_UInt64 threshold = ticks[SHELL_CACHE_ENTRIES / 4];
+    free(ticks);
+    if (threshold >= shell->tick)
+        threshold = shell->tick - 1;
+    
+    nodeIndex_clear(&shell->index);
+    for (size_t i = 0; i < SHELL_CACHE_ENTRIES; i++) {
+        ShellEntry *e = &shell->entries[i];
+        if (UA_NodeId_isNull(&e->nodeId))
+            continue;
+        if (e->lastUsed <= threshold && !e->prefetching) {
+            shellEntry_clear(e);
+            shell->used--;
+        } else {
+            nodeIndex_insert(&shell->index, &e->nodeId, i);
+        }
+    }
+}
+
+// Cache entry of a node, created if needed. NULL if the cache is full of
+// entries the current command uses.
+static ShellEntry *shell_entry(Shell *shell, const UA_NodeId *nodeId) {
+    size_t slot = nodeIndex_find(&shell->index, nodeId);
+    if (slot == NODEINDEX_EMPTY) {
+        if (shell->used == SHELL_CACHE_ENTRIES)
+            shell_evict(shell);
+        if (shell->used == SHELL_CACHE_ENTRIES)
+            return NULL;
+        slot = 0;
+        while (!UA_NodeId_isNull(&shell->entries[slot].nodeId))
+            slot++;
+        if (UA_NodeId_copy(nodeId, &shell->entries[slot].nodeId) != UA_STATUSCODE_GOOD ||
+            nodeIndex_insert(&shell->index, nodeId, slot) == NODEINDEX_EMPTY) {
+            shellEntry_clear(&shell->entries[slot]);
+            return NULL;
+        }
+        shell->used++;
+    }
+    ShellEntry *e = &shell->entries[slot];
+    e->lastUsed = shell->tick;
+    return e;
+}
+
+static int shell_fresh(UA_UInt64 at, UA_UInt64 ttl) {
+    return at != 0 && stats_now() - at < ttl;
+}
+
+// Children of a node, browsed unless cached within the TTL
+static ShellEntry *shell_children(Shell *shell, const UA_NodeId *nodeId) {
+    ShellEntry *e = shell_entry(shell, nodeId);
+    if (e && shell_fresh(e->childrenAt, SHELL_REFERENCES_TTL_US)) {
+        shell->hits++;
+        return e;
+    }
+    shell->misses++;
+    RefList children;
+    memset(&children, 0, sizeof(RefList));
+    UA_StatusCode retval = browseChildren(shell->client, nodeId, shell->opts, &children);
+    if (retval != UA_STATUSCODE_GOOD) {
+        printf("Error: Browse failed: %s\n", UA_StatusCode_name(retval));
+        refList_clear(&children);
+        return NULL;
+    }
+    // The Browse may have delivered prefetches that evicted or refilled the entry
+    e = shell_entry(shell, nodeId);
+    if (!e) {
+        refList_clear(&children);
+        return NULL;
+    }
+    refList_clear(&e->children);
+    e->children = children;
+    e->childrenAt = stats_now();
+    return e;
+}
+
+#if UACONSOLE_WITH_ASYNC
+typedef struct {
+    Shell *shell;
+    size_t count;
+    UA_NodeId nodeIds[];
+} ShellPrefetch;
+
+static void shellPrefetchCallback(UA_Client *client, void *userdata, UA_UInt32 requestId,
+                                  UA_BrowseResponse *response) {
+    (void)client;
+    (void)requestId;
+    ShellPrefetch *req = (ShellPrefetch*)userdata;
+    Shell *shell = req->shell;
+    shell->prefetches--;
+    for (size_t i = 0; i < req->count; i++) {
+        size_t slot = nodeIndex_find(&shell->index, &req->nodeIds[i]);
+        ShellEntry *e = slot != NODEINDEX_EMPTY ? &shell->entries[slot] : NULL;
+        if (e)
+            e->prefetching = 0;
+        if (i < response->resultsSize) {
+            UA_BrowseResult *result = &response->results[i];
+            // Partial results are not cached; the rest is released later
+            if (result->continuationPoint.length > 0) {
+                UA_ByteString *orphans = (UA_ByteString*)realloc(shell->orphans,
+                    (shell->orphansSize + 1) * sizeof(UA_ByteString));
+                if (orphans) {
+                    shell->orphans = orphans;
+                    shell->orphans[shell->orphansSize++] = result->continuationPoint;
+                    UA_ByteString_init(&result->continuationPoint);
+                }
+            } else if (e && result->statusCode == UA_STATUSCODE_GOOD &&
+                       !shell_fresh(e->childrenAt, SHELL_REFERENCES_TTL_US)) {
+                refList_clear(&e->children);
+                refList_take(&e->children, result);
+                if (e->children.status == UA_STATUSCODE_GOOD)
+                    e->childrenAt = stats_now();
+                else
+                    refList_clear(&e->children);
+            }
+        }
+        UA_NodeId_clear(&req->nodeIds[i]);
+    }
+    free(req);
+}
+
+// Browse the Objects below a listed node in the background; responses are
+// processed while the shell waits for input
+static void shell_prefetch(Shell *shell, const ShellEntry *dir) {
+    size_t chunk = shell->opts->sizes.browse;
+    ShellPrefetch *req = NULL;
+    for (size_t i = 0; i <= dir->children.size; i++) {
+        const UA_ReferenceDescription *ref = i < dir->children.size ? &dir->children.refs[i] : NULL;
+        if (ref && (ref->nodeClass == UA_NODECLASS_OBJECT || ref->nodeClass == UA_NODECLASS_VIEW) &&
+            acceptReference(shell->opts, ref)) {
+            ShellEntry *e = shell_entry(shell, &ref->nodeId.nodeId);
+            if (!e || e->prefetching || shell_fresh(e->childrenAt, SHELL_REFERENCES_TTL_US))
+                continue;
+            if (!req) {
+                req = (ShellPrefetch*)malloc(sizeof(ShellPrefetch) + chunk * sizeof(UA_NodeId));
+                if (!req)
+                    return;
+                req->shell = shell;
+                req->count = 0;
+            }
+            UA_NodeId_copy(&ref->nodeId.nodeId, &req->nodeIds[req->count++]);
+            e->prefetching = 1;
+        }
+        if (!req || (ref && req->count < chunk))
+            continue;
+        
+        UA_BrowseRequest bReq;
+        UA_BrowseRequest_init(&bReq);
+        bReq.requestedMaxReferencesPerNode = shell->opts->maxReferencesPerNode;
+        bReq.nodesToBrowse = (UA_BrowseDescription*)
+            UA_Array_new(req->count, &UA_TYPES[UA_TYPES_BROWSEDESCRIPTION]);
+        UA_StatusCode retval = UA_STATUSCODE_BADOUTOFMEMORY;
+        if (bReq.nodesToBrowse) {
+            bReq.nodesToBrowseSize = req->count;
+            for (size_t k = 0; k < req->count; k++) {
+                UA_NodeId_copy(&req->nodeIds[k], &bReq.nodesToBrowse[k].nodeId);
+                initBrowseDescription(&bReq.nodesToBrowse[k], shell->opts);
+            }
+            retval = UA_Client_sendAsyncBrowseRequest(shell->client, &bReq, shellPrefetchCallback, req, NULL);
+        }
+        UA_BrowseRequest_clear(&bReq);
+        if (retval != UA_STATUSCODE_GOOD) {
+            for (size_t k = 0; k < req->count; k++) {
+                size_t slot = nodeIndex_find(&shell->index, &req->nodeIds[k]);
+                if (slot != NODEINDEX_EMPTY)
+                    shell->entries[slot].prefetching = 0;
+                UA_NodeId_clear(&req->nodeIds[k]);
+            }
+            free(req);
+        } else {
+            shell->prefetches++;
+        }
+        req = NULL;
+    }
+}
+#endif
+
+// Copy a path item; traversal_push moves its arguments
+static int shell_pushCopy(TraversalStack *path, const UA_NodeId *nodeId,
+                          const UA_QualifiedName *browseName, UA_NodeClass nodeClass, int depth) {
+    UA_NodeId id;
+    UA_QualifiedName name;
+    UA_NodeId_init(&id);
+    UA_QualifiedName_init(&name);
+    if (UA_NodeId_copy(nodeId, &id) != UA_STATUSCODE_GOOD ||
+        UA_QualifiedName_copy(browseName, &name) != UA_STATUSCODE_GOOD ||
+        !traversal_push(path, &id, &name, nodeClass, depth)) {
+        UA_NodeId_clear(&id);
+        UA_QualifiedName_clear(&name);
+        return 0;
+    }
+    return 1;
+}
+
+static void shell_popPath(TraversalStack *path) {
+    TraversalItem *item = &path->items[--path->size];
+    UA_NodeId_clear(&item->nodeId);
+    UA_QualifiedName_clear(&item->browseName);
+}
+
+// Resolve a path of BrowseNames separated by '/' relative to the current
+// location ("/" is the root, ".." the parent), or a NodeId such as
+// "ns=2;s=Pump1". Returns 1 with the resolved location in path.
+static int shell_resolve(Shell *shell, const char *text, TraversalStack *path) {
+    memset(path, 0, sizeof(TraversalStack));
+    UA_NodeId nodeId;
+    if (strchr(text, '=') && UA_NodeId_parse(&nodeId, UA_STRING((char*)(uintptr_t)text)) == UA_STATUSCODE_GOOD) {
+        UA_ReferenceDescription ref;
+        UA_StatusCode retval = readRootReference(shell->client, nodeId, &ref);
+        UA_NodeId_clear(&nodeId);
+        if (retval != UA_STATUSCODE_GOOD) {
+            printf("Error: %s: %s\n", text, UA_StatusCode_name(retval));
+            return 0;
+        }
+        int ok = traversal_push(path, &ref.nodeId.nodeId, &ref.browseName, ref.nodeClass, 0);
+        UA_ReferenceDescription_clear(&ref);
+        return ok;
+    }
+    
+    size_t keep = text[0] == '/' ? 1 : shell->cwd.size;
+    for (size_t i = 0; i < keep; i++) {
+        const TraversalItem *item = &shell->cwd.items[i];
+        if (!shell_pushCopy(path, &item->nodeId, &item->browseName, item->nodeClass, (int)i)) {
+            traversal_clear(path);
+            return 0;
+        }
+    }
+    
+    while (*text) {
+        while (*text == '/')
+            text++;
+        size_t len = strcspn(text, "/");
+        if (len == 0)
+            break;
+        if (len == 2 && strncmp(text, "..", 2) == 0) {
+            if (path->size > 1)
+                shell_popPath(path);
+        } else if (!(len == 1 && text[0] == '.')) {
+            const TraversalItem *at = &path->items[path->size - 1];
+            ShellEntry *dir = shell_children(shell, &at->nodeId);
+            const UA_ReferenceDescription *match = NULL;
+            for (size_t pass = 0; dir && pass < 2 && !match; pass++) {
+                for (size_t i = 0; i < dir->children.size && !match; i++) {
+                    const UA_String *name = &dir->children.refs[i].browseName.name;
+                    if (name->length == len &&
+                        (pass == 0 ? strncmp : strncasecmp)((const char*)name->data, text, len) == 0)
+                        match = &dir->children.refs[i];
+                }
+            }
+            if (!match) {
+                printf("Error: No node '%.*s'\n", (int)len, text);
+                traversal_clear(path);
+                return 0;
+            }
+            if (!shell_pushCopy(path, &match->nodeId.nodeId, &match->browseName, match->nodeClass,
+                                (int)path->size)) {
+                traversal_clear(path);
+                return 0;
+            }
+        }
+        text += len;
+    }
+    return 1;
+}
+
+static void shell_printPath(const TraversalStack *path) {
+    for (size_t i = 0; i < path->size; i++) {
+        const UA_String *name = &path->items[i].browseName.name;
+        printf("%s%.*s", i > 0 ? "/" : "", (int)name->length, (const char*)name->data);
+    }
+}
+
+static void shell_emit(Shell *shell, const UA_ReferenceDescription *ref, const UA_NodeId *parentId,
+                       const UA_DataValue *value) {
+    NodeRecord rec;
+    memset(&rec, 0, sizeof(NodeRecord));
+    rec.nodeId = &ref->nodeId.nodeId;
+    rec.browseName = &ref->browseName;
+    rec.nodeClass = ref->nodeClass;
+    rec.parentId = parentId;
+    rec.value = value;
+    emitNode(shell->opts->out, shell->opts->format, &rec);
+}
+
+// ls: children of a node, with the values of Variables read in batches
+// where the cache has none within the TTL
+static void shell_list(Shell *shell, const UA_NodeId *nodeId) {
+    ShellEntry *dir = shell_children(shell, nodeId);
+    if (!dir)
+        return;
+    size_t count = dir->children.size;
+    UA_DataValue *values = (UA_DataValue*)calloc(count ? count : 1, sizeof(UA_DataValue));
+    size_t *missing = (size_t*)malloc((count ? count : 1) * sizeof(size_t));
+    if (!values || !missing) {
+        printf("Error: Out of memory\n");
+        free(values);
+        free(missing);
+        return;
+    }
+    
+    size_t missingSize = 0;
+    for (size_t i = 0; i < count; i++) {
+        const UA_ReferenceDescription *ref = &dir->children.refs[i];
+        if (ref->nodeClass != UA_NODECLASS_VARIABLE)
+            continue;
+        ShellEntry *e = shell_entry(shell, &ref->nodeId.nodeId);
+        if (e && shell_fresh(e->valueAt, SHELL_VALUE_TTL_US)) {
+            UA_DataValue_copy(&e->value, &values[i]);
+            shell->hits++;
+        } else {
+            missing[missingSize++] = i;
+            shell->misses++;
+        }
+    }
+    
+    size_t chunk = shell->opts->sizes.read;
+    for (size_t start = 0; start < missingSize; start += chunk) {
+        size_t n = missingSize - start < chunk ? missingSize - start : chunk;
+        UA_ReadRequest rReq;
+        UA_ReadRequest_init(&rReq);
+        rReq.timestampsToReturn = UA_TIMESTAMPSTORETURN_BOTH;
+        rReq.nodesToRead = (UA_ReadValueId*)UA_Array_new(n, &UA_TYPES[UA_TYPES_READVALUEID]);
+        if (!rReq.nodesToRead)
+            break;
+        rReq.nodesToReadSize = n;
+        for (size_t k = 0; k < n; k++) {
+            UA_NodeId_copy(&dir->children.refs[missing[start + k]].nodeId.nodeId, &rReq.nodesToRead[k].nodeId);
+            rReq.nodesToRead[k].attributeId = UA_ATTRIBUTEID_VALUE;
+        }
+        UA_ReadResponse rResp = timedRead(shell->client, rReq);
+        UA_ReadRequest_clear(&rReq);
+        for (size_t k = 0; k < n; k++) {
+            UA_DataValue *dv = &values[missing[start + k]];
+            if (k < rResp.resultsSize) {
+                *dv = rResp.results[k];
+                UA_DataValue_init(&rResp.results[k]);
+                ShellEntry *e = shell_entry(shell, &dir->children.refs[missing[start + k]].nodeId.nodeId);
+                if (e) {
+                    UA_DataValue_clear(&e->value);
+                    UA_DataValue_copy(dv, &e->value);
+                    e->valueAt = stats_now();
+                }
+            } else {
+                dv->hasStatus = true;
+                dv->status = rResp.responseHeader.serviceResult;
+            }
+        }
+        UA_ReadResponse_clear(&rResp);
+    }
+    
+    beginOutput(shell->opts->out, shell->opts->format, 0, NULL);
+    for (size_t i = 0; i < count; i++) {
+        const UA_ReferenceDescription *ref = &dir->children.refs[i];
+        if (acceptReference(shell->opts, ref))
+            shell_emit(shell, ref, nodeId, ref->nodeClass == UA_NODECLASS_VARIABLE ? &values[i] : NULL);
+        UA_DataValue_clear(&values[i]);
+    }
+    out_flush(shell->opts->out);
+    fflush(shell->opts->out->fp);
+    free(values);
+    free(missing);
+#if UACONSOLE_WITH_ASYNC
+    shell_prefetch(shell, dir);
+#endif
+}
+
+// read: Value and the --attributes of one node, always from the server
+static void shell_read(Shell *shell, const TraversalItem *item) {
+    UA_DataValue value;
+    UA_DataValue attributes[MAX_EXTRA_ATTRIBUTES];
+    readValue(shell->client, &item->nodeId, &shell->opts->attributes, &value, attributes);
+    NodeRecord rec;
+    memset(&rec, 0, sizeof(NodeRecord));
+    rec.nodeId = &item->nodeId;
+    rec.browseName = &item->browseName;
+    rec.nodeClass = item->nodeClass;
+    rec.value = &value;
+    rec.attributeSet = &shell->opts->attributes;
+    rec.attributes = attributes;
+    emitNode(shell->opts->out, shell->opts->format, &rec);
+    out_flush(shell->opts->out);
+    fflush(shell->opts->out->fp);
+    
+    ShellEntry *e = shell_entry(shell, &item->nodeId);
+    if (e) {
+        UA_DataValue_clear(&e->value);
+        UA_DataValue_copy(&value, &e->value);
+        e->valueAt = stats_now();
+    }
+    UA_DataValue_clear(&value);
+    for (size_t i = 0; i < shell->opts->attributes.count; i++)
+        UA_DataValue_clear(&attributes[i]);
+}
+
+// watch: print the value of one node every intervalMs until Ctrl+C
+static void shell_watch(Shell *shell, const TraversalItem *item, int intervalMs) {
+    AttributeSet valueOnly;
+    memset(&valueOnly, 0, sizeof(AttributeSet));
+    printf("Watching every %d ms, Ctrl+C to stop\n", intervalMs);
+    fflush(stdout);
+    monitorRunning = 1;
+    signal(SIGINT, monitorStop);
+    while (monitorRunning) {
+        UA_DataValue value;
+        readValue(shell->client, &item->nodeId, &valueOnly, &value, NULL);
+        NodeRecord rec;
+        memset(&rec, 0, sizeof(NodeRecord));
+        rec.nodeId = &item->nodeId;
+        rec.browseName = &item->browseName;
+        rec.nodeClass = item->nodeClass;
+        rec.value = &value;
+        if (shell->opts->format == FORMAT_TREE) {
+            out_isotime(shell->opts->out, value.hasSourceTimestamp ? value.sourceTimestamp : UA_DateTime_now());
+            out_char(shell->opts->out, ' ');
+        }
+        emitNode(shell->opts->out, shell->opts->format, &rec);
+        out_flush(shell->opts->out);
+        fflush(shell->opts->out->fp);
+        UA_DataValue_clear(&value);
+        if (monitorRunning)
+            usleep((useconds_t)intervalMs * 1000);
+    }
+    signal(SIGINT, SIG_DFL);
+    printf("\n");
+}
+
+// find: breadth-first search below the current location for BrowseNames
+// containing the pattern, at most SHELL_FIND_DEPTH levels deep. Nodes
+// browsed on the way stay in the cache for later ls and cd.
+static void shell_find(Shell *shell, const char *pattern) {
+    const TraversalItem *at = &shell->cwd.items[shell->cwd.size - 1];
+    size_t plen = strlen(pattern);
+    size_t found = 0;
+    NodeIndex seen;
+    memset(&seen, 0, sizeof(NodeIndex));
+    TraversalStack frontier;
+    memset(&frontier, 0, sizeof(TraversalStack));
+    if (!shell_pushCopy(&frontier, &at->nodeId, &at->browseName, at->nodeClass, 0))
+        return;
+    nodeIndex_insert(&seen, &at->nodeId, 0);
+    
+    // The frontier is consumed in insertion order without popping
+    for (size_t next = 0; next < frontier.size; next++) {
+        if (frontier.items[next].depth >= SHELL_FIND_DEPTH)
+            continue;
+        // A shallow copy stays valid when the frontier grows
+        UA_NodeId parentId = frontier.items[next].nodeId;
+        int depth = frontier.items[next].depth;
+        ShellEntry *dir = shell_children(shell, &parentId);
+        for (size_t i = 0; dir && i < dir->children.size; i++) {
+            const UA_ReferenceDescription *ref = &dir->children.refs[i];
+            if (!acceptReference(shell->opts, ref) ||
+                nodeIndex_find(&seen, &ref->nodeId.nodeId) != NODEINDEX_EMPTY)
+                continue;
+            nodeIndex_insert(&seen, &ref->nodeId.nodeId, seen.size);
+            
+            const UA_String *name = &ref->browseName.name;
+            for (size_t k = 0; k + plen <= name->length; k++) {
+                if (strncasecmp((const char*)&name->data[k], pattern, plen) == 0) {
+                    shell_emit(shell, ref, &parentId, NULL);
+                    found++;
+                    break;
+                }
+            }
+            if ((ref->nodeClass == UA_NODECLASS_OBJECT || ref->nodeClass == UA_NODECLASS_VIEW) &&
+                !shell_pushCopy(&frontier, &ref->nodeId.nodeId, &ref->browseName, ref->nodeClass, depth + 1))
+                break;
+        }
+    }
+    out_flush(shell->opts->out);
+    fflush(shell->opts->out->fp);
+    printf("%zu matches in %zu nodes searched\n", found, seen.size);
+    traversal_clear(&frontier);
+    nodeIndex_clear(&seen);
+}
+
+// Read one command line. While none is complete, the background
+// prefetches are delivered by iterating the client.
+static int shell_readLine(Shell *shell, char *line, size_t size) {
+    for (;;) {
+        char *nl = (char*)memchr(shell->input, '\n', shell->inputSize);
+        if (nl || shell->inputSize == sizeof(shell->input)) {
+            size_t len = nl ? (size_t)(nl - shell->input) : shell->inputSize;
+            size_t copy = len < size - 1 ? len : size - 1;
+            memcpy(line, shell->input, copy);
+            line[copy] = '\0';
+            size_t consumed = nl ? len + 1 : len;
+            memmove(shell->input, &shell->input[consumed], shell->inputSize - consumed);
+            shell->inputSize -= consumed;
+            return 1;
+        }
+        
+        struct pollfd pfd;
+        pfd.fd = STDIN_FILENO;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, 50) == 0) {
+            UA_Client_run_iterate(shell->client, 0);
+            continue;
+        }
+        ssize_t n = read(STDIN_FILENO, &shell->input[shell->inputSize],
+                         sizeof(shell->input) - shell->inputSize);
+        if (n <= 0) {
+            // End of input; a last line without newline still counts
+            if (shell->inputSize == 0)
+                return 0;
+            shell->input[shell->inputSize] = '\n';
+            n = 1;
+        }
+        shell->inputSize += (size_t)n;
+    }
+}
+
+static void shell_help(void) {
+    printf("Commands:\n");
+    printf("  ls [PATH]         List the children of a node, with Variable values\n");
+    printf("  cd [PATH]         Change the current node (no PATH: the root)\n");
+    printf("  pwd               Print the current path and NodeId\n");
+    printf("  read PATH         Read the Value (and --attributes) of a node\n");
+    printf("  watch PATH [MS]   Read a value every MS milliseconds until Ctrl+C\n");
+    printf("  find TEXT         Search BrowseNames below the current node\n");
+    printf("  help, quit\n");
+    printf("PATH is BrowseNames separated by '/', '..' for the parent, a leading '/'\n");
+    printf("for the root, or a NodeId such as ns=2;s=Pump1\n\n");
+}
+
+// Entry point of --shell: browse interactively from the root. Children are
+// fetched only when a node is listed or entered, the Objects below a
+// listed node are browsed in the background, and references and values
+// are cached (LRU, with a TTL each) so repeated commands stay local.
+static void runShell(UA_Client *client, UA_NodeId rootId, const ScanOptions *opts) {
+    Shell shell;
+    memset(&shell, 0, sizeof(Shell));
+    shell.client = client;
+    shell.opts = opts;
+    shell.tick = 1;
+    shell.entries = (ShellEntry*)calloc(SHELL_CACHE_ENTRIES, sizeof(ShellEntry));
+    if (!shell.entries) {
+        printf("Error: Out of memory\n");
+        return;
+    }
+    UA_ReferenceDescription root;
+    if (readRootReference(client, rootId, &root) != UA_STATUSCODE_GOOD) {
+        free(shell.entries);
+        return;
+    }
+    traversal_push(&shell.cwd, &root.nodeId.nodeId, &root.browseName, root.nodeClass, 0);
+    UA_ReferenceDescription_clear(&root);
+    shell_help();
+    
+    char line[1024];
+    while (shell.cwd.size > 0) {
+        if (shell.orphansSize > 0) {
+            releaseContinuationPoints(client, shell.orphans, shell.orphansSize);
+            for (size_t i = 0; i < shell.orphansSize; i++)
+                UA_ByteString_clear(&shell.orphans[i]);
+            shell.orphansSize = 0;
+        }
+        shell_printPath(&shell.cwd);
+        printf("> ");
+        fflush(stdout);
+        if (!shell_readLine(&shell, line, sizeof(line)))
             break;
-        case UA_NODECLASS_DATATYPE:
-            printf(" (DataType)\n");
+        shell.tick++;
+        
+        char *command = line;
+        while (*command == ' ' || *command == '\t')
+            command++;
+        char *arg = command + strcspn(command, " \t");
+        if (*arg)
+            *arg++ = '\0';
+        while (*arg == ' ' || *arg == '\t')
+            arg++;
+        size_t argLen = strlen(arg);
+        while (argLen > 0 && (arg[argLen - 1] == ' ' || arg[argLen - 1] == '\t' || arg[argLen - 1] == '\r'))
+            arg[--argLen] = '\0';
+        
+        if (*command == '\0') {
+            continue;
+        } else if (strcmp(command, "quit") == 0 || strcmp(command, "exit") == 0) {
             break;
-        case UA_NODECLASS_VIEW:
-            printf(" (View)\n");
+        } else if (strcmp(command, "help") == 0) {
+            shell_help();
+            continue;
+        } else if (strcmp(command, "pwd") == 0) {
+            char storage[FIELD_BUFFER_SIZE];
+            OutBuf tmp;
+            out_init(&tmp, storage, sizeof(storage), NULL);
+            out_nodeid(&tmp, &shell.cwd.items[shell.cwd.size - 1].nodeId);
+            shell_printPath(&shell.cwd);
+            printf("  [%.*s]\n", (int)tmp.size, tmp.data);
+            continue;
+        } else if (strcmp(command, "find") == 0) {
+            if (*arg)
+                shell_find(&shell, arg);
+            else
+                printf("Error: find needs a search text\n");
+            continue;
+        }
+        
+        // watch takes an optional interval after the path
+        int intervalMs = 1000;
+        if (strcmp(command, "watch") == 0) {
+            char *last = strrchr(arg, ' ');
+            if (last && atoi(last + 1) > 0) {
+                intervalMs = atoi(last + 1);
+                *last = '\0';
+            }
+        }
+        
+        TraversalStack path;
+        if (!shell_resolve(&shell, *arg ? arg : (strcmp(command, "cd") == 0 ? "/" : "."), &path))
+            continue;
+        const TraversalItem *target = &path.items[path.size - 1];
+        int folder = target->nodeClass == UA_NODECLASS_OBJECT || target->nodeClass == UA_NODECLASS_VIEW;
+        if (strcmp(command, "ls") == 0) {
+            if (folder)
+                shell_list(&shell, &target->nodeId);
+            else
+                shell_read(&shell, target);
+        } else if (strcmp(command, "cd") == 0) {
+            if (folder) {
+                traversal_clear(&shell.cwd);
+                shell.cwd = path;
+                memset(&path, 0, sizeof(TraversalStack));
+            } else {
+                printf("Error: %s is a %s\n", arg, nodeClassName(target->nodeClass));
+            }
+        } else if (strcmp(command, "read") == 0) {
+            shell_read(&shell, target);
+        } else if (strcmp(command, "watch") == 0) {
+            shell_watch(&shell, target, intervalMs);
+        } else {
+            printf("Unknown command: %s (try help)\n", command);
+        }
+        traversal_clear(&path);
+    }
+    
+    // Prefetch callbacks write into the cache: let them arrive, or cancel
+    // them by disconnecting, while it still exists
+    int connected = 1;
+    while (shell.prefetches > 0) {
+        if (UA_Client_run_iterate(client, 100) != UA_STATUSCODE_GOOD) {
+            UA_Client_disconnect(client);
+            connected = 0;
             break;
-        default:
-            printf(" (Unknown)\n");
+        }
     }
+    if (connected)
+        releaseContinuationPoints(client, shell.orphans, shell.orphansSize);
     
-    UA_QualifiedName_clear(&browseName);
+    if (opts->verbose)
+        printf("\nNode cache: %zu entries, %zu hits, %zu misses\n", shell.used, shell.hits, shell.misses);
+    for (size_t i = 0; i < SHELL_CACHE_ENTRIES; i++)
+        shellEntry_clear(&shell.entries[i]);
+    free(shell.entries);
+    for (size_t i = 0; i < shell.orphansSize; i++)
+        UA_ByteString_clear(&shell.orphans[i]);
+    free(shell.orphans);
+    nodeIndex_clear(&shell.index);
+    traversal_clear(&shell.cwd);
+}
+
+#endif
+
+// ========== OPTION PARSING ==========
+
+// Reference type filter: a well-known name or a NodeId
+static int parseReferenceType(const char *text, UA_NodeId *referenceTypeId) {
+    static const struct {
+        const char *name;
+        UA_UInt32 id;
+    } known[] = {
+        {"hierarchical", UA_NS0ID_HIERARCHICALREFERENCES},
+        {"organizes", UA_NS0ID_ORGANIZES},
+        {"aggregates", UA_NS0ID_AGGREGATES},
+        {"components", UA_NS0ID_HASCOMPONENT},
+        {"properties", UA_NS0ID_HASPROPERTY}
+    };
     
-    // Recursive traversal of child nodes (only for objects)
-    if (nodeClass == UA_NODECLASS_OBJECT || nodeClass == UA_NODECLASS_VIEW) {
-        UA_BrowseRequest bReq;
-        UA_BrowseRequest_init(&bReq);
-        bReq.nodesToBrowse = UA_BrowseDescription_new();
-        bReq.nodesToBrowseSize = 1;
-        bReq.nodesToBrowse[0].nodeId = nodeId;
-        bReq.nodesToBrowse[0].resultMask = UA_BROWSERESULTMASK_ALL;
-        
-        UA_BrowseResponse bResp = UA_Client_Service_browse(client, bReq);
-        
-        if (bResp.resultsSize > 0 && bResp.results[0].referencesSize > 0) {
-            if (verbose && depth == 0) {
-                printf("  Found %zu references to browse\n", bResp.results[0].referencesSize);
-            }
-            for (size_t i = 0; i < bResp.results[0].referencesSize; i++) {
-                if (bResp.results[0].references[i].isForward) {
-                    browseAndReadNode(client, bResp.results[0].references[i].nodeId.nodeId, depth + 1, verbose);
-                }
+    UA_NodeId_init(referenceTypeId);
+    if (strcasecmp(text, "all") == 0)
+        return 1;
+    for (size_t i = 0; i < sizeof(known) / sizeof(known[0]); i++) {
+        if (strcasecmp(text, known[i].name) == 0) {
+            *referenceTypeId = UA_NODEID_NUMERIC(0, known[i].id);
+            return 1;
+        }
+    }
+    return UA_NodeId_parse(referenceTypeId, UA_STRING((char*)(uintptr_t)text)) == UA_STATUSCODE_GOOD;
+}
+
+// Comma-separated NodeClass names as printed in the listing
+static int parseNodeClassMask(const char *text, UA_UInt32 *mask) {
+    static const UA_NodeClass classes[] = {
+        UA_NODECLASS_OBJECT, UA_NODECLASS_VARIABLE, UA_NODECLASS_METHOD,
+        UA_NODECLASS_OBJECTTYPE, UA_NODECLASS_VARIABLETYPE, UA_NODECLASS_REFERENCETYPE,
+        UA_NODECLASS_DATATYPE, UA_NODECLASS_VIEW
+    };
+    
+    *mask = 0;
+    while (*text) {
+        const char *end = strchr(text, ',');
+        size_t len = end ? (size_t)(end - text) : strlen(text);
+        size_t i = 0;
+        for (; i < sizeof(classes) / sizeof(classes[0]); i++) {
+            const char *name = nodeClassName(classes[i]);
+            if (strlen(name) == len && strncasecmp(text, name, len) == 0)
+                break;
+        }
+        if (i == sizeof(classes) / sizeof(classes[0]))
+            return 0;
+        *mask |= (UA_UInt32)classes[i];
+        text += len;
+        if (*text == ',')
+            text++;
+    }
+    return *mask != 0;
+}
+
+// Parse a comma-separated --attributes list; "all" selects every
+// attribute and the timestamps. Attributes are read in list order.
+static int parseAttributeList(const char *text, AttributeSet *attrs) {
+    memset(attrs, 0, sizeof(AttributeSet));
+    while (*text) {
+        const char *end = strchr(text, ',');
+        size_t len = end ? (size_t)(end - text) : strlen(text);
+        if (len == 3 && strncasecmp(text, "all", 3) == 0) {
+            attrs->count = MAX_EXTRA_ATTRIBUTES;
+            for (size_t i = 0; i < MAX_EXTRA_ATTRIBUTES; i++)
+                attrs->ids[i] = attributeNames[i].id;
+            attrs->timestamps = 1;
+        } else if (len == 10 && strncasecmp(text, "timestamps", 10) == 0) {
+            attrs->timestamps = 1;
+        } else {
+            size_t i = 0;
+            for (; i < MAX_EXTRA_ATTRIBUTES; i++) {
+                const char *name = attributeNames[i].option;
+                if (strlen(name) == len && strncasecmp(text, name, len) == 0)
+                    break;
             }
+            if (i == MAX_EXTRA_ATTRIBUTES)
+                return 0;
+            size_t k = 0;
+            while (k < attrs->count && attrs->ids[k] != attributeNames[i].id)
+                k++;
+            if (k == attrs->count)
+                attrs->ids[attrs->count++] = attributeNames[i].id;
         }
-        
-        UA_BrowseResponse_clear(&bResp);
-        UA_BrowseRequest_clear(&bReq);
+        text += len;
+        if (*text == ',')
+            text++;
     }
+    return attrs->count > 0 || attrs->timestamps;
 }
 
 // ========== HELP FUNCTION ==========
@@ -235,12 +8005,138 @@ void print_help(const char* program_name) {
     printf("Options:\n");
     printf("  -h, --help           Show this help message\n");
     printf("  -v, --verbose        Enable verbose output\n");
-    printf("  -t, --timeout N      Set connection timeout in ms (default: 5000)\n\n");
+    printf("  -t, --timeout N      Set connection timeout in ms (default: 5000)\n");
+    printf("  -b, --batched        Breadth-first traversal with batched Browse/Read requests\n");
+    printf("  --batch-size N       Max nodes per batched request (default: %d,\n", DEFAULT_BATCH_SIZE);
+    printf("                       further capped by the server's OperationLimits,\n");
+    printf("                       continuation points and message size)\n");
+    printf("  --max-refs N         Max references per node in one Browse response\n");
+    printf("                       (default: 0 = server decides, rest via BrowseNext)\n");
+#if UACONSOLE_WITH_ASYNC
+    printf("  --inflight N|auto    Pipelined traversal keeping up to N asynchronous\n");
+    printf("                       Browse/Read requests outstanding (e.g. 32); auto\n");
+    printf("                       sizes the window from the server's limits\n");
+#endif
+    printf("  --sessions N         Parallel traversal over N sessions, one worker\n");
+    printf("                       thread each, sharing work by stealing subtrees\n");
+    printf("  --format-threads N   Format the listing of the batched, pipelined and\n");
+    printf("                       parallel engines on N threads, decoupled from\n");
+    printf("                       the network thread (large scans only)\n");
+    printf("  --root NODEID        Start at this node instead of the Objects folder\n");
+    printf("                       (e.g. \"ns=2;s=Line1\")\n");
+    printf("  --max-depth N        Expand at most N levels below the root\n");
+    printf("  --ns N               Only follow nodes of namespace N\n");
+    printf("  --ref-type T         Follow only references of type T and its subtypes:\n");
+    printf("                       hierarchical, organizes, aggregates, components,\n");
+    printf("                       properties, all (default) or a NodeId\n");
+    printf("  --no-subtypes        Do not include subtypes of --ref-type\n");
+    printf("  --node-class LIST    Only list these NodeClasses, e.g. Variable,Method;\n");
+    printf("                       Objects and Views are always followed\n");
+    printf("  --backrefs           Print repeated nodes as back-references\n");
+    printf("                       (default: each node is listed once)\n");
+    printf("  --attributes LIST    Read these attributes of each Variable in the same\n");
+    printf("                       request as its Value: datatype, valuerank,\n");
+    printf("                       arraydimensions, accesslevel, useraccesslevel,\n");
+    printf("                       minsampling, historizing, displayname, description,\n");
+    printf("                       timestamps (tree listing) or all\n");
+    printf("  --max-array N        Print at most N elements of array values\n");
+    printf("                       (default: %d, 0 = all)\n", VALUE_ARRAY_LIMIT);
+    printf("  --stats              Print per-service latency percentiles, request and\n");
+    printf("                       byte counts and throughput to stderr at exit\n");
+    printf("  --adaptive           Grow and shrink batch sizes, the in-flight window and\n");
+    printf("                       active sessions with the server's response latency\n");
+    printf("                       and overload status codes (AIMD), so a scan takes\n");
+    printf("                       no more than the server can sustain\n");
+    printf("  --max-rps N          Send at most N requests per second to a server\n");
+#if UACONSOLE_WITH_EXPORT
+    printf("  -f, --format F       Output format: tree, ndjson or csv (default: tree);\n");
+    printf("                       records go to stdout, messages to stderr; valueType\n");
+    printf("                       is the type of the Value (the node's DataType\n");
+    printf("                       attribute with --attributes datatype)\n");
+#endif
+#if UACONSOLE_WITH_SNAPSHOT
+    printf("  --snapshot FILE      Save the scanned address space to a binary snapshot\n");
+    printf("                       (uses the batched traversal unless another is chosen)\n");
+    printf("  --load FILE          List a snapshot offline, without a server connection\n");
+    printf("  --diff FILE          Re-scan and list only nodes added, removed or changed\n");
+    printf("                       since the snapshot; nodes with an unchanged NodeVersion\n");
+    printf("                       are not browsed again (combine with --snapshot to roll)\n");
+#endif
+#if UACONSOLE_WITH_MONITOR
+    printf("  --monitor            Subscribe to all Variables and stream value changes\n");
+    printf("                       until Ctrl+C\n");
+    printf("  --monitor-list FILE  Monitor the NodeIds listed in FILE, one per line\n");
+    printf("  --sampling MS        Sampling and publishing interval (default: 100)\n");
+    printf("  --queue N            Server-side queue size per item (default: 10)\n");
+    printf("  --deadband X         Absolute deadband for numeric values (default: 0)\n");
+    printf("  --read-list FILE     Register the NodeIds listed in FILE and poll their\n");
+    printf("                       Values with batched Reads until Ctrl+C, for servers\n");
+    printf("                       that do not allow subscriptions\n");
+    printf("  --interval MS        Polling interval for --read-list (default: 1000)\n");
+    printf("  --profile-values     With --monitor or --read-list: collect per-item\n");
+    printf("                       statistics (min/max/mean/stddev, actual versus\n");
+    printf("                       requested interval, timestamp jitter, inter-arrival\n");
+    printf("                       histogram) in bounded memory and report them at the end\n");
+    printf("  --duration S         Stop monitoring or polling after S seconds\n");
+    printf("  --cycles N           Stop --read-list polling after N cycles\n");
+#endif
+    printf("  --targets FILE       Scan every endpoint URL listed in FILE concurrently\n");
+    printf("                       (batched traversal, --timeout applies per target)\n");
+    printf("  --workers N          Targets scanned at the same time (default: 16)\n");
+    printf("  --out-dir DIR        Write one output file per target to DIR instead of\n");
+    printf("                       combined output tagged with the server URL; files\n");
+    printf("                       are named after the URL and a hash of it\n");
+    printf("  --direct             Connect straight to the endpoint cached from an earlier\n");
+    printf("                       run, skipping endpoint discovery (cache: ~/.uaconsole-endpoints)\n");
+    printf("  --endpoint-cache F   Use F as the endpoint cache (implies --direct)\n");
+    printf("  --checkpoint FILE    Save the progress of the depth-first traversal to FILE\n");
+    printf("                       every 30 s; dropped connections are re-established\n");
+    printf("                       with backoff and the scan continues; exits with 1\n");
+    printf("                       if the scan could not finish\n");
+    printf("  --resume             Continue the scan saved in --checkpoint, appending to\n");
+    printf("                       the earlier output\n");
+    printf("  --path PATH          Read only the node at this browse path, e.g.\n");
+    printf("                       \"/Objects/2:Line1/2:Temp\" (from the Root folder) or\n");
+    printf("                       \"2:Line1/2:Temp\" (from --root); may be repeated, all\n");
+    printf("                       paths are resolved and read in batched requests.\n");
+    printf("                       With --monitor the targets are monitored instead\n");
+#if UACONSOLE_WITH_SHELL
+    printf("  --shell              Browse interactively (ls, cd, read, watch, find),\n");
+    printf("                       fetching only the nodes that are looked at\n");
+#endif
+    printf("\n");
     
     printf("Examples:\n");
     printf("  %s opc.tcp://10.0.0.128:4840\n", program_name);
     printf("  %s -v opc.tcp://opcua-esp32:4840\n", program_name);
-    printf("  %s -t 10000 opc.tcp://10.0.0.128:4840\n\n", program_name);
+    printf("  %s -t 10000 opc.tcp://10.0.0.128:4840\n", program_name);
+    printf("  %s -b opc.tcp://10.0.0.128:4840\n", program_name);
+    printf("  %s --root \"ns=2;s=Line1\" --ns 2 --ref-type hierarchical opc.tcp://10.0.0.128:4840\n", program_name);
+#if UACONSOLE_WITH_EXPORT
+    printf("  %s -f ndjson opc.tcp://10.0.0.128:4840 > nodes.ndjson\n", program_name);
+#endif
+#if UACONSOLE_WITH_SNAPSHOT
+    printf("  %s --snapshot plant.uas opc.tcp://10.0.0.128:4840\n", program_name);
+    printf("  %s --load plant.uas\n", program_name);
+    printf("  %s --diff plant.uas --snapshot plant.uas opc.tcp://10.0.0.128:4840\n", program_name);
+#endif
+#if UACONSOLE_WITH_MONITOR
+    printf("  %s --monitor --sampling 50 --deadband 0.5 opc.tcp://10.0.0.128:4840\n", program_name);
+    printf("  %s --read-list tags.txt --interval 100 opc.tcp://10.0.0.128:4840\n", program_name);
+    printf("  %s --monitor --profile-values --duration 3600 -f csv opc.tcp://10.0.0.128:4840 > tags.csv\n", program_name);
+#endif
+#if UACONSOLE_WITH_EXPORT
+    printf("  %s --targets plants.txt --workers 32 -f ndjson > fleet.ndjson\n", program_name);
+#endif
+#if UACONSOLE_WITH_ASYNC
+    printf("  %s --inflight 16 --adaptive --max-rps 50 opc.tcp://10.0.0.128:4840\n", program_name);
+#endif
+    printf("  %s --direct --targets plants.txt --out-dir scans\n", program_name);
+    printf("  %s --checkpoint scan.ckpt --resume opc.tcp://10.0.0.128:4840 >> nodes.txt\n", program_name);
+#if UACONSOLE_WITH_SHELL
+    printf("  %s --shell opc.tcp://10.0.0.128:4840\n", program_name);
+#endif
+    printf("  %s --path /Objects/2:Line1/2:Temp --path /Objects/2:Line1/2:Speed opc.tcp://10.0.0.128:4840\n\n", program_name);
     
     printf("Contact:\n");
     printf("  WeChat: wxid_ic7ytyv3mlh522\n");
@@ -256,7 +8152,7 @@ void print_help(const char* program_name) {
     printf("  # Install library 安装库\n");
     printf("  sudo apt-get install libopen62541-dev\n\n");
     printf("  # Compile 编译\n");
-    printf("  gcc -o uaconsole browse_opc_server.c -lopen62541 -lm\n\n");
+    printf("  gcc -o uaconsole browse_opc_server.c -lopen62541 -lm -lpthread\n\n");
     printf("  # Run 运行\n");
     printf("  ./uaconsole opc.tcp://10.0.0.128:4840\n\n");
     
@@ -277,6 +8173,56 @@ int main(int argc, char* argv[]) {
     char* server_url = "opc.tcp://10.0.0.128:4840";
     int verbose = 0;
     int timeout_ms = 5000;
+    int batched = 0;
+    int batch_size = DEFAULT_BATCH_SIZE;
+    int max_refs = 0;
+    int backrefs = 0;
+    int collect_stats = 0;
+    int adaptive = 0;
+    double max_rps = 0.0;
+    int inflight = 0;
+    int inflight_auto = 0;
+    int sessions = 0;
+    int format_threads = 0;
+    OutputFormat format = FORMAT_TREE;
+    const char *snapshot_path = NULL;
+    const char *load_path = NULL;
+    const char *diff_path = NULL;
+    int monitor = 0;
+    const char *monitor_list = NULL;
+    double sampling_ms = 100.0;
+    int queue_size = 10;
+    double deadband = 0.0;
+    const char *read_list = NULL;
+    int interval_ms = 1000;
+    int profile_values = 0;
+    double duration = 0.0;
+    int cycles = 0;
+    const char *targets_path = NULL;
+    const char *out_dir = NULL;
+    int workers = 16;
+    int direct = 0;
+    const char *endpoint_cache = NULL;
+    const char *checkpoint_path = NULL;
+    int resume = 0;
+    int shell = 0;
+    const char **path_list = (const char**)calloc((size_t)argc, sizeof(char*));
+    size_t path_count = 0;
+    size_t failed_paths = 0;
+    int incomplete = 0;
+    if (!path_list) {
+        printf("Error: Out of memory\n");
+        return 1;
+    }
+    UA_NodeId root_id = UA_NODEID_NUMERIC(0, UA_NS0ID_OBJECTSFOLDER);
+    const char *root_text = NULL;
+    int max_depth = -1;
+    int namespace_index = -1;
+    UA_NodeId reference_type = UA_NODEID_NULL;
+    int exact_reference_type = 0;
+    UA_UInt32 node_class_mask = 0;
+    AttributeSet attributes;
+    memset(&attributes, 0, sizeof(AttributeSet));
     
     // Parse command line arguments
     for (int i = 1; i < argc; i++) {
@@ -296,6 +8242,349 @@ int main(int argc, char* argv[]) {
                 printf("Error: Missing value for timeout\n");
                 return 1;
             }
+        } else if (strcmp(argv[i], "-b") == 0 || strcmp(argv[i], "--batched") == 0) {
+            batched = 1;
+        } else if (strcmp(argv[i], "--batch-size") == 0) {
+            if (i + 1 < argc) {
+                batch_size = atoi(argv[++i]);
+                if (batch_size <= 0) {
+                    printf("Error: Batch size must be positive\n");
+                    return 1;
+                }
+            } else {
+                printf("Error: Missing value for batch size\n");
+                return 1;
+            }
+#if UACONSOLE_WITH_ASYNC
+        } else if (strcmp(argv[i], "--inflight") == 0) {
+            if (i + 1 < argc && strcmp(argv[i + 1], "auto") == 0) {
+                inflight_auto = 1;
+                i++;
+            } else if (i + 1 < argc) {
+                inflight = atoi(argv[++i]);
+                inflight_auto = 0;
+                if (inflight <= 0) {
+                    printf("Error: In-flight window must be positive\n");
+                    return 1;
+                }
+            } else {
+                printf("Error: Missing value for in-flight window\n");
+                return 1;
+            }
+#endif
+        } else if (strcmp(argv[i], "--sessions") == 0) {
+            if (i + 1 < argc) {
+                sessions = atoi(argv[++i]);
+                if (sessions <= 0) {
+                    printf("Error: Session count must be positive\n");
+                    return 1;
+                }
+            } else {
+                printf("Error: Missing value for session count\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--format-threads") == 0) {
+            if (i + 1 < argc) {
+                format_threads = atoi(argv[++i]);
+                if (format_threads <= 0) {
+                    printf("Error: Format thread count must be positive\n");
+                    return 1;
+                }
+            } else {
+                printf("Error: Missing value for format thread count\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-f") == 0 || strcmp(argv[i], "--format") == 0) {
+            if (i + 1 < argc) {
+                const char *name = argv[++i];
+                if (strcmp(name, "tree") == 0) {
+                    format = FORMAT_TREE;
+#if UACONSOLE_WITH_EXPORT
+                } else if (strcmp(name, "ndjson") == 0) {
+                    format = FORMAT_NDJSON;
+                } else if (strcmp(name, "csv") == 0) {
+                    format = FORMAT_CSV;
+#endif
+                } else {
+                    printf("Error: Unknown output format: %s\n", name);
+                    return 1;
+                }
+            } else {
+                printf("Error: Missing value for output format\n");
+                return 1;
+            }
+#if UACONSOLE_WITH_SNAPSHOT
+        } else if (strcmp(argv[i], "--snapshot") == 0) {
+            if (i + 1 < argc) {
+                snapshot_path = argv[++i];
+            } else {
+                printf("Error: Missing value for snapshot file\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--load") == 0) {
+            if (i + 1 < argc) {
+                load_path = argv[++i];
+            } else {
+                printf("Error: Missing value for snapshot file\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--diff") == 0) {
+            if (i + 1 < argc) {
+                diff_path = argv[++i];
+            } else {
+                printf("Error: Missing value for snapshot file\n");
+                return 1;
+            }
+#endif
+#if UACONSOLE_WITH_MONITOR
+        } else if (strcmp(argv[i], "--monitor") == 0) {
+            monitor = 1;
+        } else if (strcmp(argv[i], "--monitor-list") == 0) {
+            if (i + 1 < argc) {
+                monitor = 1;
+                monitor_list = argv[++i];
+            } else {
+                printf("Error: Missing value for NodeId list\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--sampling") == 0) {
+            if (i + 1 < argc) {
+                sampling_ms = atof(argv[++i]);
+                if (sampling_ms < 0) {
+                    printf("Error: Sampling interval must not be negative\n");
+                    return 1;
+                }
+            } else {
+                printf("Error: Missing value for sampling interval\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--queue") == 0) {
+            if (i + 1 < argc) {
+                queue_size = atoi(argv[++i]);
+                if (queue_size <= 0) {
+                    printf("Error: Queue size must be positive\n");
+                    return 1;
+                }
+            } else {
+                printf("Error: Missing value for queue size\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--deadband") == 0) {
+            if (i + 1 < argc) {
+                deadband = atof(argv[++i]);
+                if (deadband < 0) {
+                    printf("Error: Deadband must not be negative\n");
+                    return 1;
+                }
+            } else {
+                printf("Error: Missing value for deadband\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--read-list") == 0) {
+            if (i + 1 < argc) {
+                read_list = argv[++i];
+            } else {
+                printf("Error: Missing value for NodeId list\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--interval") == 0) {
+            if (i + 1 < argc) {
+                interval_ms = atoi(argv[++i]);
+                if (interval_ms <= 0) {
+                    printf("Error: Polling interval must be positive\n");
+                    return 1;
+                }
+            } else {
+                printf("Error: Missing value for polling interval\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--profile-values") == 0) {
+            profile_values = 1;
+        } else if (strcmp(argv[i], "--duration") == 0) {
+            if (i + 1 < argc) {
+                duration = atof(argv[++i]);
+                if (duration <= 0) {
+                    printf("Error: Duration must be positive\n");
+                    return 1;
+                }
+            } else {
+                printf("Error: Missing value for duration\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--cycles") == 0) {
+            if (i + 1 < argc) {
+                cycles = atoi(argv[++i]);
+                if (cycles <= 0) {
+                    printf("Error: Cycle count must be positive\n");
+                    return 1;
+                }
+            } else {
+                printf("Error: Missing value for cycle count\n");
+                return 1;
+            }
+#endif
+        } else if (strcmp(argv[i], "--targets") == 0) {
+            if (i + 1 < argc) {
+                targets_path = argv[++i];
+            } else {
+                printf("Error: Missing value for target list\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--workers") == 0) {
+            if (i + 1 < argc) {
+                workers = atoi(argv[++i]);
+                if (workers <= 0) {
+                    printf("Error: Worker count must be positive\n");
+                    return 1;
+                }
+            } else {
+                printf("Error: Missing value for worker count\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--out-dir") == 0) {
+            if (i + 1 < argc) {
+                out_dir = argv[++i];
+            } else {
+                printf("Error: Missing value for output directory\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--direct") == 0) {
+            direct = 1;
+        } else if (strcmp(argv[i], "--endpoint-cache") == 0) {
+            if (i + 1 < argc) {
+                direct = 1;
+                endpoint_cache = argv[++i];
+            } else {
+                printf("Error: Missing value for endpoint cache\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--checkpoint") == 0) {
+            if (i + 1 < argc) {
+                checkpoint_path = argv[++i];
+            } else {
+                printf("Error: Missing value for checkpoint file\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--resume") == 0) {
+            resume = 1;
+        } else if (strcmp(argv[i], "--path") == 0) {
+            if (i + 1 < argc) {
+                path_list[path_count++] = argv[++i];
+            } else {
+                printf("Error: Missing value for browse path\n");
+                return 1;
+            }
+#if UACONSOLE_WITH_SHELL
+        } else if (strcmp(argv[i], "--shell") == 0) {
+            shell = 1;
+#endif
+        } else if (strcmp(argv[i], "--root") == 0) {
+            if (i + 1 < argc) {
+                root_text = argv[++i];
+                UA_NodeId_clear(&root_id);
+                if (UA_NodeId_parse(&root_id, UA_STRING(argv[i])) != UA_STATUSCODE_GOOD) {
+                    printf("Error: Invalid root NodeId: %s\n", root_text);
+                    return 1;
+                }
+            } else {
+                printf("Error: Missing value for root NodeId\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--max-depth") == 0) {
+            if (i + 1 < argc) {
+                max_depth = atoi(argv[++i]);
+                if (max_depth < 0) {
+                    printf("Error: Max depth must not be negative\n");
+                    return 1;
+                }
+            } else {
+                printf("Error: Missing value for max depth\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--ns") == 0) {
+            if (i + 1 < argc) {
+                namespace_index = atoi(argv[++i]);
+                if (namespace_index < 0 || namespace_index > 65535) {
+                    printf("Error: Namespace index must be 0..65535\n");
+                    return 1;
+                }
+            } else {
+                printf("Error: Missing value for namespace index\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--ref-type") == 0) {
+            if (i + 1 < argc) {
+                UA_NodeId_clear(&reference_type);
+                if (!parseReferenceType(argv[++i], &reference_type)) {
+                    printf("Error: Unknown reference type: %s\n", argv[i]);
+                    return 1;
+                }
+            } else {
+                printf("Error: Missing value for reference type\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--no-subtypes") == 0) {
+            exact_reference_type = 1;
+        } else if (strcmp(argv[i], "--node-class") == 0) {
+            if (i + 1 < argc) {
+                if (!parseNodeClassMask(argv[++i], &node_class_mask)) {
+                    printf("Error: Invalid NodeClass list: %s\n", argv[i]);
+                    return 1;
+                }
+            } else {
+                printf("Error: Missing value for NodeClass list\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--attributes") == 0) {
+            if (i + 1 < argc) {
+                if (!parseAttributeList(argv[++i], &attributes)) {
+                    printf("Error: Invalid attribute list: %s\n", argv[i]);
+                    return 1;
+                }
+            } else {
+                printf("Error: Missing value for attribute list\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--backrefs") == 0) {
+            backrefs = 1;
+        } else if (strcmp(argv[i], "--max-array") == 0) {
+            if (i + 1 < argc) {
+                int limit = atoi(argv[++i]);
+                if (limit < 0) {
+                    printf("Error: Array limit must not be negative\n");
+                    return 1;
+                }
+                valueArrayLimit = (size_t)limit;
+            } else {
+                printf("Error: Missing value for array limit\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            collect_stats = 1;
+        } else if (strcmp(argv[i], "--adaptive") == 0) {
+            adaptive = 1;
+        } else if (strcmp(argv[i], "--max-rps") == 0) {
+            if (i + 1 < argc) {
+                max_rps = atof(argv[++i]);
+                if (max_rps <= 0) {
+                    printf("Error: Request rate must be positive\n");
+                    return 1;
+                }
+            } else {
+                printf("Error: Missing value for request rate\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--max-refs") == 0) {
+            if (i + 1 < argc) {
+                max_refs = atoi(argv[++i]);
+                if (max_refs < 0) {
+                    printf("Error: Max references must not be negative\n");
+                    return 1;
+                }
+            } else {
+                printf("Error: Missing value for max references\n");
+                return 1;
+            }
         } else if (argv[i][0] == '-') {
             printf("Unknown option: %s\n", argv[i]);
             printf("Use %s -h for help\n", argv[0]);
@@ -306,12 +8595,155 @@ int main(int argc, char* argv[]) {
         }
     }
     
+    if ((profile_values || duration > 0.0) && !monitor && !read_list) {
+        printf("Error: --profile-values and --duration need --monitor or --read-list\n");
+        return 1;
+    }
+    if (cycles > 0 && !read_list) {
+        printf("Error: --cycles needs --read-list\n");
+        return 1;
+    }
+    if (resume && !checkpoint_path) {
+        printf("Error: --resume needs --checkpoint FILE\n");
+        return 1;
+    }
+    if (checkpoint_path && (batched || inflight > 0 || inflight_auto || sessions > 1 ||
+                            snapshot_path || load_path || diff_path || monitor || read_list ||
+                            targets_path || shell || path_count > 0)) {
+        printf("Error: --checkpoint is only supported by the default depth-first traversal\n");
+        return 1;
+    }
+    if (path_count > 0 && (read_list || shell || targets_path || load_path)) {
+        printf("Error: --path cannot be combined with --read-list, --shell, --targets or --load\n");
+        return 1;
+    }
+    
+    // ========== OUTPUT STREAM ==========
+    
+    // Machine-readable records get the original stdout to themselves; the
+    // banner, diagnostics and library log lines are sent to stderr
+    FILE *data = stdout;
+    if (format != FORMAT_TREE) {
+        fflush(stdout);
+        int dataFd = dup(STDOUT_FILENO);
+        if (dataFd < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0 ||
+            !(data = fdopen(dataFd, "w"))) {
+            printf("Error: Could not redirect output\n");
+            return 1;
+        }
+    }
+    
+    // Node listing goes through one large buffer, flushed with fwrite when
+    // it fills and at least once a second while records arrive
+    static char out_storage[256 * 1024];
+    OutBuf out;
+    out_init(&out, out_storage, sizeof(out_storage), data);
+    out.flushInterval = OUT_FLUSH_INTERVAL_US;
+    
+    ScanOptions opts;
+    memset(&opts, 0, sizeof(ScanOptions));
+    opts.out = &out;
+    opts.format = format;
+    opts.verbose = verbose;
+    opts.batchSize = (size_t)batch_size;
+    opts.maxReferencesPerNode = (UA_UInt32)max_refs;
+    opts.backReferences = backrefs;
+    opts.inflight = (size_t)inflight;
+    opts.sessions = (size_t)sessions;
+    opts.formatThreads = (size_t)format_threads;
+    opts.serverUrl = server_url;
+    opts.timeoutMs = timeout_ms;
+    opts.snapshotPath = snapshot_path;
+    opts.monitorList = monitor_list;
+    opts.monitorSamplingMs = sampling_ms;
+    opts.monitorQueueSize = (UA_UInt32)queue_size;
+    opts.monitorDeadband = deadband;
+    opts.readList = read_list;
+    opts.pollIntervalMs = interval_ms;
+    opts.duration = duration;
+    opts.cycles = (size_t)cycles;
+    opts.profileValues = profile_values;
+    opts.referenceTypeId = reference_type;
+    opts.exactReferenceType = exact_reference_type;
+    opts.nodeClassMask = node_class_mask;
+    opts.attributes = attributes;
+    opts.maxDepth = max_depth;
+    opts.namespaceIndex = namespace_index;
+    opts.inflightAuto = inflight_auto;
+    opts.checkpointPath = checkpoint_path;
+    opts.paths = path_list;
+    opts.pathCount = path_count;
+    opts.resume = resume;
+    if (collect_stats)
+        stats_start();
+    throttle_configure(adaptive, max_rps);
+    
+    // ========== OFFLINE SNAPSHOT ==========
+    
+#if UACONSOLE_WITH_SNAPSHOT
+    if (load_path) {
+        printf("=== SNAPSHOT %s ===\n", load_path);
+        int loaded = renderSnapshot(load_path, &opts);
+        if (data != stdout)
+            fclose(data);
+        stats_report();
+        return loaded ? 0 : 1;
+    }
+#endif
+    
+    // ========== ENDPOINT CACHE ==========
+    
+    static EndpointCache endpoints;
+    if (direct) {
+        static char default_cache[1024];
+        if (!endpoint_cache) {
+            const char *home = getenv("HOME");
+            snprintf(default_cache, sizeof(default_cache), "%s/.uaconsole-endpoints", home ? home : ".");
+            endpoint_cache = default_cache;
+        }
+        endpointCache_load(&endpoints, endpoint_cache);
+        opts.endpoints = &endpoints;
+        if (verbose)
+            printf("Endpoint cache %s: %zu endpoints\n", endpoint_cache, endpoints.size);
+    }
+    
+    // ========== FLEET SCAN ==========
+    
+    if (targets_path) {
+        if (monitor || read_list || snapshot_path || diff_path) {
+            printf("Error: --targets cannot be combined with --monitor, --read-list, --snapshot or --diff\n");
+            return 1;
+        }
+        printf("=== FLEET SCAN OF %s ===\n", targets_path);
+        size_t failed = scanFleet(targets_path, (size_t)workers, out_dir, root_id, &opts);
+        out_flush(&out);
+        if (data != stdout)
+            fclose(data);
+        if (direct)
+            endpointCache_close(&endpoints);
+        UA_NodeId_clear(&root_id);
+        UA_NodeId_clear(&reference_type);
+        stats_report();
+        return failed > 0 ? 1 : 0;
+    }
+    
+#if UACONSOLE_WITH_SNAPSHOT
+    // The baseline is checked before a connection is made
+    static ScanBaseline baseline;
+    if (diff_path) {
+        if (!baseline_open(&baseline, diff_path))
+            return 1;
+        opts.baseline = &baseline;
+    }
+#endif
+    
     // ========== CLIENT CONFIGURATION ==========
     
-    UA_Client *client = UA_Client_new();
-    UA_ClientConfig *config = UA_Client_getConfig(client);
-    UA_ClientConfig_setDefault(config);
-    config->timeout = timeout_ms;
+    UA_Client *client = createClient(timeout_ms);
+    if (!client) {
+        printf("Error: Could not create client\n");
+        return 1;
+    }
     
     // ========== CONNECTION ==========
     
@@ -327,12 +8759,15 @@ int main(int argc, char* argv[]) {
         printf("Connecting to %s...\n", server_url);
     }
     
-    UA_StatusCode retval = UA_Client_connect(client, server_url);
+    UA_StatusCode retval = connectClient(client, server_url, &opts);
     
     if(retval != UA_STATUSCODE_GOOD) {
         printf("Connection failed: %s (0x%08X)\n", 
                UA_StatusCode_name(retval), retval);
         UA_Client_delete(client);
+        if (direct)
+            endpointCache_close(&endpoints);
+        stats_report();
         return 1;
     }
     
@@ -348,26 +8783,108 @@ int main(int argc, char* argv[]) {
         printf("\n");
     }
     
+    // ========== SERVER LIMITS ==========
+    
+    // One Read of the ServerCapabilities sizes all batched requests
+    ServerLimits limits;
+    discoverServerLimits(client, &limits);
+    chooseBatchSizes(&limits, &opts);
+    if (inflight_auto)
+        inflight = (int)opts.inflight;
+    
     // ========== SERVER BROWSING ==========
     
-    printf("=== RECURSIVE BROWSING OF OBJECTS FOLDER ===\n");
+    // Snapshots are written from the collected graph, which the recursive
+    // traversal does not build
+    if (snapshot_path && sessions <= 1 && inflight <= 0)
+        batched = 1;
     
-    if (verbose) {
-        printf("Starting from ObjectsFolder (ns=0;i=85)\n");
-        printf("Depth-first traversal...\n\n");
+    // The incremental re-scan is part of the batched traversal
+    if (diff_path) {
+        sessions = inflight = 0;
+        opts.sessions = opts.inflight = 0;
+        batched = 1;
     }
     
-    UA_NodeId objectsFolder = UA_NODEID_NUMERIC(0, UA_NS0ID_OBJECTSFOLDER);
-    browseAndReadNode(client, objectsFolder, 0, verbose);
+    const char *mode = sessions > 1 ? "PARALLEL" : inflight > 0 ? "PIPELINED" :
+                       batched ? "BATCHED" : "RECURSIVE";
+    if (shell)
+        printf("=== INTERACTIVE SHELL AT %s ===\n", root_text ? root_text : "OBJECTS FOLDER");
+    else if (read_list)
+        printf("=== REGISTERED POLLING OF %s ===\n", read_list);
+    else if (path_count > 0 && !monitor)
+        printf("=== READING %zu BROWSE PATHS ===\n", path_count);
+    else if (monitor && path_count > 0)
+        printf("=== LIVE MONITORING OF %zu BROWSE PATHS ===\n", path_count);
+    else if (monitor)
+        printf("=== LIVE MONITORING OF %s ===\n", monitor_list ? monitor_list :
+               root_text ? root_text : "OBJECTS FOLDER");
+    else
+        printf("=== %s BROWSING OF %s ===\n", mode, root_text ? root_text : "OBJECTS FOLDER");
+    
+    if (verbose && read_list) {
+        printf("Polling interval: %d ms, up to %zu nodes per Read\n\n", interval_ms, opts.sizes.read);
+    } else if (verbose && monitor) {
+        printf("Sampling interval: %.0f ms, queue size: %d, deadband: %g\n\n",
+               sampling_ms, queue_size, deadband);
+    } else if (verbose) {
+        printf("Starting from %s\n", root_text ? root_text : "ObjectsFolder (ns=0;i=85)");
+        if (sessions > 1)
+            printf("Parallel traversal over %d sessions...\n\n", sessions);
+        else if (inflight > 0)
+            printf("Pipelined traversal, %d requests in flight...\n\n", inflight);
+        else
+            printf("%s traversal...\n\n", batched ? "Breadth-first" : "Depth-first");
+    }
+    
+#if UACONSOLE_WITH_SHELL
+    if (shell)
+        runShell(client, root_id, &opts);
+    else
+#endif
+#if UACONSOLE_WITH_MONITOR
+    if (read_list)
+        pollValues(client, &opts);
+    else if (monitor)
+        monitorValues(client, root_id, &opts);
+    else
+#endif
+    if (path_count > 0)
+        failed_paths = readPaths(client, root_id, &opts);
+    else if (sessions > 1)
+        incomplete = !browseParallel(client, root_id, &opts);
+#if UACONSOLE_WITH_ASYNC
+    else if (inflight > 0)
+        incomplete = !browsePipelined(client, root_id, &opts);
+#endif
+    else if (batched)
+        incomplete = !browseBatched(client, root_id, &opts);
+    else
+        incomplete = !browseAndReadRoot(client, root_id, &opts);
+    out_flush(&out);
+    if (data != stdout)
+        fclose(data);
+#if UACONSOLE_WITH_SNAPSHOT
+    if (diff_path)
+        baseline_close(&baseline);
+#endif
+    UA_NodeId_clear(&root_id);
+    UA_NodeId_clear(&reference_type);
     
     // ========== DISCONNECTION AND CLEANUP ==========
     
     UA_Client_disconnect(client);
     UA_Client_delete(client);
+    if (direct)
+        endpointCache_close(&endpoints);
     
     printf("\n=== BROWSING COMPLETED ===\n");
     printf("Server URL: %s\n", server_url);
     printf("Disconnected from server\n");
+    if (verbose)
+        throttle_report(&mainThrottle);
+    stats_report();
+    free(path_list);
     
-    return 0;
+    return failed_paths > 0 || incomplete ? 1 : 0;
 }